@@ -35,6 +35,8 @@ void rabi::init(double D_E, double wi, double Am){
   params.SetMixingAngle(0,1,params.pi/4);
 
   Set_CoherentRhoTerms(true);
+  //let the library rotate the laser term into the interaction picture
+  Set_InteractionPicture(true);
 
   b0_proj.reset(new SU_vector[nsun]);
   b1_proj.reset(new SU_vector[nsun]);
@@ -49,20 +51,15 @@ void rabi::init(double D_E, double wi, double Am){
   suH0=b0_proj[1]*params.GetEnergyDifference(1);
   
   d0=(b1_proj[0]-b1_proj[1]);
-  d=d0;
 
   // set initial conditions for the density matrix.
   state[0].rho[0] = b0_proj[0];
 }
 
-void rabi::PreDerive(double t){
-  d=d0.Evolve(suH0,t-Get_t_initial());
-}
-
 SU_vector rabi::H0(double x, unsigned int irho) const{
   return suH0;
 }
 
 SU_vector rabi::HI(unsigned int ix, unsigned int irho, double t) const{
-  return (A*cos(w*t))*d;
+  return (A*cos(w*t))*d0;
 }
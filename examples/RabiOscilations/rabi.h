@@ -36,8 +36,6 @@ class rabi: public squids::SQuIDS {
  private:
   //Hamiltonian no external field
   squids::SU_vector suH0;
-  //The time evolved dipole operators
-  squids::SU_vector d;
   //Laser Frequency
   double w;
   //Laser Amplitude
@@ -50,8 +48,6 @@ class rabi: public squids::SQuIDS {
   std::unique_ptr<squids::SU_vector[]> b0_proj;
   std::unique_ptr<squids::SU_vector[]> b1_proj;
 
-  //Function evaluated before any derivative
-  void PreDerive(double t);
   //Constructors and initializer
   rabi(){};
   rabi(double D_E, double wi, double Am){init(D_E,wi,Am);};
@@ -0,0 +1,148 @@
+
+ /******************************************************************************
+ *    This program is free software: you can redistribute it and/or modify     *
+ *   it under the terms of the GNU General Public License as published by      *
+ *   the Free Software Foundation, either version 3 of the License, or         *
+ *   (at your option) any later version.                                       *
+ *                                                                             *
+ *   This program is distributed in the hope that it will be useful,           *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the             *
+ *   GNU General Public License for more details.                              *
+ *                                                                             *
+ *   You should have received a copy of the GNU General Public License         *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.     *
+ *                                                                             *
+ *   Authors:                                                                  *
+ *      Carlos Arguelles (University of Wisconsin Madison)                     *
+ *         carguelles@icecube.wisc.edu                                         *
+ *      Christopher Weaver (University of Wisconsin Madison)                   *
+ *         chris.weaver@icecube.wisc.edu                                       *
+ *      Jordi Salvado (University of Wisconsin Madison)                        *
+ *         jsalvado@icecube.wisc.edu                                           *
+ ******************************************************************************/
+
+
+#ifndef SQUIDS_ENSEMBLE_H
+#define SQUIDS_ENSEMBLE_H
+
+#if __cplusplus < 201103L
+#error C++11 compiler required. Update your compiler and use the flag -std=c++11
+#endif
+
+#include "SQuIDS.h"
+#include "detail/ThreadPool.h"
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace squids{
+
+///\brief Evolves copies of a prepared system for many parameter points in parallel
+///
+/// Each thread works on its own copy of the prototype, made the first time
+/// the thread is used. For each point the copy is reset to the prototype
+/// with CopyStateFrom, which allocates no memory, and passed to a setup
+/// function which applies the parameters of the point. The system is then
+/// evolved, and a measurement function stores the results for the point in
+/// a row of a table. Neighboring points are given to the same thread, and by
+/// default each evolution starts with the step size found at the end of the
+/// previous point on that thread, which saves the initial search for a step
+/// size when the parameters change slowly from point to point.
+///
+/// System must be copy constructible; members of System which are not part
+/// of SQuIDS are copied from the prototype only when a thread's copy is made,
+/// so the setup function must set all of those which vary between points.
+/// The copies evolve with a single thread each.
+template<typename System>
+class Ensemble{
+public:
+  ///The function which applies the parameters of a point to a system
+  typedef std::function<void(System& system, size_t point)> setupFunction;
+  ///The function which stores the results for a point in its row of the table
+  typedef std::function<void(const System& system, size_t point, double* row)> measureFunction;
+
+  ///\param prototype the system to copy for each point; it is copied, so
+  ///       later changes to it do not affect the ensemble
+  ///\param nthreads the number of threads to use; zero uses one per available core
+  explicit Ensemble(const System& prototype, unsigned int nthreads=0):
+  prototype(prototype),
+  pool(nthreads>0 ? nthreads : std::max(1u,std::thread::hardware_concurrency()),false),
+  systems(pool.size()),
+  warm_start(true),
+  npoints(0),
+  ncolumns(0){
+    this->prototype.Set_NumThreads(1);
+  }
+
+  ///\brief Set whether each point starts with the step size of the previous point
+  void Set_WarmStart(bool opt){ warm_start=opt; }
+  ///\brief Get whether each point starts with the step size of the previous point
+  bool Get_WarmStart() const{ return(warm_start); }
+  ///\brief Returns the number of threads used
+  unsigned int Get_NumThreads() const{ return(pool.size()); }
+
+  //***************************************************************
+  ///\brief Evolves the system for each point
+  ///
+  /// If setup or measure throw for any point, the remaining points are
+  /// abandoned and the first exception is rethrown.
+  ///\param n the number of points
+  ///\param dt the time for which to evolve each point
+  ///\param setup the function applying the parameters of each point; it is
+  ///       called concurrently for different points
+  ///\param columns the number of results stored for each point
+  ///\param measure the function storing the results of each point; it is
+  ///       called concurrently for different points
+  void Run(size_t n, double dt, const setupFunction& setup,
+           unsigned int columns, const measureFunction& measure){
+    npoints=n;
+    ncolumns=columns;
+    results.assign(npoints*ncolumns,0);
+    //a few chunks per thread balance the load while keeping neighbors together
+    const unsigned int chunk=std::max<size_t>(1,npoints/(4*pool.size()));
+    pool.parallel_for(npoints,chunk,[&](unsigned int begin, unsigned int end, unsigned int worker){
+      if(!systems[worker]){
+        systems[worker].reset(new System(prototype));
+        systems[worker]->Set_NumThreads(1);
+      }
+      System& system=*systems[worker];
+      for(unsigned int point=begin; point<end; point++){
+        const double h_previous=system.h_last;
+        system.CopyStateFrom(prototype);
+        setup(system,point);
+        if(warm_start && h_previous>0)
+          system.h_last=h_previous;
+        system.Evolve(dt);
+        measure(system,point,&results[point*ncolumns]);
+      }
+    });
+  }
+
+  ///\brief Returns the number of points in the last run
+  size_t Get_NumPoints() const{ return(npoints); }
+  ///\brief Returns the number of results stored for each point
+  unsigned int Get_NumColumns() const{ return(ncolumns); }
+  ///\brief Returns the table of results, with one row of Get_NumColumns() entries per point
+  const std::vector<double>& GetResults() const{ return(results); }
+  ///\brief Returns one result for one point
+  double GetResult(size_t point, unsigned int column) const{ return(results[point*ncolumns+column]); }
+
+private:
+  System prototype;
+  detail::thread_pool pool;
+  ///the copy of the prototype used by each thread
+  std::vector<std::unique_ptr<System>> systems;
+  bool warm_start;
+  size_t npoints;
+  unsigned int ncolumns;
+  std::vector<double> results;
+};
+
+} //namespace squids
+
+#endif
@@ -0,0 +1,140 @@
+
+ /******************************************************************************
+ *    This program is free software: you can redistribute it and/or modify     *
+ *   it under the terms of the GNU General Public License as published by      *
+ *   the Free Software Foundation, either version 3 of the License, or         *
+ *   (at your option) any later version.                                       *
+ *                                                                             *
+ *   This program is distributed in the hope that it will be useful,           *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the             *
+ *   GNU General Public License for more details.                              *
+ *                                                                             *
+ *   You should have received a copy of the GNU General Public License         *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.     *
+ *                                                                             *
+ *   Authors:                                                                  *
+ *      Carlos Arguelles (University of Wisconsin Madison)                     *
+ *         carguelles@icecube.wisc.edu                                         *
+ *      Christopher Weaver (University of Wisconsin Madison)                   *
+ *         chris.weaver@icecube.wisc.edu                                       *
+ *      Jordi Salvado (University of Wisconsin Madison)                        *
+ *         jsalvado@icecube.wisc.edu                                           *
+ ******************************************************************************/
+
+
+#ifndef SQUIDS_OBSERVABLERECORDER_H
+#define SQUIDS_OBSERVABLERECORDER_H
+
+#if __cplusplus < 201103L
+#error C++11 compiler required. Update your compiler and use the flag -std=c++11
+#endif
+
+#include "SQuIDS.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace squids{
+
+///\brief Records the expectation values of a set of operators at all nodes
+///
+/// Each call to Record computes the expectation values of the registered
+/// operators for every node, and hands them to a background thread through a
+/// fixed size lock-free ring buffer; the background thread does all of the
+/// writing, so the thread which evolves the system never waits for I/O unless
+/// the ring is full. A recorder can be passed directly as the observer of
+/// SQuIDS::Evolve with a list of output times, using std::ref.
+///
+/// The binary file, whose numbers are stored in the byte order of the
+/// machine which wrote it, starts with
+///  - the 8 characters "SQuIDSob", a uint32 format version (1) and the uint32 0x01020304
+///  - a uint32 number of nodes nx and a uint32 number of observables
+///  - for each observable a uint32 length followed by its name, and its uint32 rho index
+///  - nx doubles: the x values of the nodes
+///
+/// which is followed by blocks of samples, each of which contains
+///  - a uint32 number of samples m
+///  - m doubles: the times of the samples
+///  - for each observable, for each node, m doubles: the expectation values
+///
+/// so that each column of a block is contiguous.
+class ObservableRecorder{
+public:
+  ///\param path the binary file to write
+  ///\param csv_path a file to which the samples are also written as comma
+  ///       separated values, one row per sample; empty for none
+  ///\param capacity the number of samples which can wait to be written, which
+  ///       is also the number of samples in each block of the binary file
+  ObservableRecorder(const std::string& path, const std::string& csv_path="", unsigned int capacity=64);
+  ///Writes any remaining samples and closes the files, ignoring errors
+  ~ObservableRecorder();
+  ObservableRecorder(const ObservableRecorder&)=delete;
+  ObservableRecorder& operator=(const ObservableRecorder&)=delete;
+
+  ///\brief Registers an operator whose expectation value is recorded
+  ///
+  /// All operators must be registered before the first sample is recorded.
+  ///\param name the name of the observable, used in the file headers
+  ///\param op the operator
+  ///\param irho the index of the density matrix to which it is applied
+  void AddObservable(const std::string& name, const SU_vector& op, unsigned int irho);
+  ///\brief Records the expectation values for the current state of a system
+  void Record(const SQuIDS& system);
+  ///\brief Records the expectation values for a state passed to an observer
+  void operator()(const SQuIDS::stateView& view);
+  ///\brief Waits until all samples are written, and closes the files
+  ///
+  /// Rethrows any error which occurred while writing. No further samples may
+  /// be recorded afterwards.
+  void Close();
+  ///\brief Returns the number of samples recorded so far
+  unsigned long Get_NumSamples() const{ return(head.load()); }
+
+private:
+  struct observable{
+    std::string name;
+    SU_vector op;
+    unsigned int irho;
+  };
+  std::vector<observable> observables;
+  std::string path, csv_path;
+  std::ofstream file, csv;
+  unsigned int nx;
+  std::vector<double> x;
+
+  ///Each slot holds the time of a sample followed by the values of each
+  ///observable at each node
+  std::vector<std::vector<double>> slots;
+  ///the number of samples written to the ring, and read from it
+  std::atomic<unsigned long> head, tail;
+  ///the columns of the block being assembled by the writer
+  std::vector<double> block;
+  unsigned int block_size;
+
+  std::thread writer;
+  std::mutex mut;
+  std::condition_variable wake;
+  std::atomic<bool> writer_waiting, closing, failed;
+  std::string error;
+
+  ///Opens the files and starts the writer, once the nodes are known
+  void start(const std::vector<double>& x);
+  ///Returns the next free slot, waiting for the writer if the ring is full
+  std::vector<double>& acquire_slot();
+  ///Makes the slot returned by acquire_slot available to the writer
+  void publish_slot();
+  void write_loop();
+  void write_header();
+  void write_sample(const std::vector<double>& sample);
+  void write_block();
+};
+
+} //namespace squids
+
+#endif
@@ -91,8 +91,16 @@
 #endif
 
 #include "SUNalg.h"
+#include "detail/RungeKutta.h"
+#include "detail/GridIndex.h"
+#include "detail/KernelCompression.h"
 
+#include <array>
+#include <cstdint>
+#include <functional>
 #include <iosfwd>
+#include <limits>
+#include <string>
 #include <vector>
 #include <memory>
 
@@ -101,11 +109,61 @@
 
 namespace squids{
 
+namespace detail{
+  class thread_pool;
+}
+
+template<typename System>
+class Ensemble;
+
+///\brief The methods which SQuIDS::Evolve can use to integrate the system
+enum class integrator{
+  ///the GSL stepper selected with SQuIDS::Set_GSL_step
+  gsl,
+  ///Dormand-Prince 5(4), which reuses its last stage as the next first stage
+  dormand_prince_54,
+  ///Tsitouras 5(4), which reuses its last stage as the next first stage
+  tsitouras_54,
+  ///Verner 6(5)
+  verner_65,
+  ///Fourth order Magnus expansion, for systems with only coherent terms
+  magnus_4
+};
+
+///\brief The ways in which SQuIDS interpolates the states between nodes
+enum class interpolation{
+  ///linear interpolation between the neighbouring nodes
+  linear,
+  ///cubic Hermite interpolation, with the slope at each node taken from the
+  ///parabola through it and its neighbours
+  cubic_hermite,
+  ///cubic Hermite interpolation with the slopes limited as proposed by
+  ///Fritsch and Butland, so that each component is monotone between nodes
+  ///where it is monotone at the nodes, and has no new extrema
+  monotone_cubic
+};
+
 ///\brief SQuIDS main class
 ///
 ///density matrix kinetic equation solver
+///
+///\par Thread safety
+///By default all terms of the derivative are evaluated by the thread which
+///calls Evolve. If more threads are requested with Set_NumThreads the node
+///loop of Derive is split among them, and the following rules apply to the
+///virtual functions supplied by derived classes:
+/// - PreDerive is called exactly once per derivative evaluation, by the
+///   calling thread, before any other term is evaluated. It is the place to
+///   update any state which is shared between nodes.
+/// - HI, GammaRho, InteractionsRho, GammaScalar and InteractionsScalar may be
+///   called concurrently for different nodes, in no particular order. They
+///   must not modify any shared data, including member buffers reused between
+///   calls; all calls for a given node are made by the same thread during one
+///   derivative evaluation.
+/// - Reading estate for any node is allowed, but only the entries of dstate
+///   belonging to the node being evaluated are written by the library.
 class SQuIDS {
- protected:
+ public:
   
   ///\brief Structure that contains the node state
   struct SU_state
@@ -115,9 +173,37 @@ class SQuIDS {
     ///\brief Vector of scalars that represents the classic part of the state
     double* scalar; //not owned
   };
-
+  
+  ///\brief Counts and times of the work done to evolve the system
+  struct solverStats{
+    ///the number of evaluations of the derivative
+    unsigned long rhs_calls=0;
+    ///the number of steps taken
+    unsigned long accepted_steps=0;
+    ///the number of steps rejected by the error control and retried with
+    ///a smaller size
+    unsigned long rejected_steps=0;
+    ///the size of the smallest step taken, or infinity if none was recorded
+    double min_step=std::numeric_limits<double>::infinity();
+    ///whether the library was built with SQUIDS_TIMERS (see the
+    ///--enable-timers option of configure); if not, all times are zero
+    bool timed=false;
+    ///the time in seconds spent in PreDerive
+    double pre_derive_time=0;
+    ///the time spent evaluating HI and applying it to the states, including
+    ///applying the combined maps of the time independent terms
+    double hi_time=0;
+    ///the time spent evaluating GammaRho and applying it to the states
+    double gamma_rho_time=0;
+    ///the time spent in InteractionsRho
+    double interactions_rho_time=0;
+    ///the time spent in GammaScalar and InteractionsScalar
+    double scalar_time=0;
+    ///the time spent applying the non-local kernels
+    double nonlocal_time=0;
+  };
  private:
-  bool CoherentRhoTerms,NonCoherentRhoTerms,OtherRhoTerms,GammaScalarTerms,OtherScalarTerms,AnyNumerics;
+  bool CoherentRhoTerms,NonCoherentRhoTerms,OtherRhoTerms,GammaScalarTerms,OtherScalarTerms,NonLocalRhoTerms,NonLocalScalarTerms,AnyNumerics;
   bool is_init;
   bool adaptive_step;
  
@@ -138,10 +224,405 @@ class SQuIDS {
   double h_max;
   double abs_error;
   double rel_error;
+  ///whether the initial step size was chosen by the user
+  bool h_set;
+  ///whether the GSL driver is kept between calls to Evolve
+  bool persistent_driver;
+  ///the GSL driver, if one is being kept
+  std::unique_ptr<gsl_odeiv2_driver,void (*)(gsl_odeiv2_driver*)> driver;
+  ///the step size suggested after the last accepted step, zero if unknown
+  double h_last;
+  ///the method used by Evolve
+  integrator method;
+  ///the length of the Strang splitting steps, zero if the terms are not split
+  double split_step;
+  ///the number of step size levels used to group nodes, zero or one to disable
+  unsigned int multirate_levels;
+  ///the interval at which the node groups are synchronized, zero for each call to Evolve
+  double multirate_sync;
+  ///the first node of each group, followed by nx; empty until the nodes are classified
+  std::vector<unsigned int> multirate_groups;
+  ///the step size carried between calls to Evolve for each node group
+  std::vector<double> multirate_h;
+  ///the synchronized state and a second state buffer for multi-rate stepping
+  std::vector<double> multirate_buffers;
+  ///the largest relative difference between neighbouring nodes allowed by
+  ///the adaptive grid, zero if the grid is fixed
+  double grid_tolerance;
+  ///the longest interval between adaptations of the grid, zero to adapt it
+  ///once per call to Evolve
+  double grid_interval;
+  ///the largest number of nodes the adaptive grid may use, zero for no limit
+  unsigned int grid_max_nodes;
+  ///the nodes set with Set_xrange, which the adaptive grid does not remove
+  std::vector<double> grid_base;
+  ///finds the interval of the grid containing a value
+  detail::grid_index x_index;
+  ///how the states are interpolated between nodes
+  interpolation x_interpolation;
+  ///the slope in x of each component of each density matrix at each node,
+  ///computed at the end of each call to Evolve; empty when it must be
+  ///computed for each query
+  std::vector<double> x_slopes;
+  ///whether an interpolant is kept for the last step
+  bool dense_output;
+  ///the interpolant for the last step taken by Evolve, if any
+  detail::dense_interpolant dense;
+  ///the storage for the states returned by GetStateAt, allocated on first use
+  std::unique_ptr<double[]> dense_system;
+  ///views of dense_system
+  std::unique_ptr<SU_state[]> dense_state;
+  ///the output times and observer of the current call to Evolve with a
+  ///schedule, or null; not owned
+  struct output_schedule;
+  output_schedule* schedule;
+  ///allocates dense_system and dense_state if necessary
+  void prepare_dense_state();
+  ///stage storage for the native integrators
+  detail::rk_workspace rk_work;
   std::unique_ptr<SU_state[]> dstate;
   double* last_dstate_ptr;
   double* last_estate_ptr;
   
+  ///number of threads used to evaluate the derivative
+  unsigned int nthreads;
+  ///number of nodes handed to a thread at a time, zero to choose automatically
+  unsigned int thread_chunk;
+  ///whether worker threads are bound to cores
+  bool thread_affinity;
+  ///worker threads, present only when nthreads>1
+  std::unique_ptr<detail::thread_pool> pool;
+  
+  ///the parts of the derivative timed when the library is built with SQUIDS_TIMERS
+  enum timed_term{pre_derive_term, hi_term, gamma_rho_term, interactions_rho_term,
+    scalar_term, nonlocal_term, timed_terms};
+  ///\brief Preallocated output slots for the batched term functions
+  struct derive_workspace{
+    std::vector<SU_vector> hi, gamma, interactions;
+    ///holds a term after rotation into the interaction picture
+    SU_vector frame;
+    ///holds the exponent of a Magnus step
+    SU_vector generator;
+    ///scratch space for the batched kernels, in batch layout
+    std::vector<double> batch;
+    ///the ticks spent by this thread in each timed part of the derivative
+    ///since they were last added to term_ticks
+    std::array<uint64_t,timed_terms> ticks{};
+  };
+  ///one workspace for each thread which may run DeriveNodes
+  std::vector<derive_workspace> workspaces;
+  
+  ///the counters reported by GetStats; the times are computed from term_ticks
+  solverStats stats;
+  ///the ticks spent in each timed part of the derivative, summed over the threads
+  std::array<uint64_t,timed_terms> term_ticks;
+  
+  ///whether HI and GammaRho are rotated into the frame of H0 by the library
+  bool interaction_picture;
+  ///H0 for each node and density matrix, empty when it must be recomputed
+  std::vector<SU_vector> h0_cache;
+  ///the PrepareEvolve coefficients of h0_cache for each node and density matrix
+  std::vector<double> evolve_buffers;
+  ///the time for which the coefficients of each node were computed
+  std::vector<double> evolve_buffer_times;
+  
+  ///the partial sums of each block of nodes computed by SumRho
+  std::vector<double> reduction_partials;
+  
+  ///whether HI and GammaRho have been declared not to depend on time
+  bool static_hi, static_gamma;
+  ///the static terms for each node, ordered by term (HI before GammaRho),
+  ///density matrix and node; empty when they must be recomputed
+  std::vector<SU_vector> static_terms;
+  ///the linear map which the static terms apply to each density matrix, as a
+  ///size_rho by size_rho matrix for each node and density matrix, if it is
+  ///used instead of static_terms
+  std::vector<double> static_maps;
+  ///whether the static terms include the coherent and non-coherent terms
+  bool static_map_coherent, static_map_noncoherent;
+  
+  ///\brief The tabulated kernel of a non-local term
+  struct node_kernel{
+    ///the entry for each pair of nodes, row by row
+    std::vector<double> entries;
+    ///the first and one past the last nonzero column of each row
+    std::vector<unsigned int> bounds;
+    ///the approximation used instead of entries, if entries is empty
+    detail::compressed_kernel compressed;
+    ///the projections of the state onto the blocks of the approximation
+    std::vector<double> projections;
+  };
+  ///the kernels of the non-local terms for each density matrix and for each
+  ///scalar; empty when they must be recomputed
+  std::vector<node_kernel> rho_kernels, scalar_kernels;
+  ///the accuracy to which the kernels are approximated, zero to use them exactly
+  double kernel_tolerance;
+  
+  //***************************************************************
+  ///\brief Evaluates H0 for all nodes and allocates the evolution buffers
+  void prepare_interaction_picture();
+  
+  //***************************************************************
+  ///\brief Gets the coefficients which rotate a term into the interaction picture
+  ///
+  /// The coefficients of all density matrices of the node are recomputed if
+  /// they do not correspond to the current time.
+  ///\param ix node position
+  ///\param irho index of rho
+  const double* evolve_buffer(unsigned int ix, unsigned int irho);
+  
+  //***************************************************************
+  ///\brief Whether the coherent terms are applied through static_maps
+  bool use_static_hi() const{
+    return(CoherentRhoTerms && static_hi && !interaction_picture);
+  }
+  ///\brief Whether the non-coherent terms are applied through static_maps
+  bool use_static_gamma() const{
+    return(NonCoherentRhoTerms && static_gamma && !interaction_picture);
+  }
+  
+  //***************************************************************
+  ///\brief Adds the derivative of the terms of a density matrix's derivative
+  /// due to HI and GammaRho with respect to its components to a block of a matrix
+  ///\param block the entry of the matrix in the row and column of the first component
+  ///\param stride the distance between the rows of the matrix
+  ///\param H the coherent term, or null if it is not included
+  ///\param G the non-coherent term, or null if it is not included
+  void add_rho_term_block(double* block, size_t stride, const SU_vector* H, const SU_vector* G) const;
+  
+  //***************************************************************
+  ///\brief Evaluates the static terms for all nodes
+  ///
+  /// For SU(2) the terms are turned into dense maps, whose products with the
+  /// state are cheaper than the commutators. For larger dimensions the dense
+  /// maps have too many entries, so the terms are applied with the batched
+  /// kernels instead.
+  void prepare_static_terms();
+  
+  //***************************************************************
+  ///\brief Tabulates the kernels of the enabled non-local terms
+  ///
+  /// Kernels are compressed if a tolerance has been set and the approximation
+  /// is considerably smaller than the table.
+  void prepare_kernels();
+  
+  //***************************************************************
+  ///\brief Adds a non-local term to the derivatives of a range of nodes
+  ///\param kernel the kernel of the term
+  ///\param ix_begin the first node to compute
+  ///\param ix_end the node after the last node to compute
+  ///\param width the number of components to which the kernel applies
+  ///\param in the first component of the state of the first node
+  ///\param out the first component of the derivative of node ix_begin
+  void add_kernel_term(const node_kernel& kernel, unsigned int ix_begin, unsigned int ix_end,
+                       unsigned int width, const double* in, double* out) const;
+  
+  //***************************************************************
+  ///\brief The number of nodes handed to a thread at a time
+  unsigned int node_chunk_size() const;
+  
+  //***************************************************************
+  ///\brief Ensures that there are enough workspaces with enough slots
+  ///\param nworkspaces the number of workspaces needed
+  ///\param capacity the largest number of nodes which will be given to one workspace
+  void prepare_workspaces(unsigned int nworkspaces, unsigned int capacity);
+  
+  //***************************************************************
+  ///\brief Computes the derivative for a range of nodes, after calling PreDerive
+  ///\param at the time at which to compute the derivative
+  ///\param ix_begin the first node to compute
+  ///\param ix_end the node after the last node to compute
+  void DeriveRange(double at, unsigned int ix_begin, unsigned int ix_end);
+  
+  //***************************************************************
+  ///\brief Computes the derivative for a range of nodes
+  ///\param ix_begin the first node to compute
+  ///\param ix_end the node after the last node to compute
+  ///\param ws storage for the results of the batched term functions
+  void DeriveNodes(unsigned int ix_begin, unsigned int ix_end, derive_workspace& ws);
+  
+  //***************************************************************
+  ///\brief Computes the terms of the derivative which involve only the node itself
+  ///\param ix_begin the first node to compute
+  ///\param ix_end the node after the last node to compute
+  ///\param ws storage for the results of the batched term functions
+  void DeriveLocalNodes(unsigned int ix_begin, unsigned int ix_end, derive_workspace& ws);
+  
+  //***************************************************************
+  ///\brief Computes the terms of the derivative which involve only the node
+  /// itself without calling the virtual term functions
+  ///
+  /// Overridden by SQuIDS_static. Called once for each range of nodes, unless
+  /// the library must transform the terms itself (see Set_InteractionPicture,
+  /// Set_StaticHI and Set_StaticGammaRho).
+  ///\param ix_begin the first node to compute
+  ///\param ix_end the node after the last node to compute
+  ///\return whether the terms were computed; if not, DeriveLocalNodes is used
+  virtual bool DeriveLocalTerms(unsigned int ix_begin, unsigned int ix_end){ return false; }
+  
+  //***************************************************************
+  ///\brief Computes a term of the derivative for a range of nodes with the batched kernels
+  ///
+  /// Processes detail::batch_lanes nodes at a time, giving the same results
+  /// as the per node computation.
+  ///\param ix_begin the first node to compute
+  ///\param ix_end the node after the last node to compute
+  ///\param irho index of rho
+  ///\param ops the term for each node, as computed by HI_batch or GammaRho_batch
+  ///\param coherent whether ops is the Hamiltonian, whose commutator with rho
+  ///       is assigned to the derivative, rather than the decay term, whose
+  ///       anticommutator with rho is subtracted from it
+  ///\param ws the workspace of the calling thread
+  void DeriveBatched(unsigned int ix_begin, unsigned int ix_end, unsigned int irho,
+                     const SU_vector* ops, bool coherent, derive_workspace& ws);
+  
+  //***************************************************************
+  ///\brief Evolves the system using the persistent GSL driver
+  ///\param dt evolution time interval.
+  ///\return the GSL status code
+  int EvolvePersistent(double dt);
+  
+  //***************************************************************
+  ///\brief Estimates a good size for the first step of an integration
+  ///
+  /// Uses the procedure described by Hairer, Norsett & Wanner, Solving
+  /// Ordinary Differential Equations I, section II.4, which costs two
+  /// evaluations of the derivative.
+  ///\param dt the interval which is to be integrated
+  ///\param order the order of the integration method
+  double InitialStepSize(double dt, unsigned int order);
+  
+  //***************************************************************
+  ///\brief Evolves the system using one of the native Runge-Kutta methods
+  ///\param dt evolution time interval.
+  template<typename Tableau>
+  void EvolveRK(double dt);
+  
+  //***************************************************************
+  ///\brief Integrates over an interval with adaptive step sizes
+  ///
+  /// Chooses the first step as described for the persistent driver, and sets
+  /// t when done.
+  ///\param dt evolution time interval.
+  ///\param order the order of the method
+  ///\param error_order the order of the method used to estimate the error
+  ///\param h_carried the step size with which to start, or zero if unknown;
+  ///       set to the step size suggested for the next call
+  ///\param attempt called as attempt(t,h) to try a step, returning its error norm
+  ///\param accept called when the step last tried is accepted
+  ///\return false if the step size became too small, true otherwise
+  template<typename Attempt, typename Accept>
+  bool AdaptiveSteps(double dt, unsigned int order, unsigned int error_order,
+                     double& h_carried, Attempt attempt, Accept accept);
+  
+  //***************************************************************
+  ///\brief Calls a function for ranges of nodes, using the threads if there are any
+  ///\param f called as f(ix_begin,ix_end,workspace)
+  template<typename NodeFunction>
+  void ForNodeRanges(NodeFunction f);
+  
+  ///the Hamiltonians sampled at the two points of a Magnus step
+  std::vector<SU_vector> magnus_h1, magnus_h2;
+  ///intermediate states of the Magnus integrator
+  std::vector<double> magnus_buffers;
+  
+  //***************************************************************
+  ///\brief Evaluates the Hamiltonian which drives the coherent evolution
+  ///
+  /// This is HI in the frame of the state, or H0+HI if the interaction
+  /// picture is handled by the library.
+  ///\param at the time at which to evaluate it
+  ///\param out the Hamiltonian for each node and density matrix
+  void SampleHamiltonian(double at, std::vector<SU_vector>& out);
+  
+  //***************************************************************
+  ///\brief Takes one step of the fourth order Magnus integrator
+  ///\param t0 the time at the start of the step
+  ///\param hs the step size
+  ///\param y_in the state at the start of the step
+  ///\param y_out storage for the state at the end of the step
+  void MagnusStep(double t0, double hs, const double* y_in, double* y_out);
+  
+  //***************************************************************
+  ///\brief Evolves the system using the fourth order Magnus integrator
+  ///\param dt evolution time interval.
+  void EvolveMagnus(double dt);
+  
+  //***************************************************************
+  ///\brief Passes the scheduled output times within an accepted step to the observer
+  ///
+  /// Called by EvolveRK when a schedule is set, which Evolve only does for
+  /// methods with a continuous extension.
+  ///\param step_t the start of the step
+  ///\param step_h the size of the step
+  ///\param y0 the state at the start of the step
+  template<typename Tableau>
+  void ObserveStep(double step_t, double step_h, const double* y0);
+  
+  //***************************************************************
+  ///\brief Divides the nodes into groups which need similar step sizes
+  ///
+  /// Estimates the step size of each node with the procedure used by
+  /// InitialStepSize, and fills multirate_groups and multirate_h.
+  ///\param order the order of the integration method
+  void ClassifyNodes(unsigned int order);
+  
+  //***************************************************************
+  ///\brief Evolves each group of nodes separately using a native Runge-Kutta method
+  ///\param dt evolution time interval.
+  template<typename Tableau>
+  void EvolveMultiRate(double dt);
+  
+  //***************************************************************
+  ///\brief Allocates the views of state, estate and dstate for all nodes,
+  /// with state and estate pointing into system
+  void allocate_states();
+  
+  //***************************************************************
+  ///\brief The relative difference between the states of two nodes
+  ///
+  /// The largest, over the density matrices and the scalars, of the norm of
+  /// the difference divided by the larger of the two norms.
+  double node_difference(unsigned int ix, unsigned int jx) const;
+  
+  //***************************************************************
+  ///\brief The slope in x of one component of a density matrix at a node,
+  /// for the cubic interpolation methods
+  double interpolation_slope(unsigned int ix, unsigned int irho, unsigned int k) const;
+  
+  //***************************************************************
+  ///\brief Computes the slopes used by the cubic interpolation methods for
+  /// all nodes, or discards them for linear interpolation
+  void update_slopes();
+  
+  //***************************************************************
+  ///\brief Interpolates a density matrix between nodes
+  ///\param irho index of rho
+  ///\param x value of x
+  ///\param ix the node starting the interval used
+  ///\param out the interpolated state
+  void interpolate_rho(unsigned int irho, double x, size_t ix, SU_vector& out) const;
+  
+  //***************************************************************
+  ///\brief Counts a step taken by an integrator
+  ///\param hs the size of the step
+  void record_step(double hs);
+  
+  //***************************************************************
+  ///\brief Evolves the system without adapting the grid
+  ///\param dt evolution time interval.
+  void EvolveFixedGrid(double dt);
+  
+  //***************************************************************
+  ///\brief Evolves the system with the selected integrator, without splitting
+  ///\param dt evolution time interval.
+  void Integrate(double dt);
+  
+  //***************************************************************
+  ///\brief Evolves the system by Strang splitting of the coherent terms
+  ///\param dt evolution time interval.
+  void EvolveSplit(double dt);
+  
   //***************************************************************
   ///\brief Sets the evolution state and derivative system pointer for GSL use
   ///\param sp the backing storage for the state during evolution (estate)
@@ -149,6 +630,17 @@ class SQuIDS {
   void set_system_pointers(double* sp, double* dp);
   //interface function called by GSL
   friend int RHS(double ,const double*,double*,void*);
+  //interface function called by GSL
+  friend int JAC(double ,const double*,double*,double*,void*);
+  //the ensemble runner carries step sizes between systems
+  template<typename System>
+  friend class Ensemble;
+  //the statically dispatched variant computes the derivative directly
+  template<typename Derived, typename TermPolicy>
+  friend class SQuIDS_static;
+  ///temporary storage for the derivatives used to compute the time
+  ///derivative in Jacobian
+  std::vector<double> jacobian_scratch;
  
  protected:
   ///The number of nodes in the system
@@ -184,6 +676,14 @@ class SQuIDS {
   ///\param nscalar Number of scalars in every "x" site
   ///\param ti initial value for the evolution parameter t
   SQuIDS(unsigned int nx, unsigned int dim, unsigned int nrho, unsigned int nscalar, double ti=0.0);
+  //***************************************************************
+  ///\brief Copies a system
+  ///
+  /// The copy has the same state, times, x values, mixing parameters and
+  /// settings, including the thread settings, as described for
+  /// CopyStateFrom. Derived classes whose members can be copied can
+  /// therefore be copied as well.
+  SQuIDS(const SQuIDS& other);
 
   ///\brief Move constructs a SQUIDS object from an existing object
   SQuIDS(SQuIDS&&);
@@ -229,9 +729,19 @@ class SQuIDS {
   
   ///\brief Get the range of values for the array "x"
   const std::vector<double>& Get_xrange() const{ return(x); }
+  
+  //***************************************************************
+  ///\brief Refines and coarsens the grid once according to the current state
+  ///
+  /// Follows the rules described for Set_AdaptiveGrid, and does nothing if
+  /// the grid is fixed.
+  ///\return whether the nodes changed
+  bool AdaptGrid();
 
   //***************************************************************
-  ///\brief Returns the closes position in the array x for the value given
+  ///\brief Returns the position of the interval of the array x containing
+  /// the value given, that is the last node not after the value, or nx-2 for
+  /// the last node
   ///\param x value of x to look for
   unsigned int Get_i(double x) const;
 
@@ -240,34 +750,150 @@ class SQuIDS {
   ///\param i node position
   double Get_x(unsigned int i) const{return x[i];}
 
+  //***************************************************************
+  ///\brief Returns the position of a density matrix component in the system
+  ///
+  /// The system is the flat array of all the numbers describing the state,
+  /// which is what the Jacobian is computed with respect to.
+  ///\param ix node position
+  ///\param irho index of rho
+  ///\param component the component of the density matrix
+  size_t Get_StateIndex(unsigned int ix, unsigned int irho, unsigned int component) const{
+    return(static_cast<size_t>(ix)*size_state+irho*size_rho+component);
+  }
+  ///\brief Returns the position of a scalar in the system
+  ///\param ix node position
+  ///\param is index of the scalar
+  size_t Get_ScalarIndex(unsigned int ix, unsigned int is) const{
+    return(static_cast<size_t>(ix)*size_state+nrhos*size_rho+is);
+  }
+
   //***************************************************************
   //virtual functions defined in the dervied class
   ///\brief H0 time independent evolution operator
   virtual SU_vector H0(double x, unsigned int irho) const{ return SU_vector(nsun);}
   ///\brief H1 time dependent evolution operator
+  ///
+  ///May be called concurrently for different nodes when using multiple threads.
   virtual SU_vector HI(unsigned int ix, unsigned int irho, double t) const{ return SU_vector(nsun);}
   ///\brief Attenuation and/or decoherence operator
   ///\param ix Index in the x-array
   ///\param t time
+  ///
+  ///May be called concurrently for different nodes when using multiple threads.
   virtual SU_vector GammaRho(unsigned int ix, unsigned int irho, double t) const{ return SU_vector(nsun);}
   ///\brief Function containing other possible operations, like non linear terms in rho
   ///or terms involving the scalar functions
   ///\param ix Index in the x-array
   ///\param t time
+  ///
+  ///May be called concurrently for different nodes when using multiple threads.
   virtual SU_vector InteractionsRho(unsigned int ix, unsigned int irho, double t) const{ return SU_vector(nsun);}
   ///\brief Attenuation for the scalar functions
   ///\param ix Index in the x-array
   ///\param t time
+  ///
+  ///May be called concurrently for different nodes when using multiple threads.
   virtual double GammaScalar(unsigned int ix, unsigned int irho, double t) const{return 0.0;}
   ///\brief Other possible interaction terms for the scalar functions.
   ///\param ix Index in the x-array
   ///\param t time
+  ///
+  ///May be called concurrently for different nodes when using multiple threads.
   virtual double InteractionsScalar(unsigned int ix, unsigned int irho, double t) const{return 0.0;}
+  ///\brief Kernel of the non-local term for a density matrix
+  ///
+  /// When non-local rho terms are enabled (see Set_NonLocalRhoTerms), the
+  /// derivative of rho[irho] at node ix gains the sum over all nodes jx of
+  /// RhoKernel(ix,jx,irho) times rho[irho] at node jx, component by component,
+  /// which describes processes such as the redistribution of particles between
+  /// energies. Any quadrature weights, such as the widths of the bins, must be
+  /// included in the kernel. The components are those of the state as it is
+  /// stored, that is, in the interaction picture with respect to H0.
+  ///\param ix the node whose derivative receives the contribution
+  ///\param jx the node whose state contributes
+  ///\param irho index of rho
+  ///
+  ///May be called concurrently for different ix when using multiple threads.
+  virtual double RhoKernel(unsigned int ix, unsigned int jx, unsigned int irho) const{return 0.0;}
+  ///\brief Kernel of the non-local term for a scalar
+  ///
+  /// Follows the same conventions as RhoKernel, with the derivative of scalar
+  /// is at node ix gaining ScalarKernel(ix,jx,is) times the same scalar at
+  /// node jx.
+  virtual double ScalarKernel(unsigned int ix, unsigned int jx, unsigned int is) const{return 0.0;}
+  
+  ///\brief Batched form of HI
+  ///
+  /// Computes HI for all nodes in [ix_begin,ix_end) at once, storing the
+  /// results in out[0] through out[ix_end-ix_begin-1]. The output vectors
+  /// already have dimension nsun and their own storage, so assigning to them
+  /// does not allocate memory. Derived classes which override this function
+  /// must return true; the default implementation returns false, which makes
+  /// Derive call HI for each node instead. Terms computed in batches are
+  /// applied to several nodes at a time by kernels which vectorize across
+  /// nodes, which is considerably faster than applying them node by node.
+  ///\param ix_begin the first node to compute
+  ///\param ix_end the node after the last node to compute
+  ///\param irho index of rho
+  ///\param t time
+  ///\param out the output vectors
+  ///\return whether the results were computed
+  ///
+  ///May be called concurrently for disjoint node ranges when using multiple threads.
+  virtual bool HI_batch(unsigned int ix_begin, unsigned int ix_end, unsigned int irho, double t, SU_vector* out) const{ return false; }
+  ///\brief Batched form of GammaRho
+  ///
+  /// Follows the same conventions as HI_batch.
+  virtual bool GammaRho_batch(unsigned int ix_begin, unsigned int ix_end, unsigned int irho, double t, SU_vector* out) const{ return false; }
+  ///\brief Batched form of InteractionsRho
+  ///
+  /// Follows the same conventions as HI_batch.
+  virtual bool InteractionsRho_batch(unsigned int ix_begin, unsigned int ix_end, unsigned int irho, double t, SU_vector* out) const{ return false; }
+  ///\brief Contributions of InteractionsRho and InteractionsScalar to the Jacobian
+  ///
+  /// The library computes the parts of the Jacobian which come from HI,
+  /// GammaRho, GammaScalar and the non-local kernels. Derived classes may
+  /// override this function to add the parts which come from InteractionsRho
+  /// and InteractionsScalar, including couplings between different nodes. Terms which are omitted
+  /// only make the Jacobian approximate, which slows the convergence of the
+  /// implicit methods but does not change the solution. This function is
+  /// only called if other rho or other scalar terms are enabled, and is
+  /// always called by a single thread, after PreDerive.
+  ///\param t time
+  ///\param dfdy the Jacobian, in row-major order, to which contributions
+  ///            should be added. Entry (i,j) is the derivative of entry i of
+  ///            the derivative with respect to entry j of the state, where
+  ///            entries are numbered as by Get_StateIndex and
+  ///            Get_ScalarIndex.
+  virtual void InteractionsJacobian(double t, double* dfdy) const{}
   ///\brief Function to be evaluated before the derivative
   ///\param t time
   ///
   /// This function enables the user to perform operations or updates before the derivative.
+  /// It is always called by a single thread, before any of the per-node terms are evaluated.
   virtual void PreDerive(double t){}
+  ///\brief Function called after the adaptive grid has changed the nodes
+  ///
+  /// Nodes may have been inserted or removed, so derived classes which store
+  /// data for each node should recompute it here from Get_nx and Get_x.
+  virtual void GridChanged(){}
+
+  //***************************************************************
+  ///\brief Computes a weighted sum of a density matrix over all nodes
+  ///
+  /// Sums weights[ix]*estate[ix].rho[irho], which makes it suitable for
+  /// building mean field terms in PreDerive. The nodes are divided into blocks
+  /// of a fixed size which are summed on the thread pool, and the partial sums
+  /// are added pairwise in a fixed order, so the result is the same bit for
+  /// bit for any number of threads. Must not be called from the functions
+  /// which may run on the threads of the pool, such as HI.
+  ///\param result the vector into which the sum is stored; it is resized to
+  ///       dimension nsun if necessary
+  ///\param irho index of rho
+  ///\param weights the weight of each node, or null to give every node a
+  ///       weight of one
+  void SumRho(SU_vector& result, unsigned int irho, const double* weights=nullptr);
 
   //***************************************************************
   ///\brief Computes the right hand side of the kinetic equation.
@@ -275,10 +901,86 @@ class SQuIDS {
   void Derive(double t);
 
   //***************************************************************
-  ///\brief Numerical evolution of the state using GSL
+  ///\brief Computes the Jacobian of the right hand side of the kinetic equation.
+  ///
+  /// The coherent and non-coherent terms are assembled exactly from HI and
+  /// GammaRho as one block per density matrix, and GammaScalar contributes
+  /// to the diagonal. Dependence of HI or GammaRho on the state (for example
+  /// through quantities computed in PreDerive) is not included. Other terms
+  /// are included only as far as InteractionsJacobian provides them. The
+  /// Jacobian is used automatically by the implicit GSL steppers.
+  ///\param t time
+  ///\param dfdy the Jacobian, in row-major order, for the n entries of the
+  ///            system, where n=Get_nx()*(Get_nrhos()*nsun*nsun+Get_nscalars())
+  ///\param dfdt the explicit time derivative of the derivative, which is
+  ///            estimated by finite differences
+  void Jacobian(double t, double* dfdy, double* dfdt);
+
+  //***************************************************************
+  ///\brief Numerical evolution of the state
+  ///
+  /// Uses GSL or one of the native Runge-Kutta methods, as chosen with
+  /// Set_Integrator.
   ///\param dt evolution time interval.
   void Evolve(double dt);
 
+  ///\brief A read-only view of the state of the system at one time
+  ///
+  /// The state is in the interaction picture with respect to H0, like the
+  /// state of the system itself; GetExpectationValue takes care of this.
+  class stateView{
+  private:
+    const SQuIDS* sys;
+    const SU_state* states;
+    double t;
+    friend class SQuIDS;
+    stateView(const SQuIDS* sys, const SU_state* states, double t):
+    sys(sys),states(states),t(t){}
+  public:
+    ///\brief Returns the time of the state
+    double Get_t() const{ return(t); }
+    ///\brief Returns the number of nodes
+    unsigned int Get_nx() const{ return(sys->nx); }
+    ///\brief Returns the value of x at a node
+    double Get_x(unsigned int ix) const{ return(sys->x[ix]); }
+    ///\brief Returns the density matrix irho at node ix
+    const SU_vector& GetRho(unsigned int irho, unsigned int ix) const{ return(states[ix].rho[irho]); }
+    ///\brief Returns the scalar iscalar at node ix
+    double GetScalar(unsigned int iscalar, unsigned int ix) const{ return(states[ix].scalar[iscalar]); }
+    ///\brief Returns the expectation value for a given operator for a given state irho in a node ix
+    double GetExpectationValue(SU_vector op, unsigned int irho, unsigned int ix) const;
+  };
+
+  ///The type of function which Evolve calls at each output time
+  typedef std::function<void(const stateView&)> observerFunction;
+
+  //***************************************************************
+  ///\brief Numerical evolution of the state with output at a list of times
+  ///
+  /// Evolves the system to each of the given times in turn, and calls the
+  /// observer with the state at each of them. With the Dormand-Prince and
+  /// Tsitouras integrators the system is integrated in a single sweep, and
+  /// the states at the output times are obtained from the continuous
+  /// extension of the method (see Set_DenseOutput), so the output times do
+  /// not limit the step size. Otherwise, including with Verner's method,
+  /// which has no continuous extension of matching accuracy, each step is
+  /// clipped at the next output time, so the outputs have the full accuracy
+  /// of the steps; the GSL integrator then keeps its driver between the
+  /// intervals as if Set_PersistentDriver had been enabled.
+  ///
+  /// When threaded is true the observer runs on a separate thread and
+  /// receives copies of the state, so the integration continues while it
+  /// runs. The observer is then called concurrently with the functions which
+  /// compute the derivative, and must only use the view it is given and
+  /// data of its own. If it throws, the integration is stopped as soon as
+  /// possible and the exception is rethrown by Evolve.
+  ///\param times the output times, ordered in the direction of the
+  ///             evolution starting from the current time; the system is
+  ///             evolved to the last of them
+  ///\param observer the function called with the state at each output time
+  ///\param threaded whether the observer is called on a separate thread
+  void Evolve(const std::vector<double>& times, const observerFunction& observer, bool threaded=false);
+
   //***************************************************************
   //functions to set parameters in the object.
   // string -> parameter
@@ -301,8 +1003,156 @@ class SQuIDS {
   // nscalars
   // The parameters in the struc "const" are also available from this functions
   ///\brief Sets the GSL stepper function (numerical method)
+  ///
+  /// Only used when the integrator is integrator::gsl.
   ///\param opt GSL step function
   void Set_GSL_step(gsl_odeiv2_step_type const* opt);
+  ///\brief Sets the method used to integrate the system
+  ///
+  /// The native Runge-Kutta methods work directly on the contiguous state
+  /// buffer, forming their stages and error estimates in cache sized blocks
+  /// which the compiler can vectorize. Like GSL's standard control they
+  /// accept a step if every component's error estimate is within
+  /// abs_error+rel_error*|y|, and they honor h_min, h_max, Set_h and
+  /// Set_AdaptiveStep. They always start each call to Evolve with the step
+  /// size found at the end of the previous call (see Get_h_last), so
+  /// Set_PersistentDriver has no effect on them.
+  ///
+  /// integrator::magnus_4 advances each density matrix with the exponential of
+  /// the fourth order Magnus expansion of the Hamiltonian, built from HI at
+  /// the two Gauss-Legendre points of each step, and estimates the error by
+  /// step doubling. It can only be used when CoherentRhoTerms are the only
+  /// terms enabled. If the interaction picture is handled by the library
+  /// (see Set_InteractionPicture) it steps with H0+HI, so that a constant
+  /// Hamiltonian is integrated exactly with steps spanning any number of
+  /// oscillations; otherwise it uses HI as given. HI is evaluated with estate
+  /// holding the state at the start of the step, so the method is only of
+  /// fourth order if HI does not depend on the state.
+  ///\param opt the integration method
+  void Set_Integrator(integrator opt);
+  ///\brief Gets the method used to integrate the system
+  integrator Get_Integrator() const;
+  ///\brief Integrates the coherent terms separately from the others
+  ///
+  /// Each call to Evolve is divided into steps no longer than the given size,
+  /// and each of these is composed as a Strang splitting: half a step of the
+  /// coherent evolution, a full step of the remaining terms, and another half
+  /// step of the coherent evolution. The coherent half steps are single steps
+  /// of the fourth order Magnus method (see Set_Integrator), which are exact
+  /// for constant Hamiltonians, while the remaining terms are integrated by the
+  /// selected integrator, which must not be integrator::magnus_4. The result
+  /// is second order in the split step size, with an error proportional to
+  /// the commutator of the coherent and other terms, so weakly damped but
+  /// strongly oscillating systems can be integrated with far fewer
+  /// evaluations of the derivative. With the GSL integrator a persistent
+  /// driver should be used, so that the step size is carried between the
+  /// split steps.
+  ///\param opt the longest split step; zero disables splitting
+  void Set_SplitStep(double opt);
+  ///\brief Gets the longest split step, or zero if the terms are not split
+  double Get_SplitStep() const;
+  ///\brief Steps groups of nodes with different step sizes
+  ///
+  /// At the start of the first call to Evolve the step size needed by each
+  /// node is estimated from two evaluations of the derivative, the
+  /// logarithmic range of these sizes is divided into the given number of
+  /// levels, and each run of consecutive nodes at the same level becomes a
+  /// group. Each group is then integrated with its own adaptive step size,
+  /// so only the nodes which need them take short steps. Groups see each
+  /// other's states only as they were at the last synchronization point, so
+  /// terms coupling nodes in different groups are only first order accurate
+  /// in the synchronization interval. PreDerive is called before each
+  /// evaluation of a group's derivative, with estate holding the
+  /// synchronized states for the other groups.
+  ///
+  /// The groups are kept until the x range, the tolerances, the initial step
+  /// size or the integrator change. Requires a native Runge-Kutta integrator
+  /// and adaptive stepping; with fixed steps the nodes are not grouped.
+  ///\param levels the number of step size levels; zero or one disables grouping
+  ///\param sync_step the longest interval between synchronizations of the
+  ///       groups; zero synchronizes once per call to Evolve
+  void Set_MultiRate(unsigned int levels, double sync_step=0);
+  ///\brief Gets the number of step size levels used to group nodes
+  unsigned int Get_MultiRateLevels() const;
+  ///\brief Gets the node groups used for multi-rate stepping
+  ///
+  ///\returns the first node of each group followed by the number of nodes, or
+  ///         an empty vector if the nodes have not been grouped yet
+  const std::vector<unsigned int>& Get_MultiRateGroups() const;
+  ///\brief Adapt the x grid to the state during evolution
+  ///
+  /// The relative difference between the states of each pair of neighbouring
+  /// nodes is the largest, over the density matrices and the scalars, of the
+  /// norm of the difference of their components divided by the larger of
+  /// their norms. Where it exceeds the tolerance evenly spaced nodes are
+  /// inserted between them, as many as needed for the differences to be
+  /// within the tolerance if the state changes linearly. Their states are
+  /// interpolated with the cubic through the four nearest nodes, so that the
+  /// errors made by repeated refinements stay well below those of
+  /// GetExpectationValueD. Where the difference is below a quarter of the
+  /// tolerance on both sides of an inserted node the node is removed;
+  /// neighbouring nodes are not removed together, so the removal of a node
+  /// does not make its neighbours be split again. The nodes set with
+  /// Set_xrange are always kept: features which develop between nodes with
+  /// similar states cannot be detected, so these nodes should be just fine
+  /// enough to show where the state will vary. If inserting all nodes would
+  /// exceed the largest number of nodes, the pairs which differ most are
+  /// refined first.
+  ///
+  /// Evolve divides each call into intervals no longer than the given one,
+  /// and adapts the grid after each of them; Evolve with a list of output
+  /// times does not adapt it. When the nodes change the system buffer and the
+  /// views of the state are reallocated, everything which the library
+  /// computed for the nodes (such as static terms, tabulated kernels and node
+  /// groups) is computed again when needed, and GridChanged is called.
+  /// Derived classes must therefore compute the terms of the derivative from
+  /// Get_x rather than from a fixed number of nodes.
+  ///\param tolerance the largest relative difference between neighbouring
+  ///       nodes; zero (the default) keeps the grid fixed
+  ///\param interval the longest interval between adaptations; zero adapts
+  ///       the grid once at the end of each call to Evolve
+  ///\param max_nodes the largest number of nodes; zero for no limit
+  void Set_AdaptiveGrid(double tolerance, double interval=0, unsigned int max_nodes=0);
+  ///\brief Get the relative difference between neighbouring nodes allowed by
+  /// the adaptive grid, or zero if the grid is fixed
+  double Get_AdaptiveGridTolerance() const;
+  ///\brief Set how the states are interpolated in x between nodes
+  ///
+  /// Applies to GetIntermediateState, GetExpectationValueD and
+  /// GetExpectationValuesD. The cubic methods interpolate each component of
+  /// the density matrices with a cubic polynomial on each interval, whose
+  /// slopes at the nodes are computed from the neighbouring nodes at the end
+  /// of each call to Evolve, so that each query still uses only the two
+  /// bracketing nodes. After changing the states directly the slopes are
+  /// stale; calling this function again recomputes them. The default is
+  /// linear interpolation.
+  void Set_Interpolation(interpolation method);
+  ///\brief Get how the states are interpolated in x between nodes
+  interpolation Get_Interpolation() const;
+  ///\brief Keep an interpolant for the last step taken by each call to Evolve
+  ///
+  /// When enabled, the native Runge-Kutta integrators store a polynomial
+  /// approximation of the state over the last step, so that GetStateAt and
+  /// GetExpectationValueAt can be used for any time within that step. The
+  /// Dormand-Prince and Tsitouras methods use their fourth order continuous
+  /// extensions, which need no additional evaluations of the derivative;
+  /// Verner's method uses cubic Hermite interpolation, which needs one
+  /// additional evaluation at the end of each call to Evolve. Being only
+  /// third order, this interpolant is typically two to three orders of
+  /// magnitude less accurate than the steps of the sixth order method, so
+  /// states needed to the full accuracy of the method should be obtained by
+  /// evolving to the times of interest, for example with the Evolve
+  /// overload which takes a list of output times. No interpolant
+  /// is kept when evolving with the GSL or Magnus integrators, with
+  /// multi-rate stepping or with split steps.
+  void Set_DenseOutput(bool opt);
+  ///\brief Get whether an interpolant is kept for the last step
+  bool Get_DenseOutput() const;
+  ///\brief Returns the start of the interval in which GetStateAt can be used
+  ///
+  /// The interval ends at the current time. If no interpolant is available
+  /// the current time is returned.
+  double Get_DenseOutputStart() const;
 
   ///\brief Turns on and off adaptive runge-kutta stepping
   ///\param opt If true: uses adaptive stepping, else: it does not.
@@ -317,6 +1167,39 @@ class SQuIDS {
   void Set_GammaScalarTerms(bool opt);
   ///\brief Activate other scalar interactions
   void Set_OtherScalarTerms(bool opt);
+  ///\brief Activate the non-local terms for the density matrices
+  ///
+  /// RhoKernel is evaluated once for each pair of nodes and each density
+  /// matrix when the derivative is next computed, and again after the x range
+  /// changes; enable the option again to make the library reevaluate it after
+  /// changing any parameters it depends on. The tabulated kernels take
+  /// Get_nx()*Get_nx() values for each density matrix, and are applied as a
+  /// blocked matrix product over the state, divided between the threads by
+  /// rows. Leading and trailing zeros of each row of the kernel are skipped,
+  /// so triangular and banded kernels cost proportionally less.
+  void Set_NonLocalRhoTerms(bool opt);
+  ///\brief Activate the non-local terms for the scalars
+  ///
+  /// Follows the same conventions as Set_NonLocalRhoTerms, using ScalarKernel.
+  void Set_NonLocalScalarTerms(bool opt);
+  ///\brief Set the accuracy to which the non-local kernels are approximated
+  ///
+  /// With a positive tolerance each tabulated kernel is compressed into a
+  /// hierarchy of blocks: the blocks off the diagonal are replaced by low
+  /// rank approximations found by adaptive cross approximation, negligible
+  /// blocks are dropped, and only small blocks along the diagonal are kept as
+  /// they are. The approximation differs from the kernel by at most the
+  /// tolerance times the Frobenius norm of the kernel. Kernels which are
+  /// smooth, or separable on either side of the diagonal as many cascade and
+  /// regeneration kernels are, then cost O(nx*log(nx)) operations to apply
+  /// rather than O(nx^2), and the full table is released. Kernels which do
+  /// not compress well are applied exactly. Setting the tolerance makes the
+  /// kernels be tabulated again.
+  ///\param tolerance the relative accuracy, zero (the default) to apply the
+  ///       kernels exactly
+  void Set_KernelCompression(double tolerance);
+  ///\brief Get the accuracy to which the non-local kernels are approximated
+  double Get_KernelCompression() const;
   ///\brief If set to false will disable all numerics
   void Set_AnyNumerics(bool opt);
   ///\brief Set the minimum runge-kutta step
@@ -324,6 +1207,9 @@ class SQuIDS {
   ///\brief Set the maximum runge-kutta step
   void Set_h_max(double opt);
   ///\brief Set the initial runge-kutta step
+  ///
+  /// When using a persistent driver this also discards the step size carried
+  /// over from the previous call to Evolve.
   void Set_h(double opt);
   ///\brief Get the minimum runge-kutta step
   double Get_h_min() const;
@@ -343,6 +1229,104 @@ class SQuIDS {
   double Get_abs_error() const;
   ///\brief Get the number of steps when not using adaptive stepping
   double Get_NumSteps() const;
+  ///\brief Keep the GSL stepper, control and evolution objects between calls to Evolve
+  ///
+  /// When enabled, each call to Evolve starts with the step size which was
+  /// found to be suitable at the end of the previous call, instead of the
+  /// initial step size. If no initial step size has been set with Set_h, the
+  /// first step is chosen automatically. The driver is recreated (and the step
+  /// size estimated again) whenever the step function, the tolerances or the
+  /// size of the system change.
+  ///\param opt If true: keeps the driver, else: creates a new one for every call to Evolve
+  void Set_PersistentDriver(bool opt);
+  ///\brief Get whether the GSL driver is kept between calls to Evolve
+  bool Get_PersistentDriver() const;
+  ///\brief Rotate HI and GammaRho into the interaction picture automatically
+  ///
+  /// The state of the system is always stored in the interaction picture with
+  /// respect to H0, which is why GetExpectationValue evolves operators with
+  /// H0. By default, HI and GammaRho must also be given in that frame. When
+  /// this option is enabled HI and GammaRho are instead given in the same
+  /// frame as H0, and are rotated by the library using the time elapsed since
+  /// the initial time, with the coefficients for each node cached for each
+  /// time at which the derivative is evaluated. H0 must be diagonal, and is
+  /// evaluated once per node when this option is enabled and when the x
+  /// range changes; enable the option again to make the library reevaluate
+  /// it after changing any parameters it depends on. InteractionsRho is not
+  /// rotated.
+  ///\param opt If true: rotates HI and GammaRho, else: uses them as given
+  void Set_InteractionPicture(bool opt);
+  ///\brief Get whether HI and GammaRho are rotated into the interaction picture automatically
+  bool Get_InteractionPicture() const;
+  ///\brief Declare that HI does not depend on time
+  ///
+  /// HI is then evaluated once for each node and density matrix, and the
+  /// results are applied by Derive without calling HI. For SU(2) the linear
+  /// map from rho to iCommutator(rho,HI) is stored as a dense real matrix,
+  /// combined with the map of GammaRho if that is also declared static; for
+  /// larger dimensions the stored terms are applied with the batched kernels.
+  /// The terms are evaluated when the derivative is next computed, and again
+  /// after the x range or the enabled terms change; enable the option again to
+  /// make the library reevaluate HI after changing any parameters it depends
+  /// on. Static terms are not used in the interaction picture handled by the
+  /// library (see Set_InteractionPicture), in which the rotated terms depend
+  /// on time, nor by the Magnus integrator and the Jacobian, which call HI.
+  ///\param opt If true: HI is evaluated once, else: it is evaluated for every derivative
+  void Set_StaticHI(bool opt);
+  ///\brief Get whether HI has been declared not to depend on time
+  bool Get_StaticHI() const;
+  ///\brief Declare that GammaRho does not depend on time
+  ///
+  /// Follows the same conventions as Set_StaticHI, with the map from rho to
+  /// -ACommutator(GammaRho,rho).
+  ///\param opt If true: GammaRho is evaluated once, else: it is evaluated for every derivative
+  void Set_StaticGammaRho(bool opt);
+  ///\brief Get whether GammaRho has been declared not to depend on time
+  bool Get_StaticGammaRho() const;
+  ///\brief Get the step size which will be used to start the next call to Evolve
+  ///
+  /// Only meaningful when using a persistent driver or a native integrator;
+  /// returns zero if no step size has been determined yet.
+  double Get_h_last() const;
+  ///\brief Set the number of threads used to compute the derivative
+  ///
+  /// With more than one thread, the nodes are divided among the threads in
+  /// Derive, so the functions which compute the terms of the derivative must
+  /// follow the rules described in the class documentation.
+  ///\param n the number of threads, including the calling thread; zero uses
+  ///         one thread per available core
+  void Set_NumThreads(unsigned int n);
+  ///\brief Get the number of threads used to compute the derivative
+  unsigned int Get_NumThreads() const;
+  ///\brief Set the number of nodes a thread processes at a time
+  ///
+  /// Smaller chunks balance uneven per-node costs better, larger chunks
+  /// reduce the scheduling overhead.
+  ///\param n the chunk size; zero chooses a size automatically
+  void Set_ThreadChunkSize(unsigned int n);
+  ///\brief Get the number of nodes a thread processes at a time (zero if automatic)
+  unsigned int Get_ThreadChunkSize() const;
+  ///\brief Set whether the threads used to compute the derivative are bound to cores
+  ///
+  /// This is currently only supported on Linux, elsewhere it has no effect.
+  void Set_ThreadAffinity(bool opt);
+  ///\brief Get whether the threads used to compute the derivative are bound to cores
+  bool Get_ThreadAffinity() const;
+
+  //***************************************************************
+  ///\brief Returns the counts and times collected since the system was
+  /// created or ResetStats was last called
+  ///
+  /// The counters cost nothing noticeable and are always kept. The times are
+  /// measured with the time stamp counter, where available, around each term
+  /// for each block of nodes, and are summed over the threads, so that they
+  /// can exceed the elapsed time. Terms computed by DeriveLocalTerms, as in
+  /// SQuIDS_static, or by the Magnus integrator are not timed. With a GSL
+  /// stepper and no persistent driver the smallest step is not known, and
+  /// only the numbers of steps are recorded.
+  solverStats GetStats() const;
+  ///\brief Sets all counts and times to zero
+  void ResetStats();
 
   //***************************************************************
   ///\brief Returns the expectation value for a given operator for a give state irho in a node ix.
@@ -363,14 +1347,35 @@ class SQuIDS {
   double GetExpectationValue(SU_vector op, unsigned int nrh, unsigned int i, double scale, std::vector<bool>& avr) const;
 
   //***************************************************************
-  ///\brief Returns the intermediate state using linear interpolation in "x"
+  ///\brief Returns the state at a time within the last step taken by Evolve
+  ///
+  /// Requires dense output (see Set_DenseOutput). Like the current state, the
+  /// result is in the interaction picture with respect to H0.
+  ///\param t the time, between Get_DenseOutputStart() and Get_t()
+  ///\returns the states of all nodes, which remain valid until the next
+  ///         call to GetStateAt
+  const SU_state* GetStateAt(double t);
+
+  //***************************************************************
+  ///\brief Returns the expectation value for a given operator for a given state irho in a node ix,
+  /// at a time within the last step taken by Evolve
+  ///
+  /// Requires dense output (see Set_DenseOutput); only the requested node is interpolated.
+  ///\param op operator
+  ///\param irho index of rho
+  ///\param ix index in the array "x"
+  ///\param t the time, between Get_DenseOutputStart() and Get_t()
+  double GetExpectationValueAt(SU_vector op, unsigned int irho, unsigned int ix, double t) const;
+
+  //***************************************************************
+  ///\brief Returns the intermediate state interpolated in "x" (see Set_Interpolation)
   ///\param irho index of rho
   ///\param x value of x
   SU_vector GetIntermediateState(unsigned int irho, double x) const;
 
   //***************************************************************
   ///\brief Returns the expectation value for a given operator for the rho given by irho
-  /// and using linear interpolation in "x"
+  /// interpolating in "x" (see Set_Interpolation)
   ///\param op operator 
   ///\param irho index of rho
   ///\param x value of x
@@ -379,7 +1384,7 @@ class SQuIDS {
   //***************************************************************
   ///\brief Returns the expectation value for a given operator for a give state irho in a node ix when
   /// consindering averaging of oscillations. Oscillations are averaged if the phase is larger than scale
-  /// the bool pointer is true for all scales that are averaged out. It uses linear interpolation in "x"
+  /// the bool pointer is true for all scales that are averaged out. It interpolates in "x" as selected with Set_Interpolation
   ///\param op operator
   ///\param irho index of rho
   ///\param x value of x
@@ -400,7 +1405,7 @@ class SQuIDS {
   };
 
   ///\brief Returns the expectation value for a given operator for the rho given by irho
-  /// and using linear interpolation in "x"
+  /// interpolating in "x" (see Set_Interpolation)
   ///\param op operator
   ///\param irho index of rho
   ///\param x value of x
@@ -411,7 +1416,7 @@ class SQuIDS {
  //***************************************************************
   ///\brief Returns the expectation value for a given operator for a give state irho in a node ix when
   /// consindering averaging of oscillations. Oscillations are averaged if the phase is larger than scale
-  /// the bool pointer is true for all scales that are averaged out. It uses linear interpolation in "x"
+  /// the bool pointer is true for all scales that are averaged out. It interpolates in "x" as selected with Set_Interpolation
   ///\param op operator
   ///\param irho index of rho
   ///\param x value of x
@@ -419,6 +1424,121 @@ class SQuIDS {
   ///\param avg bool array which is true for all scales that were averaged out
   double GetExpectationValueD(const SU_vector& op, unsigned int nrh,  double x, expectationValueDBuffer& buf, double scale, std::vector<bool>& avr) const;
 
+  //***************************************************************
+  ///\brief Returns the expectation values of several operators for the rho
+  /// given by irho at several values of x, interpolating in "x" (see Set_Interpolation)
+  ///
+  /// Gives the same results as GetExpectationValueD for each pair of operator
+  /// and x, up to rounding. For each x, H0 is evaluated once and the
+  /// interpolated state is rotated out of the interaction picture once, with
+  /// a single table of sines and cosines, after which each operator costs
+  /// only a scalar product. The bracketing nodes are found by advancing from
+  /// those of the previous x as long as the x values increase, so sorted x
+  /// values are cheapest. If the system uses several threads (see
+  /// Set_NumThreads) the x values are divided among them; this function must
+  /// then not be called from the functions which run on the threads, or
+  /// concurrently with other calls which use them, such as Evolve.
+  ///\param ops the operators
+  ///\param irho index of rho
+  ///\param xs the values of x
+  ///\param out storage for xs.size()*ops.size() results; the expectation value
+  ///           of ops[j] at xs[i] is stored in out[i*ops.size()+j]
+  void GetExpectationValuesD(const std::vector<SU_vector>& ops, unsigned int irho, const std::vector<double>& xs, double* out) const;
+
+  //***************************************************************
+  ///\brief Returns the expectation values of several operators for the rho
+  /// given by irho at several values of x, averaging oscillations whose phase
+  /// is larger than scale, interpolating in "x" (see Set_Interpolation)
+  ///
+  /// Follows the same conventions as the overload without averaging. Which
+  /// scales were averaged out is not reported, since it differs between the
+  /// values of x.
+  ///\param ops the operators
+  ///\param irho index of rho
+  ///\param xs the values of x
+  ///\param out storage for xs.size()*ops.size() results
+  ///\param scale scale upon which oscillations will be averaged out
+  void GetExpectationValuesD(const std::vector<SU_vector>& ops, unsigned int irho, const std::vector<double>& xs, double* out, double scale) const;
+
+  ///This type encapsulates the temporary storage needed by GetExpectationValuesD
+  struct expectationValuesDBuffer{
+  private:
+    ///the evolution coefficients and two states for each thread
+    std::vector<double> scratch;
+    ///the scales averaged out for each thread
+    std::vector<std::vector<bool>> averaged;
+    ///H0 at each queried x, when the queries are split among threads
+    std::vector<double> h0;
+    friend class SQuIDS;
+  };
+
+  //***************************************************************
+  ///\brief Returns the expectation values of several operators for the rho
+  /// given by irho at several values of x, interpolating in "x" (see Set_Interpolation)
+  ///
+  /// Once the buffer has grown to the size needed by the system, no memory
+  /// is allocated other than by H0.
+  ///\param ops the operators
+  ///\param irho index of rho
+  ///\param xs the values of x
+  ///\param out storage for xs.size()*ops.size() results
+  ///\param buf a buffer containing the necessary temporary storage, which
+  ///           must not be used by another call at the same time
+  void GetExpectationValuesD(const std::vector<SU_vector>& ops, unsigned int irho, const std::vector<double>& xs, double* out, expectationValuesDBuffer& buf) const;
+
+  //***************************************************************
+  ///\brief Returns the expectation values of several operators for the rho
+  /// given by irho at several values of x, averaging oscillations whose phase
+  /// is larger than scale, interpolating in "x" (see Set_Interpolation)
+  ///\param ops the operators
+  ///\param irho index of rho
+  ///\param xs the values of x
+  ///\param out storage for xs.size()*ops.size() results
+  ///\param buf a buffer containing the necessary temporary storage, which
+  ///           must not be used by another call at the same time
+  ///\param scale scale upon which oscillations will be averaged out
+  void GetExpectationValuesD(const std::vector<SU_vector>& ops, unsigned int irho, const std::vector<double>& xs, double* out, expectationValuesDBuffer& buf, double scale) const;
+
+  //***************************************************************
+  ///\brief Writes the state of the system and its settings to a file
+  ///
+  /// The file contains the x values, the times, the integrator settings,
+  /// the mixing angles, phases and energy differences of the parameter
+  /// object for the system's dimension, the settings of the adaptive grid
+  /// with the nodes it keeps, the interpolation in x, and the state buffer. It begins with
+  /// a fixed size header giving the format version, the dimensions and the
+  /// offsets of these sections; each section starts at a multiple of 64
+  /// bytes, so the file can be memory mapped and the state used in place.
+  /// Numbers are stored in the byte order of the machine which wrote them.
+  /// The thread settings, and any parameters of derived classes, are not
+  /// included.
+  ///\param path the file to write
+  void SaveCheckpoint(const std::string& path) const;
+  //***************************************************************
+  ///\brief Restores the state of the system and its settings from a file
+  ///
+  /// Reads a file written by SaveCheckpoint. If the dimensions of the
+  /// system differ from those in the file the system is reinitialized with
+  /// ini first; otherwise the existing buffers are reused, and the state is
+  /// copied into them directly from the mapped file. Derived classes must
+  /// restore any parameters of their own, and recompute anything which
+  /// depends on x or the parameter object.
+  ///\param path the file to read
+  void LoadCheckpoint(const std::string& path);
+
+  //***************************************************************
+  ///\brief Makes the state and settings of this system match another
+  ///
+  /// Copies the state, the times, the x values, the mixing angles, phases
+  /// and energy differences for the system's dimension, and the settings of
+  /// the integrator, including the step size carried between calls to
+  /// Evolve. The thread settings are kept. If the dimensions differ the
+  /// system is reinitialized with ini first; otherwise no memory is
+  /// allocated, so this is a cheap way to reset a system to a prepared
+  /// starting point. Members of derived classes are not copied.
+  ///\param other the system to copy
+  void CopyStateFrom(const SQuIDS& other);
+
   ///\brief Returns the initial time of the system
   double Get_t_initial() const{ return(t_ini); }
   ///\brief Returns the current time of the system
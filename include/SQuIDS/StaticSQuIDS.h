@@ -0,0 +1,136 @@
+
+ /******************************************************************************
+ *    This program is free software: you can redistribute it and/or modify     *
+ *   it under the terms of the GNU General Public License as published by      *
+ *   the Free Software Foundation, either version 3 of the License, or         *
+ *   (at your option) any later version.                                       *
+ *                                                                             *
+ *   This program is distributed in the hope that it will be useful,           *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the             *
+ *   GNU General Public License for more details.                              *
+ *                                                                             *
+ *   You should have received a copy of the GNU General Public License         *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.     *
+ *                                                                             *
+ *   Authors:                                                                  *
+ *      Carlos Arguelles (University of Wisconsin Madison)                     *
+ *         carguelles@icecube.wisc.edu                                         *
+ *      Christopher Weaver (University of Wisconsin Madison)                   *
+ *         chris.weaver@icecube.wisc.edu                                       *
+ *      Jordi Salvado (University of Wisconsin Madison)                        *
+ *         jsalvado@icecube.wisc.edu                                           *
+ ******************************************************************************/
+
+
+#ifndef SQUIDS_STATICSQUIDS_H
+#define SQUIDS_STATICSQUIDS_H
+
+#if __cplusplus < 201103L
+#error C++11 compiler required. Update your compiler and use the flag -std=c++11
+#endif
+
+#include "SQuIDS.h"
+
+namespace squids{
+
+///\brief Selects the terms of the derivative computed by SQuIDS_static
+///
+/// The parameters correspond to Set_CoherentRhoTerms, Set_NonCoherentRhoTerms,
+/// Set_OtherRhoTerms, Set_GammaScalarTerms and Set_OtherScalarTerms. Terms
+/// which are not selected are removed from the derivative at compile time.
+template<bool CoherentRho, bool NonCoherentRho=false, bool OtherRho=false,
+         bool GammaScalar=false, bool OtherScalar=false>
+struct term_policy{
+  static constexpr bool coherent_rho=CoherentRho;
+  static constexpr bool noncoherent_rho=NonCoherentRho;
+  static constexpr bool other_rho=OtherRho;
+  static constexpr bool gamma_scalar=GammaScalar;
+  static constexpr bool other_scalar=OtherScalar;
+};
+
+///\brief A SQuIDS system whose terms are resolved at compile time
+///
+/// Derived must derive from SQuIDS_static<Derived,TermPolicy> and define the
+/// term functions selected by TermPolicy (see term_policy) with the same
+/// signatures as in SQuIDS, for example
+///
+///     class my_system : public SQuIDS_static<my_system,term_policy<true,true>>{ ... };
+///
+/// When computing the derivative these functions are called by their
+/// qualified names rather than through the virtual function table, so the
+/// compiler can inline them into the loop over the nodes, and the terms which
+/// are not selected are compiled out. The constructors enable exactly the
+/// selected terms.
+///
+/// Everything else behaves as for SQuIDS: the term functions remain virtual,
+/// and the parts of the library which do not compute the derivative, such as
+/// the Jacobian and the Magnus integrator, call them as usual. The derivative
+/// is computed by the general code, node by node, when a term which is not
+/// selected is enabled at run time, and when the library transforms the terms
+/// itself (see Set_InteractionPicture, Set_StaticHI and Set_StaticGammaRho).
+/// The batched term functions are not used. Selected terms may still be
+/// disabled at run time, which costs one test for each range of nodes.
+template<typename Derived, typename TermPolicy>
+class SQuIDS_static : public SQuIDS{
+public:
+  SQuIDS_static(){
+    enable_terms();
+  }
+  ///\brief Constructs a system with the selected terms enabled
+  ///
+  /// The parameters are those of the corresponding SQuIDS constructor.
+  SQuIDS_static(unsigned int nx, unsigned int dim, unsigned int nrho, unsigned int nscalar, double ti=0.0):
+  SQuIDS(nx,dim,nrho,nscalar,ti){
+    enable_terms();
+  }
+
+private:
+  void enable_terms(){
+    Set_CoherentRhoTerms(TermPolicy::coherent_rho);
+    Set_NonCoherentRhoTerms(TermPolicy::noncoherent_rho);
+    Set_OtherRhoTerms(TermPolicy::other_rho);
+    Set_GammaScalarTerms(TermPolicy::gamma_scalar);
+    Set_OtherScalarTerms(TermPolicy::other_scalar);
+  }
+
+  bool DeriveLocalTerms(unsigned int ix_begin, unsigned int ix_end) override{
+    if((CoherentRhoTerms && !TermPolicy::coherent_rho) || (NonCoherentRhoTerms && !TermPolicy::noncoherent_rho)
+       || (OtherRhoTerms && !TermPolicy::other_rho) || (GammaScalarTerms && !TermPolicy::gamma_scalar)
+       || (OtherScalarTerms && !TermPolicy::other_scalar))
+      return(false);
+    const Derived& self=static_cast<const Derived&>(*this);
+    //the operations are those of DeriveLocalNodes, so the results are the same
+    const bool coherent=(TermPolicy::coherent_rho && CoherentRhoTerms);
+    const bool noncoherent=(TermPolicy::noncoherent_rho && NonCoherentRhoTerms);
+    const bool other=(TermPolicy::other_rho && OtherRhoTerms);
+    for(unsigned int i = 0; i < nrhos; i++){
+      for(unsigned int ei = ix_begin; ei < ix_end; ei++){
+        if(coherent)
+          dstate[ei].rho[i] = iCommutator(estate[ei].rho[i],self.Derived::HI(ei,i,t));
+        else
+          dstate[ei].rho[i].SetAllComponents(0.);
+        if(noncoherent)
+          dstate[ei].rho[i] -= ACommutator(self.Derived::GammaRho(ei,i,t),estate[ei].rho[i]);
+        if(other)
+          dstate[ei].rho[i] += self.Derived::InteractionsRho(ei,i,t);
+      }
+    }
+    const bool gamma_scalar=(TermPolicy::gamma_scalar && GammaScalarTerms);
+    const bool other_scalar=(TermPolicy::other_scalar && OtherScalarTerms);
+    for(unsigned int ei = ix_begin; ei < ix_end; ei++){
+      for(unsigned int is=0;is<nscalars;is++){
+        dstate[ei].scalar[is]=0.;
+        if(gamma_scalar)
+          dstate[ei].scalar[is] += -estate[ei].scalar[is]*self.Derived::GammaScalar(ei,is,t);
+        if(other_scalar)
+          dstate[ei].scalar[is] += self.Derived::InteractionsScalar(ei,is,t);
+      }
+    }
+    return(true);
+  }
+};
+
+} //namespace squids
+
+#endif //SQUIDS_STATICSQUIDS_H
@@ -0,0 +1,85 @@
+#ifndef SQUIDS_DETAIL_BATCHKERNELS_H
+#define SQUIDS_DETAIL_BATCHKERNELS_H
+
+#include <cstddef>
+
+namespace squids{
+namespace detail{
+
+///The number of nodes processed together by the batched kernels, which is
+///the number of doubles held by one vector register of the target.
+///
+///The kernels work on vectors in batch layout, in which component k of the
+///vector belonging to node j of the batch is stored at index k*batch_lanes+j.
+///The innermost loops of the kernels then run over the nodes of the batch,
+///so that they vectorize across nodes rather than across components. The
+///kernels process several batches stored one after the other in each call.
+#if defined(__AVX512F__)
+const unsigned int batch_lanes=8;
+#elif defined(__AVX__)
+const unsigned int batch_lanes=4;
+#else
+const unsigned int batch_lanes=2;
+#endif
+
+///Copies vectors into batch layout.
+///\param size the number of components of each vector
+///\param src the components of each vector
+///\param count the number of vectors; unused lanes of the last batch are
+///       filled with zeros
+///\param out the storage for (count+batch_lanes-1)/batch_lanes batches of
+///       size*batch_lanes values each
+void batch_gather(unsigned int size, const double* const* src, unsigned int count, double* out);
+
+///Copies vectors out of batch layout.
+///\param size the number of components of each vector
+///\param in the vectors in batch layout
+///\param count the number of vectors to copy
+///\param dst the storage for the components of each vector
+void batch_scatter(unsigned int size, const double* in, unsigned int count, double* const* dst);
+
+///Computes iCommutator(u,v) for each node of consecutive batches.
+///The operations on each lane are exactly those performed by the SU_vector
+///operation, so the results agree bit for bit.
+///\param dim the dimension of the vectors
+///\param nbatches the number of batches
+void batch_icommutator(unsigned int dim, unsigned int nbatches, const double* u, const double* v, double* out);
+
+///Subtracts ACommutator(u,v) from out for each node of consecutive batches.
+///\param dim the dimension of the vectors
+///\param nbatches the number of batches
+void batch_subtract_acommutator(unsigned int dim, unsigned int nbatches, const double* u, const double* v, double* out);
+
+///Computes v.Evolve(buffer) for each node of consecutive batches.
+///\param dim the dimension of the vectors
+///\param nbatches the number of batches
+///\param buffers the coefficients computed by PrepareEvolve for each node, in
+///       batch layout
+void batch_evolve(unsigned int dim, unsigned int nbatches, const double* buffers, const double* v, double* out);
+
+///Adds the product of rows of a matrix with a set of vectors to another set
+///of vectors, computing out[r][k]+=sum_j kernel[r][j]*in[j][k].
+///
+///The product is blocked, so that each block of the input vectors is reused
+///from the cache for all rows, and several rows are accumulated together so
+///that each input vector is loaded once for all of them. The sum for each row
+///is computed in the same order for any division of the rows between calls.
+///\param nrows the number of rows
+///\param width the number of components of each vector, at most
+///       SQUIDS_MAX_HILBERT_SIZE
+///\param kernel the first row of the matrix
+///\param kernel_stride the distance between the rows of the matrix
+///\param bounds the first and one past the last column of each row which may
+///       be nonzero, as two values per row
+///\param in the vector belonging to the first column of the matrix
+///\param in_stride the distance between the input vectors
+///\param out the vector belonging to the first row
+///\param out_stride the distance between the output vectors
+void kernel_product(unsigned int nrows, unsigned int width, const double* kernel, size_t kernel_stride,
+                    const unsigned int* bounds, const double* in, size_t in_stride,
+                    double* out, size_t out_stride);
+
+} //namespace detail
+} //namespace squids
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef SQUIDS_DETAIL_GRIDINDEX_H
+#define SQUIDS_DETAIL_GRIDINDEX_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+namespace squids{
+namespace detail{
+
+///Finds the position of a value among sorted nodes in constant time.
+///
+///For nodes spaced evenly in x or in log(x) the position is computed
+///directly. For other nodes the range of the nodes is divided into as many
+///equal buckets as there are nodes, and the first node of each bucket is
+///stored, so that only the nodes of one bucket have to be searched. Either
+///way the estimate is checked against the nodes themselves, so the results
+///are exactly those of std::lower_bound.
+class grid_index{
+public:
+  ///How the nodes are spaced
+  enum class spacing{
+    ///evenly
+    linear,
+    ///evenly in the logarithm
+    logarithmic,
+    ///in any other way
+    arbitrary
+  };
+
+  grid_index();
+
+  ///Prepares the index for a set of nodes.
+  ///\param nodes the nodes, in increasing order
+  ///\param kind how the nodes were constructed; the index falls back to
+  ///       buckets if the nodes do not have the stated spacing
+  void build(const std::vector<double>& nodes, spacing kind);
+
+  ///Discards the index.
+  void clear();
+
+  ///The spacing for which the index was built.
+  spacing kind() const{ return(type); }
+
+  ///The position of the first node which is not less than a value.
+  ///\param nodes the nodes for which the index was built
+  ///\param value the value to look for
+  size_t lower_bound(const std::vector<double>& nodes, double value) const{
+    const size_t n=nodes.size();
+    if(n==0 || !(value>nodes.front()))
+      return(0);
+    if(value>nodes.back())
+      return(n);
+    if(type==spacing::arbitrary){
+      const size_t bucket=std::min<double>((value-origin)*inverse_step,n-1);
+      size_t low=buckets[bucket], high=buckets[bucket+1];
+      //rounding may put the value in a neighbouring bucket
+      while(low>0 && !(nodes[low-1]<value))
+        low--;
+      while(high<n && nodes[high]<value)
+        high++;
+      while(low<high){
+        const size_t middle=low+(high-low)/2;
+        if(nodes[middle]<value)
+          low=middle+1;
+        else
+          high=middle;
+      }
+      return(low);
+    }
+    const double position=((type==spacing::logarithmic ? std::log(value) : value)-origin)*inverse_step;
+    size_t guess=std::min<double>(std::ceil(position),n-1);
+    while(guess>0 && !(nodes[guess-1]<value))
+      guess--;
+    while(guess<n && nodes[guess]<value)
+      guess++;
+    return(guess);
+  }
+
+private:
+  spacing type;
+  ///the coordinate of the first node, and the inverse of the distance
+  ///between nodes or buckets, in x or in log(x)
+  double origin, inverse_step;
+  ///the first node in each bucket, followed by the number of nodes
+  std::vector<size_t> buckets;
+};
+
+} //namespace detail
+} //namespace squids
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef SQUIDS_DETAIL_KERNELCOMPRESSION_H
+#define SQUIDS_DETAIL_KERNELCOMPRESSION_H
+
+#include <cstddef>
+#include <vector>
+
+namespace squids{
+namespace detail{
+
+///A square matrix stored as a hierarchy of blocks, most of which are low rank.
+///
+///The matrix is split into two halves along both directions. The two blocks
+///off the diagonal are approximated by products U*V^T found by adaptive cross
+///approximation, and the two blocks on the diagonal are split again, until
+///they are small enough to be stored densely. Blocks which cannot be
+///approximated with a small rank are also stored densely, and blocks which
+///are negligible are dropped, so triangular kernels lose half of their
+///blocks. Smooth kernels and kernels which are separable on either side of
+///the diagonal have blocks of very low rank, so that applying the matrix
+///costs O(n*log(n)) rather than O(n^2) operations.
+class compressed_kernel{
+public:
+  compressed_kernel();
+
+  ///Approximates a matrix.
+  ///\param n the number of rows and columns
+  ///\param entries the entries of the matrix, in row-major order
+  ///\param tolerance the largest difference between the approximation and
+  ///       the matrix allowed, relative to the Frobenius norm of the matrix
+  void compress(unsigned int n, const double* entries, double tolerance);
+
+  ///Discards the approximation.
+  void clear();
+
+  ///Whether no approximation is stored.
+  bool empty() const{ return(blocks.empty()); }
+
+  ///The number of values stored for the approximation.
+  size_t stored_values() const{ return(values.size()); }
+
+  ///The number of values needed to store the projections of the vectors
+  ///onto the low rank blocks, for each component of the vectors.
+  size_t projection_size() const{ return(total_rank); }
+
+  ///Computes the projections of a set of vectors needed by apply.
+  ///\param width the number of components of each vector
+  ///\param in the vector belonging to the first column of the matrix
+  ///\param in_stride the distance between the input vectors
+  ///\param projections storage for projection_size()*width values
+  void project(unsigned int width, const double* in, size_t in_stride, double* projections) const;
+
+  ///Adds the product of a range of rows of the matrix with a set of vectors
+  ///to another set of vectors. The result for each row does not depend on
+  ///how the rows are divided between calls.
+  ///\param row_begin the first row
+  ///\param row_end one past the last row
+  ///\param width the number of components of each vector, at most
+  ///       SQUIDS_MAX_HILBERT_SIZE
+  ///\param in the vector belonging to the first column of the matrix
+  ///\param in_stride the distance between the input vectors
+  ///\param projections the projections computed by project for in
+  ///\param out the vector belonging to row row_begin
+  ///\param out_stride the distance between the output vectors
+  void apply(unsigned int row_begin, unsigned int row_end, unsigned int width,
+             const double* in, size_t in_stride, const double* projections,
+             double* out, size_t out_stride) const;
+
+  ///Writes the approximation as a dense matrix.
+  ///\param out storage for the n*n entries, in row-major order
+  void expand(double* out) const;
+
+private:
+  struct block{
+    unsigned int row_begin, row_end, col_begin, col_end;
+    ///the rank of the approximation, or zero for a dense block
+    unsigned int rank;
+    ///the position of the entries, or of U followed by V, in values
+    size_t offset;
+    ///the position of the nonzero column range of each row of a dense
+    ///block, or of the first projection of a low rank block
+    size_t index;
+  };
+  unsigned int n;
+  std::vector<block> blocks;
+  std::vector<double> values;
+  std::vector<unsigned int> bounds;
+  size_t total_rank;
+
+  ///Splits a diagonal block. The budget is the squared error allowed for
+  ///each entry of the matrix.
+  void build(const double* entries, unsigned int begin, unsigned int end, double budget);
+  ///Approximates an off diagonal block, with the same budget as build
+  void add_block(const double* entries, unsigned int row_begin, unsigned int row_end,
+                 unsigned int col_begin, unsigned int col_end, double budget);
+  ///Stores a block densely
+  void add_dense(const double* entries, unsigned int row_begin, unsigned int row_end,
+                 unsigned int col_begin, unsigned int col_end);
+};
+
+} //namespace detail
+} //namespace squids
+
+#endif
@@ -31,6 +31,17 @@ void gsl_matrix_complex_sub(gsl_matrix_complex *O,const gsl_matrix_complex *I,gs
 ///\param A the matrix to be exponentiated
 void matrix_exponential(gsl_matrix_complex * eA, const gsl_matrix_complex *A);
 
+///Compute exp(i*scale*H) for a small hermitian matrix H
+///
+///Uses scaling and squaring of a Taylor series in fixed size stack storage,
+///which is much cheaper than matrix_exponential for the matrix sizes
+///supported by SU_vector.
+///\param eA matrix into which the result will be written
+///\param H the hermitian matrix to be exponentiated, at most
+///         SQUIDS_MAX_HILBERT_DIM square
+///\param scale the factor multiplying i*H in the exponent
+void unitary_exponential(gsl_matrix_complex* eA, const gsl_matrix_complex* H, double scale);
+
 } // close math_detail namespace
 } // close squids namespace
 
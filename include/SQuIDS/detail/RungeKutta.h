@@ -0,0 +1,205 @@
+#ifndef SQUIDS_DETAIL_RUNGEKUTTA_H
+#define SQUIDS_DETAIL_RUNGEKUTTA_H
+
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+
+namespace squids{
+namespace detail{
+
+///The Butcher tableau of the Dormand-Prince 5(4) method.
+///J. R. Dormand and P. J. Prince, J. Comp. Appl. Math. 6, 19 (1980)
+///
+///Each tableau provides the nodes c, the (strictly lower triangular) matrix a,
+///the weights b of the propagated solution and the differences e between b
+///and the weights of the embedded solution. Methods with a continuous
+///extension also provide the coefficients of theta^1...theta^dense_degree in
+///the weights b(theta) with which the stages give the state at t+theta*h.
+struct dormand_prince_54{
+  enum{
+    stages=7,
+    ///the order of the propagated solution
+    order=5,
+    ///the order of the embedded solution
+    error_order=4,
+    ///whether the last stage is evaluated at the new state, so that it can be
+    ///reused as the first stage of the next step
+    fsal=true,
+    ///the degree of the continuous extension, zero if there is none
+    dense_degree=4
+  };
+  static const double c[stages];
+  static const double a[stages][stages];
+  static const double b[stages];
+  static const double e[stages];
+  static const double dense[stages][dense_degree];
+};
+
+///The Butcher tableau of the Tsitouras 5(4) method.
+///Ch. Tsitouras, Comput. Math. Appl. 62, 770 (2011)
+struct tsitouras_54{
+  enum{ stages=7, order=5, error_order=4, fsal=true, dense_degree=4 };
+  static const double c[stages];
+  static const double a[stages][stages];
+  static const double b[stages];
+  static const double e[stages];
+  static const double dense[stages][dense_degree];
+};
+
+///The Butcher tableau of Verner's 6(5) method, as used by DVERK.
+///J. H. Verner, SIAM J. Numer. Anal. 15, 772 (1978)
+struct verner_65{
+  enum{ stages=8, order=6, error_order=5, fsal=false, dense_degree=0 };
+  static const double c[stages];
+  static const double a[stages][stages];
+  static const double b[stages];
+  static const double e[stages];
+};
+
+///Storage for the stages of an explicit Runge-Kutta step
+struct rk_workspace{
+  ///the derivative at each stage
+  std::vector<double> k_data;
+  ///the stage derivatives, in stage order; permuted when a stage is reused
+  std::vector<double*> k;
+  ///the state at which the current stage is evaluated
+  std::vector<double> y_stage;
+  ///the state at the end of the step
+  std::vector<double> y_new;
+
+  ///Allocates space for a system of size n and a method with the given number
+  ///of stages, keeping the existing storage if it is already suitable
+  void resize(size_t n, unsigned int stages);
+};
+
+///A polynomial approximation of the state within one step,
+///y(t0+theta*h) = y0 + sum_p theta^p q_p for p=1...degree
+struct dense_interpolant{
+  double t0, h;
+  unsigned int degree;
+  std::vector<double> y0;
+  ///the vectors q_1...q_degree, one after the other
+  std::vector<double> q;
+
+  dense_interpolant():t0(0),h(0),degree(0){}
+  ///Whether no interpolant has been stored
+  bool empty() const{ return(degree==0); }
+  void clear(){ degree=0; }
+  ///Whether the time t lies within the step
+  bool contains(double t) const;
+  ///Computes the components [offset,offset+n) of the state at time t
+  ///\param out the storage for the n components
+  void evaluate(double t, size_t offset, size_t n, double* out) const;
+};
+
+///Stores the continuous extension of an explicit Runge-Kutta step.
+///\param coefficients the coefficients of the weights, as a stages by degree array
+///\param k the stage derivatives of the step, in stage order
+void rk_dense_output(dense_interpolant& d, double t0, double h, size_t n, const double* y0,
+                     const double* coefficients, unsigned int degree,
+                     const double* const* k, unsigned int stages);
+
+///Stores the cubic Hermite interpolant matching the state and its derivative
+///at both ends of a step.
+void hermite_dense_output(dense_interpolant& d, double t0, double h, size_t n,
+                          const double* y0, const double* y1,
+                          const double* f0, const double* f1);
+
+///Stores the continuous extension of a step of a method which has one.
+///\return whether the method has a continuous extension
+template<typename Tableau>
+typename std::enable_if<(Tableau::dense_degree>0),bool>::type
+rk_continuous_extension(dense_interpolant& d, double t0, double h, size_t n,
+                        const double* y0, const double* const* k){
+  rk_dense_output(d,t0,h,n,y0,&Tableau::dense[0][0],Tableau::dense_degree,k,Tableau::stages);
+  return(true);
+}
+
+template<typename Tableau>
+typename std::enable_if<(Tableau::dense_degree==0),bool>::type
+rk_continuous_extension(dense_interpolant&, double, double, size_t,
+                        const double*, const double* const*){
+  return(false);
+}
+
+///Computes out = y + h*sum_j coeffs[j]*k[j] for j<count.
+///The components are processed in blocks small enough to stay in the L1
+///cache, so each block of the output is written to memory once while the
+///inner loops over components vectorize.
+void rk_combine(size_t n, const double* y, double h, const double* coeffs,
+                const double* const* k, unsigned int count, double* out);
+
+///Computes the largest ratio over all components of the error estimate
+///h*sum_j e[j]*k[j] (j<count) to the tolerance
+///abs_error+rel_error*max(|y|,|y_new|).
+///A value greater than one means that the step should be rejected; if any
+///component of the estimate is not a number the result is not a number.
+double rk_error_norm(size_t n, const double* y, const double* y_new, double h,
+                     const double* e, const double* const* k, unsigned int count,
+                     double abs_error, double rel_error);
+
+///Step size control as described by Hairer, Norsett & Wanner, Solving
+///Ordinary Differential Equations I, section II.4, using the PI controller of
+///Gustafsson as in their DOPRI5 code.
+class step_controller{
+public:
+  ///\param error_order the order of the method used to estimate the error
+  explicit step_controller(unsigned int error_order);
+  ///Decides whether to accept a step, and how to change the step size
+  ///\param err the error norm of the step; the step is accepted if it is at most one
+  ///\param factor the factor by which the next step size should differ from this one
+  ///\return whether the step is accepted
+  bool judge(double err, double& factor);
+private:
+  double exponent, alpha, beta;
+  double err_prev;
+  bool rejected;
+};
+
+///Takes one step of an explicit Runge-Kutta method.
+///
+///The step may be restricted to the components [offset,offset+n) of the
+///state, in which case the other components of y_new and of the state passed
+///to the derivative are left untouched, and the derivative only has to
+///compute the components in the range.
+///\param f the derivative, called as f(t,y,dydt) with pointers to the full state
+///\param t the time at the start of the step
+///\param h the step size
+///\param offset the first component to step
+///\param n the number of components to step
+///\param y the state at the start of the step
+///\param y_new the storage for the state at the end of the step; may not alias y
+///\param ws the stage storage, which must have been resized for Tableau
+///\param first_stage_valid whether ws.k[0] already holds f(t,y)
+///\param estimate_error whether to compute the error estimate
+///\param abs_error the absolute tolerance used by the error estimate
+///\param rel_error the relative tolerance used by the error estimate
+///\return the error norm computed by rk_error_norm, or zero if estimate_error is false
+template<typename Tableau, typename Derivative>
+double rk_step(Derivative& f, double t, double h, size_t offset, size_t n,
+               const double* y, double* y_new, rk_workspace& ws, bool first_stage_valid,
+               bool estimate_error, double abs_error, double rel_error){
+  const unsigned int s=Tableau::stages;
+  const double* k[Tableau::stages];
+  for(unsigned int i=0; i<s; i++)
+    k[i]=ws.k[i]+offset;
+  if(!first_stage_valid)
+    f(t,y,ws.k[0]);
+  for(unsigned int i=1; i<s; i++){
+    //for a method with the FSAL property the last stage is the new state
+    double* stage_y=(Tableau::fsal && i==s-1) ? y_new : ws.y_stage.data();
+    rk_combine(n,y+offset,h,Tableau::a[i],k,i,stage_y+offset);
+    f(t+Tableau::c[i]*h,stage_y,ws.k[i]);
+  }
+  if(!Tableau::fsal)
+    rk_combine(n,y+offset,h,Tableau::b,k,s,y_new+offset);
+  if(!estimate_error)
+    return(0);
+  return(rk_error_norm(n,y+offset,y_new+offset,h,Tableau::e,k,s,abs_error,rel_error));
+}
+
+} //namespace detail
+} //namespace squids
+
+#endif
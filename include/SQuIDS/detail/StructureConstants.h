@@ -0,0 +1,32 @@
+#ifndef SQUIDS_DETAIL_STRUCTURECONSTANTS_H
+#define SQUIDS_DETAIL_STRUCTURECONSTANTS_H
+
+#include <vector>
+
+namespace squids{
+namespace detail{
+
+///One nonzero coefficient of a bilinear operation on SU_vectors.
+///The operation on vectors u and v contributes c*u[a]*v[b] to component k of
+///the result.
+struct bilinear_term{
+  unsigned char a, b, k;
+  double c;
+};
+
+///The nonzero coefficients of iCommutator(u,v) for vectors of the given
+///dimension, ordered by a, then b, then k.
+///The tables are computed once, on first use, by applying iCommutator to all
+///pairs of generators, so they agree exactly with the generated kernels.
+///\param dim the dimension of the vectors; must be in [2,SQUIDS_MAX_HILBERT_DIM]
+const std::vector<bilinear_term>& commutator_terms(unsigned int dim);
+
+///The nonzero coefficients of ACommutator(u,v) for vectors of the given
+///dimension, ordered by a, then b, then k.
+///\param dim the dimension of the vectors; must be in [2,SQUIDS_MAX_HILBERT_DIM]
+const std::vector<bilinear_term>& anticommutator_terms(unsigned int dim);
+
+} //namespace detail
+} //namespace squids
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef SQUIDS_DETAIL_THREADPOOL_H
+#define SQUIDS_DETAIL_THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace squids{
+namespace detail{
+
+///A fixed-size pool of threads for running loops over index ranges.
+///
+///The calling thread always takes part in the work, so a pool of size n
+///starts n-1 additional threads. A range handed to parallel_for is divided
+///into one contiguous share per thread, and each thread claims chunks from
+///the front of its own share. A thread which runs out of work steals chunks
+///from the shares of the other threads, so uneven per-index costs do not
+///leave threads idle.
+class thread_pool{
+public:
+  ///The type of function executed for each chunk.
+  ///The arguments are the beginning and end of the chunk's index range and
+  ///the index (in [0,size()) ) of the thread executing it. A given thread
+  ///index is never used by two threads at the same time, so it may be used to
+  ///select per-thread scratch space.
+  using chunk_function=std::function<void(unsigned int,unsigned int,unsigned int)>;
+
+  ///\param nthreads the total number of threads, including the calling thread
+  ///\param pin whether the worker threads should be bound to successive cores
+  thread_pool(unsigned int nthreads, bool pin);
+  ~thread_pool();
+  thread_pool(const thread_pool&)=delete;
+  thread_pool& operator=(const thread_pool&)=delete;
+
+  ///The number of threads which take part in a parallel_for
+  unsigned int size() const{ return(nthreads); }
+  ///Whether the worker threads are bound to cores
+  bool pinned() const{ return(pin); }
+
+  ///Apply a function to all chunks of an index range.
+  ///Does not return until all chunks have been processed. If the function
+  ///throws, remaining chunks are abandoned and the first exception is
+  ///rethrown in the calling thread.
+  ///\param n the size of the range [0,n)
+  ///\param chunk the number of indices handed out at a time; must be nonzero
+  ///\param f the function to apply
+  void parallel_for(unsigned int n, unsigned int chunk, const chunk_function& f);
+
+private:
+  ///The portion of the current range initially assigned to one thread.
+  ///Padded to the size of a cache line, so that the counters of different
+  ///threads never share a line wherever the array starts; alignas(64) would
+  ///not be honoured by new before C++17.
+  struct share{
+    std::atomic<unsigned int> next;
+    unsigned int end;
+    char padding[64-sizeof(std::atomic<unsigned int>)-sizeof(unsigned int)];
+  };
+
+  unsigned int nthreads;
+  bool pin;
+  std::unique_ptr<share[]> shares;
+  std::vector<std::thread> workers;
+
+  std::mutex mut;
+  std::condition_variable start_cond, done_cond;
+  ///incremented each time a new range is published
+  unsigned long generation;
+  ///number of worker threads still processing the current range
+  unsigned int active;
+  bool stopping;
+
+  const chunk_function* job;
+  unsigned int job_chunk;
+  std::atomic<bool> failed;
+  std::exception_ptr error;
+
+  void worker_main(unsigned int index);
+  void run(unsigned int index);
+  bool claim(unsigned int s, unsigned int& begin, unsigned int& end);
+};
+
+} //namespace detail
+} //namespace squids
+
+#endif
@@ -0,0 +1,233 @@
+#include "SQuIDS/detail/BatchKernels.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <stdexcept>
+
+#include "SQuIDS/SU_inc/dimension.h"
+
+namespace squids{
+namespace detail{
+
+namespace{
+  using std::sqrt;
+
+  //The batched kernels are built from the same generated code as the
+  //SU_vector operations, with each component replaced by one value for each
+  //lane. The arithmetic operators act on each lane separately and perform the
+  //same operations in the same order as the scalar code, so the compiler is
+  //free to vectorize across lanes but the results are unchanged.
+  struct lanes{
+    double v[batch_lanes];
+  };
+
+  inline lanes operator+(const lanes& a, const lanes& b){
+    lanes r;
+    for(unsigned int j=0; j<batch_lanes; j++)
+      r.v[j]=a.v[j]+b.v[j];
+    return(r);
+  }
+
+  inline lanes operator-(const lanes& a, const lanes& b){
+    lanes r;
+    for(unsigned int j=0; j<batch_lanes; j++)
+      r.v[j]=a.v[j]-b.v[j];
+    return(r);
+  }
+
+  inline lanes operator-(const lanes& a){
+    lanes r;
+    for(unsigned int j=0; j<batch_lanes; j++)
+      r.v[j]=-a.v[j];
+    return(r);
+  }
+
+  inline lanes operator*(const lanes& a, const lanes& b){
+    lanes r;
+    for(unsigned int j=0; j<batch_lanes; j++)
+      r.v[j]=a.v[j]*b.v[j];
+    return(r);
+  }
+
+  inline lanes operator*(double a, const lanes& b){
+    lanes r;
+    for(unsigned int j=0; j<batch_lanes; j++)
+      r.v[j]=a*b.v[j];
+    return(r);
+  }
+
+  inline lanes operator*(const lanes& a, double b){
+    lanes r;
+    for(unsigned int j=0; j<batch_lanes; j++)
+      r.v[j]=a.v[j]*b;
+    return(r);
+  }
+
+  inline lanes operator/(const lanes& a, double b){
+    lanes r;
+    for(unsigned int j=0; j<batch_lanes; j++)
+      r.v[j]=a.v[j]/b;
+    return(r);
+  }
+
+  //As for vector_wrapper, the generated code writes each component of the
+  //result with +=, which these wrappers redefine as assignment or decrement.
+  struct assign_lanes{
+    lanes* v;
+    void operator+=(const lanes& x){ *v=x; }
+    void operator+=(double x){
+      for(unsigned int j=0; j<batch_lanes; j++)
+        v->v[j]=x;
+    }
+  };
+
+  struct decrement_lanes{
+    lanes* v;
+    void operator+=(const lanes& x){
+      for(unsigned int j=0; j<batch_lanes; j++)
+        v->v[j]-=x.v[j];
+    }
+    void operator+=(double x){
+      for(unsigned int j=0; j<batch_lanes; j++)
+        v->v[j]-=x;
+    }
+  };
+
+  //a vector in batch layout, with the member names expected by generated code
+  struct batch_vector{
+    unsigned int dim;
+    const lanes* components;
+  };
+
+  template<typename Wrapper>
+  struct batch_target{
+    unsigned int dim;
+    struct component_wrapper{
+      lanes* components;
+      Wrapper operator[](unsigned int i){ return(Wrapper{components+i}); }
+    } components;
+    batch_target(unsigned int dim, double* components):
+    dim(dim),components{reinterpret_cast<lanes*>(components)}{}
+  };
+
+  batch_vector batch(unsigned int dim, const double* components){
+    return(batch_vector{dim,reinterpret_cast<const lanes*>(components)});
+  }
+}
+
+void batch_gather(unsigned int size, const double* const* src, unsigned int count, double* out){
+  const unsigned int nbatches=(count+batch_lanes-1)/batch_lanes;
+  for(unsigned int i=0; i<count; i++){
+    double* o=out+(i/batch_lanes)*size*batch_lanes+i%batch_lanes;
+    const double* s=src[i];
+    for(unsigned int k=0; k<size; k++)
+      o[k*batch_lanes]=s[k];
+  }
+  double* last=out+(nbatches-1)*size*batch_lanes;
+  for(unsigned int j=count-(nbatches-1)*batch_lanes; j<batch_lanes; j++){
+    for(unsigned int k=0; k<size; k++)
+      last[k*batch_lanes+j]=0;
+  }
+}
+
+void batch_scatter(unsigned int size, const double* in, unsigned int count, double* const* dst){
+  for(unsigned int i=0; i<count; i++){
+    const double* b=in+(i/batch_lanes)*size*batch_lanes+i%batch_lanes;
+    double* d=dst[i];
+    for(unsigned int k=0; k<size; k++)
+      d[k]=b[k*batch_lanes];
+  }
+}
+
+void batch_icommutator(unsigned int dim, unsigned int nbatches, const double* u, const double* v, double* out){
+  const unsigned int stride=dim*dim*batch_lanes;
+  for(unsigned int b=0; b<nbatches; b++, u+=stride, v+=stride, out+=stride){
+    batch_vector suv1=batch(dim,u), suv2=batch(dim,v);
+    batch_target<assign_lanes> suv_new(dim,out);
+    suv_new.components[0]+=0;
+#include "SQuIDS/SU_inc/iCommutatorSelect.txt"
+  }
+}
+
+void batch_subtract_acommutator(unsigned int dim, unsigned int nbatches, const double* u, const double* v, double* out){
+  const unsigned int stride=dim*dim*batch_lanes;
+  for(unsigned int b=0; b<nbatches; b++, u+=stride, v+=stride, out+=stride){
+    batch_vector suv1=batch(dim,u), suv2=batch(dim,v);
+    batch_target<decrement_lanes> suv_new(dim,out);
+#include "SQuIDS/SU_inc/AnticommutatorSelect.txt"
+  }
+}
+
+void batch_evolve(unsigned int dim, unsigned int nbatches, const double* buffers, const double* v, double* out){
+  const unsigned int stride=dim*dim*batch_lanes;
+  const size_t offset=dim*(dim-1)/2;
+  for(unsigned int b=0; b<nbatches; b++, buffers+=2*offset*batch_lanes, v+=stride, out+=stride){
+    batch_vector suv2=batch(dim,v);
+    batch_target<assign_lanes> suv3(dim,out);
+    const lanes* CX=reinterpret_cast<const lanes*>(buffers);
+    const lanes* SX=CX+offset;
+#include "SQuIDS/SU_inc/FastEvolutionSelect.txt"
+  }
+}
+
+void kernel_product(unsigned int nrows, unsigned int width, const double* kernel, size_t kernel_stride,
+                    const unsigned int* bounds, const double* in, size_t in_stride,
+                    double* out, size_t out_stride){
+  //The columns are divided into blocks whose input vectors stay in the L1
+  //cache while all rows are processed, and the rows into groups which share
+  //each load of an input vector. Each row is summed over a block in its own
+  //accumulator before being added to the output, so the result of a row does
+  //not depend on the group it belongs to.
+  const unsigned int column_block=256, group=4;
+  double acc[group*SQUIDS_MAX_HILBERT_SIZE];
+  unsigned int ncols=0;
+  for(unsigned int r=0; r<nrows; r++)
+    ncols=std::max(ncols,bounds[2*r+1]);
+  for(unsigned int c=0; c<ncols; c+=column_block){
+    const unsigned int c_end=std::min(ncols,c+column_block);
+    for(unsigned int r0=0; r0<nrows; r0+=group){
+      const unsigned int nr=std::min(group,nrows-r0);
+      //the columns which are nonzero for any row of the group
+      unsigned int j_begin=c_end, j_end=c;
+      for(unsigned int r=r0; r<r0+nr; r++){
+        j_begin=std::min(j_begin,std::max(c,bounds[2*r]));
+        j_end=std::max(j_end,std::min(c_end,bounds[2*r+1]));
+      }
+      if(j_begin>=j_end)
+        continue;
+      std::fill(acc,acc+nr*width,0.);
+      const double* k_rows=kernel+r0*kernel_stride;
+      if(nr==group){
+        for(unsigned int j=j_begin; j<j_end; j++){
+          const double* x=in+j*in_stride;
+          const double k0=k_rows[j], k1=k_rows[kernel_stride+j];
+          const double k2=k_rows[2*kernel_stride+j], k3=k_rows[3*kernel_stride+j];
+          for(unsigned int k=0; k<width; k++){
+            acc[k]+=k0*x[k];
+            acc[width+k]+=k1*x[k];
+            acc[2*width+k]+=k2*x[k];
+            acc[3*width+k]+=k3*x[k];
+          }
+        }
+      }else{
+        for(unsigned int j=j_begin; j<j_end; j++){
+          const double* x=in+j*in_stride;
+          for(unsigned int r=0; r<nr; r++){
+            const double kv=k_rows[r*kernel_stride+j];
+            for(unsigned int k=0; k<width; k++)
+              acc[r*width+k]+=kv*x[k];
+          }
+        }
+      }
+      for(unsigned int r=0; r<nr; r++){
+        double* o=out+(r0+r)*out_stride;
+        for(unsigned int k=0; k<width; k++)
+          o[k]+=acc[r*width+k];
+      }
+    }
+  }
+}
+
+} //namespace detail
+} //namespace squids
@@ -0,0 +1,59 @@
+#include "SQuIDS/detail/GridIndex.h"
+
+#include <algorithm>
+
+namespace squids{
+namespace detail{
+
+grid_index::grid_index():type(spacing::arbitrary),origin(0),inverse_step(0){}
+
+void grid_index::clear(){
+  type=spacing::arbitrary;
+  origin=0;
+  inverse_step=0;
+  buckets.clear();
+}
+
+void grid_index::build(const std::vector<double>& nodes, spacing kind){
+  clear();
+  const size_t n=nodes.size();
+  if(n<2 || !(nodes.back()>nodes.front()))
+    kind=spacing::arbitrary;
+  if(kind==spacing::logarithmic && !(nodes.front()>0))
+    kind=spacing::arbitrary;
+  if(kind!=spacing::arbitrary){
+    const bool logarithmic=(kind==spacing::logarithmic);
+    origin=(logarithmic ? std::log(nodes.front()) : nodes.front());
+    const double end=(logarithmic ? std::log(nodes.back()) : nodes.back());
+    inverse_step=(n-1)/(end-origin);
+    //the lookup corrects estimates which are off by a few nodes, but nodes
+    //which do not follow the spacing at all would make it slow
+    for(size_t i=0; i<n; i++){
+      const double position=((logarithmic ? std::log(nodes[i]) : nodes[i])-origin)*inverse_step;
+      if(std::abs(position-i)>0.5){
+        kind=spacing::arbitrary;
+        break;
+      }
+    }
+    if(kind!=spacing::arbitrary){
+      type=kind;
+      return;
+    }
+  }
+  if(n==0)
+    return;
+  origin=nodes.front();
+  inverse_step=(n>1 && nodes.back()>nodes.front() ? n/(nodes.back()-nodes.front()) : 0);
+  buckets.resize(n+1);
+  size_t node=0;
+  for(size_t b=0; b<n; b++){
+    const double start=origin+b/inverse_step;
+    while(node<n && nodes[node]<start)
+      node++;
+    buckets[b]=node;
+  }
+  buckets[n]=n;
+}
+
+} //namespace detail
+} //namespace squids
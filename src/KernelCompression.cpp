@@ -0,0 +1,250 @@
+#include "SQuIDS/detail/KernelCompression.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "SQuIDS/SU_inc/dimension.h"
+#include "SQuIDS/detail/BatchKernels.h"
+
+namespace squids{
+namespace detail{
+
+namespace{
+  //diagonal blocks of at most this size are stored densely
+  const unsigned int leaf_size=64;
+  //the largest rank tried for an off diagonal block
+  const unsigned int max_rank=32;
+}
+
+compressed_kernel::compressed_kernel():n(0),total_rank(0){}
+
+void compressed_kernel::clear(){
+  n=0;
+  blocks.clear();
+  values.clear();
+  bounds.clear();
+  total_rank=0;
+}
+
+void compressed_kernel::compress(unsigned int n, const double* entries, double tolerance){
+  clear();
+  this->n=n;
+  double norm=0;
+  for(size_t i=0; i<static_cast<size_t>(n)*n; i++)
+    norm+=entries[i]*entries[i];
+  //the error is shared out in proportion to the size of the blocks, so that
+  //the total error is within the tolerance
+  if(n>0)
+    build(entries,0,n,tolerance*tolerance*norm/(static_cast<double>(n)*n));
+}
+
+void compressed_kernel::build(const double* entries, unsigned int begin, unsigned int end, double budget){
+  if(end-begin<=leaf_size){
+    add_dense(entries,begin,end,begin,end);
+    return;
+  }
+  const unsigned int middle=begin+(end-begin)/2;
+  add_block(entries,begin,middle,middle,end,budget);
+  add_block(entries,middle,end,begin,middle,budget);
+  build(entries,begin,middle,budget);
+  build(entries,middle,end,budget);
+}
+
+void compressed_kernel::add_block(const double* entries, unsigned int row_begin, unsigned int row_end,
+                                  unsigned int col_begin, unsigned int col_end, double budget){
+  const unsigned int rows=row_end-row_begin, cols=col_end-col_begin;
+  const double allowed=budget*rows*cols;
+  auto entry=[&](unsigned int i, unsigned int j){
+    return(entries[static_cast<size_t>(row_begin+i)*n+col_begin+j]);
+  };
+  double norm=0;
+  for(unsigned int i=0; i<rows; i++){
+    for(unsigned int j=0; j<cols; j++)
+      norm+=entry(i,j)*entry(i,j);
+  }
+  if(norm<=allowed)
+    return;
+
+  //Adaptive cross approximation with partial pivoting: each step removes the
+  //cross through the largest entry of a row of the residual. The factors are
+  //only worth storing if they are much smaller than the block.
+  const unsigned int rank_limit=std::min<size_t>(max_rank,static_cast<size_t>(rows)*cols/(4*(rows+cols)));
+  std::vector<double> U, V; //factor l is U[l*rows...] and V[l*cols...]
+  std::vector<double> row(cols), col(rows,0.);
+  std::vector<bool> used(rows,false);
+  unsigned int rank=0, pivot=0;
+  bool accepted=false;
+  while(rank<rank_limit){
+    for(unsigned int j=0; j<cols; j++)
+      row[j]=entry(pivot,j);
+    for(unsigned int l=0; l<rank; l++){
+      const double u=U[l*rows+pivot];
+      for(unsigned int j=0; j<cols; j++)
+        row[j]-=u*V[l*cols+j];
+    }
+    used[pivot]=true;
+    unsigned int q=0;
+    for(unsigned int j=1; j<cols; j++){
+      if(std::abs(row[j])>std::abs(row[q]))
+        q=j;
+    }
+    bool check=false;
+    if(row[q]!=0){
+      for(unsigned int i=0; i<rows; i++)
+        col[i]=entry(i,q);
+      for(unsigned int l=0; l<rank; l++){
+        const double v=V[l*cols+q];
+        for(unsigned int i=0; i<rows; i++)
+          col[i]-=v*U[l*rows+i];
+      }
+      const double scale=1./row[q];
+      double u_norm=0, v_norm=0;
+      for(unsigned int i=0; i<rows; i++)
+        u_norm+=col[i]*col[i];
+      for(unsigned int j=0; j<cols; j++){
+        row[j]*=scale;
+        v_norm+=row[j]*row[j];
+      }
+      U.insert(U.end(),col.begin(),col.end());
+      V.insert(V.end(),row.begin(),row.end());
+      rank++;
+      //the size of the last cross estimates the size of the residual
+      check=(u_norm*v_norm<=allowed/4);
+    }
+    //the next pivot is the unused row in which the last column was largest
+    bool remaining=false;
+    for(unsigned int i=0; i<rows; i++){
+      if(!used[i] && (!remaining || std::abs(col[i])>std::abs(col[pivot]))){
+        pivot=i;
+        remaining=true;
+      }
+    }
+    if(check || !remaining){
+      //the estimate can be too optimistic, so the residual is checked exactly
+      double error=0;
+      for(unsigned int i=0; i<rows && error<=allowed; i++){
+        for(unsigned int j=0; j<cols; j++){
+          double r=entry(i,j);
+          for(unsigned int l=0; l<rank; l++)
+            r-=U[l*rows+i]*V[l*cols+j];
+          error+=r*r;
+        }
+      }
+      if(error<=allowed){
+        accepted=true;
+        break;
+      }
+    }
+    if(!remaining)
+      break;
+  }
+  if(!accepted){
+    add_dense(entries,row_begin,row_end,col_begin,col_end);
+    return;
+  }
+
+  block b{row_begin,row_end,col_begin,col_end,rank,values.size(),total_rank};
+  values.resize(values.size()+static_cast<size_t>(rows+cols)*rank);
+  double* u=&values[b.offset];
+  double* v=u+static_cast<size_t>(rows)*rank;
+  for(unsigned int l=0; l<rank; l++){
+    for(unsigned int i=0; i<rows; i++)
+      u[i*rank+l]=U[l*rows+i];
+    for(unsigned int j=0; j<cols; j++)
+      v[j*rank+l]=V[l*cols+j];
+  }
+  blocks.push_back(b);
+  total_rank+=rank;
+}
+
+void compressed_kernel::add_dense(const double* entries, unsigned int row_begin, unsigned int row_end,
+                                  unsigned int col_begin, unsigned int col_end){
+  const unsigned int cols=col_end-col_begin;
+  block b{row_begin,row_end,col_begin,col_end,0,values.size(),bounds.size()};
+  for(unsigned int i=row_begin; i<row_end; i++){
+    const double* r=entries+static_cast<size_t>(i)*n+col_begin;
+    values.insert(values.end(),r,r+cols);
+    unsigned int first=cols, last=0;
+    for(unsigned int j=0; j<cols; j++){
+      if(r[j]!=0){
+        first=std::min(first,j);
+        last=j+1;
+      }
+    }
+    bounds.push_back(std::min(first,last));
+    bounds.push_back(last);
+  }
+  blocks.push_back(b);
+}
+
+void compressed_kernel::project(unsigned int width, const double* in, size_t in_stride, double* projections) const{
+  for(const block& b : blocks){
+    if(b.rank==0)
+      continue;
+    double* p=projections+b.index*width;
+    std::fill(p,p+b.rank*width,0.);
+    const double* v=&values[b.offset+static_cast<size_t>(b.row_end-b.row_begin)*b.rank];
+    for(unsigned int j=b.col_begin; j<b.col_end; j++, v+=b.rank){
+      const double* x=in+j*in_stride;
+      for(unsigned int l=0; l<b.rank; l++){
+        const double vl=v[l];
+        for(unsigned int k=0; k<width; k++)
+          p[l*width+k]+=vl*x[k];
+      }
+    }
+  }
+}
+
+void compressed_kernel::apply(unsigned int row_begin, unsigned int row_end, unsigned int width,
+                              const double* in, size_t in_stride, const double* projections,
+                              double* out, size_t out_stride) const{
+  double acc[SQUIDS_MAX_HILBERT_SIZE];
+  for(const block& b : blocks){
+    const unsigned int first=std::max(row_begin,b.row_begin), last=std::min(row_end,b.row_end);
+    if(first>=last)
+      continue;
+    if(b.rank==0){
+      const unsigned int cols=b.col_end-b.col_begin;
+      kernel_product(last-first,width,&values[b.offset+static_cast<size_t>(first-b.row_begin)*cols],cols,
+                     &bounds[b.index+2*(first-b.row_begin)],in+b.col_begin*in_stride,in_stride,
+                     out+(first-row_begin)*out_stride,out_stride);
+      continue;
+    }
+    const double* p=projections+b.index*width;
+    for(unsigned int i=first; i<last; i++){
+      const double* u=&values[b.offset+static_cast<size_t>(i-b.row_begin)*b.rank];
+      std::fill(acc,acc+width,0.);
+      for(unsigned int l=0; l<b.rank; l++){
+        for(unsigned int k=0; k<width; k++)
+          acc[k]+=u[l]*p[l*width+k];
+      }
+      double* o=out+(i-row_begin)*out_stride;
+      for(unsigned int k=0; k<width; k++)
+        o[k]+=acc[k];
+    }
+  }
+}
+
+void compressed_kernel::expand(double* out) const{
+  std::fill(out,out+static_cast<size_t>(n)*n,0.);
+  for(const block& b : blocks){
+    const unsigned int cols=b.col_end-b.col_begin;
+    const double* v=&values[b.offset+static_cast<size_t>(b.row_end-b.row_begin)*b.rank];
+    for(unsigned int i=b.row_begin; i<b.row_end; i++){
+      double* o=out+static_cast<size_t>(i)*n+b.col_begin;
+      if(b.rank==0){
+        const double* r=&values[b.offset+static_cast<size_t>(i-b.row_begin)*cols];
+        std::copy(r,r+cols,o);
+        continue;
+      }
+      const double* u=&values[b.offset+static_cast<size_t>(i-b.row_begin)*b.rank];
+      for(unsigned int j=0; j<cols; j++){
+        for(unsigned int l=0; l<b.rank; l++)
+          o[j]+=u[l]*v[j*b.rank+l];
+      }
+    }
+  }
+}
+
+} //namespace detail
+} //namespace squids
@@ -1,6 +1,7 @@
 #include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <complex>
 #include <iostream>
 #include <vector>
 
@@ -13,6 +14,7 @@
 
 #include "SQuIDS/detail/MatrixExp.h"
 #include "SQuIDS/detail/ProxyFwd.h"
+#include "SQuIDS/SU_inc/dimension.h"
 
 namespace squids{
 
@@ -937,5 +939,69 @@ void matrix_exponential(gsl_matrix_complex* eA, const gsl_matrix_complex *A){
   return;
 }
 
+void unitary_exponential(gsl_matrix_complex* eA, const gsl_matrix_complex* H, double scale){
+  typedef std::complex<double> cd;
+  const unsigned int n=H->size1;
+  assert(n==H->size2 and n<=SQUIDS_MAX_HILBERT_DIM);
+  assert(eA->size1==n and eA->size2==n);
+  //small enough to live on the stack, so no allocation is needed
+  cd A[SQUIDS_MAX_HILBERT_DIM*SQUIDS_MAX_HILBERT_DIM];
+  cd P[SQUIDS_MAX_HILBERT_DIM*SQUIDS_MAX_HILBERT_DIM];
+  cd T[SQUIDS_MAX_HILBERT_DIM*SQUIDS_MAX_HILBERT_DIM];
+  
+  //A = i*scale*H, and the infinity norm of A
+  double norm=0;
+  for(unsigned int i=0; i<n; i++){
+    double row=0;
+    for(unsigned int j=0; j<n; j++){
+      gsl_complex h=gsl_matrix_complex_get(H,i,j);
+      A[i*n+j]=cd(-scale*GSL_IMAG(h),scale*GSL_REAL(h));
+      row+=std::abs(A[i*n+j]);
+    }
+    norm=std::max(norm,row);
+  }
+  //scale A so that the truncation error of the series is below rounding error
+  int squarings=0;
+  if(norm>0.25)
+    squarings=(int)std::ceil(std::log2(norm/0.25));
+  const double shrink=std::ldexp(1.,-squarings);
+  for(unsigned int i=0; i<n*n; i++)
+    A[i]*=shrink;
+  
+  auto multiply=[n](const cd* X, const cd* Y, cd* Z){
+    for(unsigned int i=0; i<n; i++){
+      for(unsigned int j=0; j<n; j++){
+        cd sum=0;
+        for(unsigned int k=0; k<n; k++)
+          sum+=X[i*n+k]*Y[k*n+j];
+        Z[i*n+j]=sum;
+      }
+    }
+  };
+  
+  //Horner evaluation of the degree 12 Taylor polynomial, P = 1 + A/1(1 + A/2(1 + ...))
+  const unsigned int degree=12;
+  for(unsigned int i=0; i<n*n; i++)
+    P[i]=0;
+  for(unsigned int i=0; i<n; i++)
+    P[i*n+i]=1;
+  for(unsigned int k=degree; k>0; k--){
+    multiply(A,P,T);
+    for(unsigned int i=0; i<n*n; i++)
+      P[i]=T[i]/(double)k;
+    for(unsigned int i=0; i<n; i++)
+      P[i*n+i]+=1.;
+  }
+  for(int s=0; s<squarings; s++){
+    multiply(P,P,T);
+    std::copy(T,T+n*n,P);
+  }
+  
+  for(unsigned int i=0; i<n; i++){
+    for(unsigned int j=0; j<n; j++)
+      gsl_matrix_complex_set(eA,i,j,gsl_complex_rect(P[i*n+j].real(),P[i*n+j].imag()));
+  }
+}
+
 } // close math_detail namespace
 } // close squids namespace
@@ -0,0 +1,251 @@
+
+ /******************************************************************************
+ *    This program is free software: you can redistribute it and/or modify     *
+ *   it under the terms of the GNU General Public License as published by      *
+ *   the Free Software Foundation, either version 3 of the License, or         *
+ *   (at your option) any later version.                                       *
+ *                                                                             *
+ *   This program is distributed in the hope that it will be useful,           *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the             *
+ *   GNU General Public License for more details.                              *
+ *                                                                             *
+ *   You should have received a copy of the GNU General Public License         *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.     *
+ *                                                                             *
+ *   Authors:                                                                  *
+ *      Carlos Arguelles (University of Wisconsin Madison)                     *
+ *         carguelles@icecube.wisc.edu                                         *
+ *      Christopher Weaver (University of Wisconsin Madison)                   *
+ *         chris.weaver@icecube.wisc.edu                                       *
+ *      Jordi Salvado (University of Wisconsin Madison)                        *
+ *         jsalvado@icecube.wisc.edu                                           *
+ ******************************************************************************/
+
+#include <SQuIDS/ObservableRecorder.h>
+
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+
+namespace squids{
+
+ObservableRecorder::ObservableRecorder(const std::string& path, const std::string& csv_path, unsigned int capacity):
+path(path),
+csv_path(csv_path),
+nx(0),
+slots(capacity>0?capacity:1),
+head(0),
+tail(0),
+block_size(capacity>0?capacity:1),
+writer_waiting(false),
+closing(false),
+failed(false)
+{
+  //open the files now so that bad paths are reported immediately
+  file.open(path,std::ios::binary|std::ios::trunc);
+  if(!file)
+    throw std::runtime_error("ObservableRecorder : Unable to open "+path);
+  if(!csv_path.empty()){
+    csv.open(csv_path,std::ios::trunc);
+    if(!csv)
+      throw std::runtime_error("ObservableRecorder : Unable to open "+csv_path);
+    csv.precision(17);
+  }
+}
+
+ObservableRecorder::~ObservableRecorder(){
+  try{
+    Close();
+  }catch(...){}
+}
+
+void ObservableRecorder::AddObservable(const std::string& name, const SU_vector& op, unsigned int irho){
+  if(writer.joinable() || closing)
+    throw std::runtime_error("ObservableRecorder::AddObservable : Observables must be added before the first sample");
+  observables.push_back(observable{name,op,irho});
+}
+
+void ObservableRecorder::Record(const SQuIDS& system){
+  if(!writer.joinable()){
+    std::vector<double> xs(system.Get_nx());
+    for(unsigned int ix=0; ix<xs.size(); ix++)
+      xs[ix]=system.Get_x(ix);
+    start(xs);
+  }
+  std::vector<double>& slot=acquire_slot();
+  slot[0]=system.Get_t();
+  double* values=&slot[1];
+  for(const observable& obs : observables){
+    for(unsigned int ix=0; ix<nx; ix++)
+      *values++=system.GetExpectationValue(obs.op,obs.irho,ix);
+  }
+  publish_slot();
+}
+
+void ObservableRecorder::operator()(const SQuIDS::stateView& view){
+  if(!writer.joinable()){
+    std::vector<double> xs(view.Get_nx());
+    for(unsigned int ix=0; ix<xs.size(); ix++)
+      xs[ix]=view.Get_x(ix);
+    start(xs);
+  }
+  std::vector<double>& slot=acquire_slot();
+  slot[0]=view.Get_t();
+  double* values=&slot[1];
+  for(const observable& obs : observables){
+    for(unsigned int ix=0; ix<nx; ix++)
+      *values++=view.GetExpectationValue(obs.op,obs.irho,ix);
+  }
+  publish_slot();
+}
+
+void ObservableRecorder::start(const std::vector<double>& xs){
+  if(closing)
+    throw std::runtime_error("ObservableRecorder : The recorder has been closed");
+  nx=xs.size();
+  x=xs;
+  const size_t sample_size=1+observables.size()*nx;
+  for(auto& slot : slots)
+    slot.resize(sample_size);
+  block.reserve(sample_size*block_size);
+  writer=std::thread(&ObservableRecorder::write_loop,this);
+}
+
+std::vector<double>& ObservableRecorder::acquire_slot(){
+  const unsigned long h=head.load(std::memory_order_relaxed);
+  //if the writer has fallen behind, wait for it to free a slot
+  while(h-tail.load(std::memory_order_acquire)==slots.size()){
+    if(failed)
+      break;
+    std::this_thread::yield();
+  }
+  if(failed){
+    std::lock_guard<std::mutex> lock(mut);
+    throw std::runtime_error(error);
+  }
+  return(slots[h%slots.size()]);
+}
+
+void ObservableRecorder::publish_slot(){
+  head.store(head.load(std::memory_order_relaxed)+1,std::memory_order_release);
+  if(writer_waiting.load()){
+    std::lock_guard<std::mutex> lock(mut);
+    wake.notify_one();
+  }
+}
+
+void ObservableRecorder::Close(){
+  if(closing)
+    return;
+  closing=true;
+  if(writer.joinable()){
+    {
+      std::lock_guard<std::mutex> lock(mut);
+      wake.notify_one();
+    }
+    writer.join();
+  }else
+    write_header();
+  file.close();
+  if(csv.is_open())
+    csv.close();
+  if(failed)
+    throw std::runtime_error(error);
+}
+
+void ObservableRecorder::write_loop(){
+  try{
+    write_header();
+    while(true){
+      const unsigned long t=tail.load(std::memory_order_relaxed);
+      if(t==head.load(std::memory_order_acquire)){
+        //closing is set after the last sample is published, so once it is
+        //seen an empty ring stays empty
+        if(closing){
+          if(t==head.load(std::memory_order_acquire))
+            break;
+          continue;
+        }
+        std::unique_lock<std::mutex> lock(mut);
+        writer_waiting=true;
+        //the timeout covers a sample published just before the flag was set
+        wake.wait_for(lock,std::chrono::milliseconds(1),[&]{
+          return(closing || t!=head.load(std::memory_order_acquire));
+        });
+        writer_waiting=false;
+        continue;
+      }
+      write_sample(slots[t%slots.size()]);
+      tail.store(t+1,std::memory_order_release);
+    }
+    if(!block.empty())
+      write_block();
+    file.flush();
+    if(!file || (csv.is_open() && !csv.flush()))
+      throw std::runtime_error("ObservableRecorder : Error writing "+path);
+  }catch(std::exception& ex){
+    std::lock_guard<std::mutex> lock(mut);
+    error=ex.what();
+    failed=true;
+  }
+}
+
+void ObservableRecorder::write_header(){
+  const char magic[8]={'S','Q','u','I','D','S','o','b'};
+  const uint32_t version=1, byte_order=0x01020304;
+  const uint32_t nodes=nx, count=observables.size();
+  file.write(magic,sizeof(magic));
+  file.write(reinterpret_cast<const char*>(&version),sizeof(version));
+  file.write(reinterpret_cast<const char*>(&byte_order),sizeof(byte_order));
+  file.write(reinterpret_cast<const char*>(&nodes),sizeof(nodes));
+  file.write(reinterpret_cast<const char*>(&count),sizeof(count));
+  for(const observable& obs : observables){
+    const uint32_t length=obs.name.size(), irho=obs.irho;
+    file.write(reinterpret_cast<const char*>(&length),sizeof(length));
+    file.write(obs.name.data(),length);
+    file.write(reinterpret_cast<const char*>(&irho),sizeof(irho));
+  }
+  file.write(reinterpret_cast<const char*>(x.data()),x.size()*sizeof(double));
+  if(csv.is_open()){
+    csv << "t";
+    for(const observable& obs : observables){
+      for(unsigned int ix=0; ix<nx; ix++)
+        csv << ',' << obs.name << '_' << ix;
+    }
+    csv << '\n';
+  }
+  if(!file)
+    throw std::runtime_error("ObservableRecorder : Error writing "+path);
+}
+
+void ObservableRecorder::write_sample(const std::vector<double>& sample){
+  block.insert(block.end(),sample.begin(),sample.end());
+  if(csv.is_open()){
+    csv << sample[0];
+    for(size_t i=1; i<sample.size(); i++)
+      csv << ',' << sample[i];
+    csv << '\n';
+  }
+  if(block.size()==block_size*sample.size())
+    write_block();
+}
+
+void ObservableRecorder::write_block(){
+  //the samples are stored one after the other, and are transposed so that
+  //each column is written contiguously
+  const size_t sample_size=1+observables.size()*nx;
+  const uint32_t count=block.size()/sample_size;
+  std::vector<double> column(count);
+  file.write(reinterpret_cast<const char*>(&count),sizeof(count));
+  for(size_t c=0; c<sample_size; c++){
+    for(uint32_t i=0; i<count; i++)
+      column[i]=block[i*sample_size+c];
+    file.write(reinterpret_cast<const char*>(column.data()),count*sizeof(double));
+  }
+  block.clear();
+  if(!file)
+    throw std::runtime_error("ObservableRecorder : Error writing "+path);
+}
+
+} //namespace squids
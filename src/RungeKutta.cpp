@@ -0,0 +1,264 @@
+#include "SQuIDS/detail/RungeKutta.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if defined(__GNUC__) || defined(__clang__) || defined(_MSC_VER)
+  #define SQUIDS_RESTRICT __restrict
+#else
+  #define SQUIDS_RESTRICT
+#endif
+
+namespace squids{
+namespace detail{
+
+const double dormand_prince_54::c[stages]={0., 1./5, 3./10, 4./5, 8./9, 1., 1.};
+const double dormand_prince_54::a[stages][stages]={
+  {},
+  {1./5},
+  {3./40, 9./40},
+  {44./45, -56./15, 32./9},
+  {19372./6561, -25360./2187, 64448./6561, -212./729},
+  {9017./3168, -355./33, 46732./5247, 49./176, -5103./18656},
+  {35./384, 0., 500./1113, 125./192, -2187./6784, 11./84}
+};
+const double dormand_prince_54::b[stages]={35./384, 0., 500./1113, 125./192, -2187./6784, 11./84, 0.};
+const double dormand_prince_54::e[stages]={
+  35./384-5179./57600, 0., 500./1113-7571./16695, 125./192-393./640,
+  -2187./6784+92097./339200, 11./84-187./2100, -1./40
+};
+//the continuous extension of Hairer, Norsett & Wanner's DOPRI5 code, which is
+//fourth order and matches the derivative at both ends of the step
+const double dormand_prince_54::dense[stages][dense_degree]={
+  {1., -8048581381./2820520608, 8663915743./2820520608, -12715105075./11282082432},
+  {0., 0., 0., 0.},
+  {0., 131558114200./32700410799, -68118460800./10900136933, 87487479700./32700410799},
+  {0., -1754552775./470086768, 14199869525./1410260304, -10690763975./1880347072},
+  {0., 127303824393./49829197408, -318862633887./49829197408, 701980252875./199316789632},
+  {0., -282668133./205662961, 2019193451./616988883, -1453857185./822651844},
+  {0., 40617522./29380423, -110615467./29380423, 69997945./29380423}
+};
+
+const double tsitouras_54::c[stages]={0., 0.161, 0.327, 0.9, 0.9800255409045097, 1., 1.};
+const double tsitouras_54::a[stages][stages]={
+  {},
+  {0.161},
+  {-0.008480655492356989, 0.335480655492357},
+  {2.897153057105493, -6.359448489975075, 4.3622954328695815},
+  {5.325864828439257, -11.748883564062828, 7.4955393428898365, -0.09249506636175525},
+  {5.86145544294642, -12.92096931784711, 8.159367898576159, -0.071584973281401, -0.028269050394068383},
+  {0.09646076681806523, 0.01, 0.4798896504144996, 1.379008574103742, -3.290069515436081, 2.324710524099774}
+};
+const double tsitouras_54::b[stages]={
+  0.09646076681806523, 0.01, 0.4798896504144996, 1.379008574103742,
+  -3.290069515436081, 2.324710524099774, 0.
+};
+const double tsitouras_54::e[stages]={
+  -0.00178001105222577714, -0.0008164344596567469, 0.007880878010261995,
+  -0.1447110071732629, 0.5823571654525552, -0.45808210592918697, 1./66
+};
+//the fourth order interpolant given in the same paper, expanded in powers of theta
+const double tsitouras_54::dense[stages][dense_degree]={
+  {1., -2.763706197274826, 2.9132554618219126, -1.0530884977290216},
+  {0., 0.1317, -0.2234, 0.1017},
+  {0., 3.930296236894751, -5.941033872131505, 2.490627285651253},
+  {0., -12.411077166933676, 30.338188630282318, -16.548102889244902},
+  {0., 37.50931341651104, -88.1789048947664, 47.37952196281928},
+  {0., -27.896526289197286, 65.09189467479368, -34.87065786149661},
+  {0., 1.5, -4., 2.5}
+};
+
+const double verner_65::c[stages]={0., 1./6, 4./15, 2./3, 5./6, 1., 1./15, 1.};
+const double verner_65::a[stages][stages]={
+  {},
+  {1./6},
+  {4./75, 16./75},
+  {5./6, -8./3, 5./2},
+  {-165./64, 55./6, -425./64, 85./96},
+  {12./5, -8., 4015./612, -11./36, 88./255},
+  {-8263./15000, 124./75, -643./680, -81./250, 2484./10625, 0.},
+  {3501./1720, -300./43, 297275./52632, -319./2322, 24068./84065, 0., 3850./26703}
+};
+const double verner_65::b[stages]={3./40, 0., 875./2244, 23./72, 264./1955, 0., 125./11592, 43./616};
+const double verner_65::e[stages]={
+  3./40-13./160, 0., 875./2244-2375./5984, 23./72-5./16,
+  264./1955-12./85, -3./44, 125./11592, 43./616
+};
+
+void rk_workspace::resize(size_t n, unsigned int stages){
+  if(k.size()==stages && y_new.size()==n)
+    return;
+  k_data.assign(stages*n,0);
+  k.resize(stages);
+  for(unsigned int i=0; i<stages; i++)
+    k[i]=&k_data[i*n];
+  y_stage.assign(n,0);
+  y_new.assign(n,0);
+}
+
+step_controller::step_controller(unsigned int error_order):
+exponent(1./(error_order+1)),
+alpha(exponent-0.75*0.04),
+beta(0.04),
+err_prev(1e-4),
+rejected(false){}
+
+bool step_controller::judge(double err, double& factor){
+  const double safety=0.9, min_factor=0.2, max_factor=10.;
+  //this also rejects steps whose error is not a number
+  if(!(err<=1.)){
+    factor=(err==err ? std::max(safety*std::pow(err,-exponent),min_factor) : min_factor);
+    rejected=true;
+    return(false);
+  }
+  err=std::max(err,1e-10);
+  factor=safety*std::pow(err,-alpha)*std::pow(err_prev,beta);
+  factor=std::min(std::max(factor,min_factor),max_factor);
+  //do not grow the step immediately after a rejection
+  if(rejected)
+    factor=std::min(factor,1.);
+  err_prev=err;
+  rejected=false;
+  return(true);
+}
+
+namespace{
+  //The number of components processed together. Together with a handful of
+  //stages a block of this size fits comfortably into the L1 cache.
+  const size_t block_size=256;
+}
+
+void rk_combine(size_t n, const double* y, double h, const double* coeffs,
+                const double* const* k, unsigned int count, double* out){
+  for(size_t start=0; start<n; start+=block_size){
+    const size_t len=std::min(block_size,n-start);
+    double* SQUIDS_RESTRICT o=out+start;
+    const double* SQUIDS_RESTRICT yb=y+start;
+    for(size_t i=0; i<len; i++)
+      o[i]=yb[i];
+    for(unsigned int j=0; j<count; j++){
+      const double hc=h*coeffs[j];
+      if(hc==0)
+        continue;
+      const double* SQUIDS_RESTRICT kb=k[j]+start;
+      for(size_t i=0; i<len; i++)
+        o[i]+=hc*kb[i];
+    }
+  }
+}
+
+double rk_error_norm(size_t n, const double* y, const double* y_new, double h,
+                     const double* e, const double* const* k, unsigned int count,
+                     double abs_error, double rel_error){
+  double ratio[block_size];
+  //independent partial results allow the final reduction to be pipelined
+  double m0=0, m1=0, m2=0, m3=0;
+  bool invalid=false;
+  for(size_t start=0; start<n; start+=block_size){
+    const size_t len=std::min(block_size,n-start);
+    double* SQUIDS_RESTRICT r=ratio;
+    for(size_t i=0; i<len; i++)
+      r[i]=0;
+    for(unsigned int j=0; j<count; j++){
+      const double he=h*e[j];
+      if(he==0)
+        continue;
+      const double* SQUIDS_RESTRICT kb=k[j]+start;
+      for(size_t i=0; i<len; i++)
+        r[i]+=he*kb[i];
+    }
+    const double* SQUIDS_RESTRICT yb=y+start;
+    const double* SQUIDS_RESTRICT ynb=y_new+start;
+    for(size_t i=0; i<len; i++)
+      r[i]=std::abs(r[i])/(abs_error+rel_error*std::max(std::abs(yb[i]),std::abs(ynb[i])));
+    size_t i=0;
+    for(; i+4<=len; i+=4){
+      m0=std::max(m0,r[i]);
+      m1=std::max(m1,r[i+1]);
+      m2=std::max(m2,r[i+2]);
+      m3=std::max(m3,r[i+3]);
+    }
+    for(; i<len; i++)
+      m0=std::max(m0,r[i]);
+    //std::max discards NaNs, so check for them separately
+    double sum=0;
+    for(i=0; i<len; i++)
+      sum+=r[i];
+    invalid|=(sum!=sum);
+  }
+  if(invalid)
+    return(std::numeric_limits<double>::quiet_NaN());
+  return(std::max(std::max(m0,m1),std::max(m2,m3)));
+}
+
+bool dense_interpolant::contains(double t) const{
+  if(empty())
+    return(false);
+  //allow for rounding in the time at the end of the step
+  const double slack=1e-12*(std::abs(t0)+std::abs(h));
+  const double t1=t0+h;
+  return(t>=std::min(t0,t1)-slack && t<=std::max(t0,t1)+slack);
+}
+
+void dense_interpolant::evaluate(double t, size_t offset, size_t n, double* out) const{
+  const size_t size=y0.size();
+  const double theta=(h!=0 ? (t-t0)/h : 0);
+  //Horner's scheme, starting from the highest power
+  const double* SQUIDS_RESTRICT qd=&q[(degree-1)*size+offset];
+  double* SQUIDS_RESTRICT o=out;
+  for(size_t i=0; i<n; i++)
+    o[i]=qd[i];
+  for(unsigned int p=degree-1; p>0; p--){
+    const double* SQUIDS_RESTRICT qp=&q[(p-1)*size+offset];
+    for(size_t i=0; i<n; i++)
+      o[i]=o[i]*theta+qp[i];
+  }
+  const double* SQUIDS_RESTRICT yb=&y0[offset];
+  for(size_t i=0; i<n; i++)
+    o[i]=o[i]*theta+yb[i];
+}
+
+void rk_dense_output(dense_interpolant& d, double t0, double h, size_t n, const double* y0,
+                     const double* coefficients, unsigned int degree,
+                     const double* const* k, unsigned int stages){
+  d.t0=t0;
+  d.h=h;
+  d.degree=degree;
+  d.y0.assign(y0,y0+n);
+  d.q.resize(degree*n);
+  for(unsigned int p=0; p<degree; p++){
+    double* SQUIDS_RESTRICT qp=&d.q[p*n];
+    std::fill(qp,qp+n,0.);
+    for(unsigned int j=0; j<stages; j++){
+      const double hc=h*coefficients[j*degree+p];
+      if(hc==0)
+        continue;
+      const double* SQUIDS_RESTRICT kj=k[j];
+      for(size_t i=0; i<n; i++)
+        qp[i]+=hc*kj[i];
+    }
+  }
+}
+
+void hermite_dense_output(dense_interpolant& d, double t0, double h, size_t n,
+                          const double* y0, const double* y1,
+                          const double* f0, const double* f1){
+  d.t0=t0;
+  d.h=h;
+  d.degree=3;
+  d.y0.assign(y0,y0+n);
+  d.q.resize(3*n);
+  double* q1=&d.q[0];
+  double* q2=&d.q[n];
+  double* q3=&d.q[2*n];
+  for(size_t i=0; i<n; i++){
+    const double diff=y1[i]-y0[i], hf0=h*f0[i], hf1=h*f1[i];
+    q1[i]=hf0;
+    q2[i]=3*diff-2*hf0-hf1;
+    q3[i]=-2*diff+hf0+hf1;
+  }
+}
+
+} //namespace detail
+} //namespace squids
@@ -22,15 +22,108 @@
  ******************************************************************************/
 
 #include <SQuIDS/SQuIDS.h>
+#include <SQuIDS/detail/StructureConstants.h>
+#include <SQuIDS/detail/BatchKernels.h>
+#include <SQuIDS/detail/ThreadPool.h>
+#include <SQuIDS/detail/MatrixExp.h>
+#include <chrono>
 #include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <iterator>
 #include <limits>
 #include <algorithm>
 #include <iostream>
+#include <mutex>
+#include <thread>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define SQUIDS_USE_MMAP
+#endif
+
+#if defined(SQUIDS_TIMERS) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define SQUIDS_USE_TSC
+#endif
 
 namespace squids{
 
 ///\brief Auxiliary function used for the GSL interface
 int RHS(double ,const double*,double*,void*);
+///\brief Auxiliary function used for the GSL interface
+int JAC(double ,const double*,double*,double*,void*);
+
+namespace{
+#ifdef SQUIDS_TIMERS
+  ///A clock cheap enough to time each term of the derivative: the time stamp
+  ///counter where it is available, otherwise steady_clock
+  inline uint64_t read_ticks(){
+#ifdef SQUIDS_USE_TSC
+    return __rdtsc();
+#else
+    return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+  }
+  
+  ///The number of ticks of read_ticks per second
+  double ticks_per_second(){
+#ifdef SQUIDS_USE_TSC
+    //the rate of the time stamp counter is measured once, against steady_clock
+    static const double rate=[]{
+      const auto start=std::chrono::steady_clock::now();
+      const uint64_t first=read_ticks();
+      std::chrono::duration<double> elapsed(0);
+      while(elapsed.count()<0.02)
+        elapsed=std::chrono::steady_clock::now()-start;
+      return((read_ticks()-first)/elapsed.count());
+    }();
+    return(rate);
+#else
+    return(double(std::chrono::steady_clock::period::den)/std::chrono::steady_clock::period::num);
+#endif
+  }
+  
+  ///Adds the ticks spent in consecutive sections of code to their totals
+  class section_timer{
+    uint64_t* totals;
+    unsigned int section;
+    uint64_t start;
+  public:
+    explicit section_timer(uint64_t* totals):totals(totals),section(~0u),start(0){}
+    ~section_timer(){ stop(); }
+    ///Ends the current section, if any, and starts another
+    void enter(unsigned int next){
+      const uint64_t now=read_ticks();
+      if(section!=~0u)
+        totals[section]+=now-start;
+      section=next;
+      start=now;
+    }
+    ///Ends the current section
+    void stop(){
+      if(section!=~0u)
+        totals[section]+=read_ticks()-start;
+      section=~0u;
+    }
+  };
+#else
+  ///Does nothing, so that the timers are compiled out
+  class section_timer{
+  public:
+    explicit section_timer(uint64_t*){}
+    void enter(unsigned int){}
+    void stop(){}
+  };
+#endif
+}
 
 SQuIDS::SQuIDS():
 CoherentRhoTerms(false),
@@ -38,6 +131,8 @@ NonCoherentRhoTerms(false),
 OtherRhoTerms(false),
 GammaScalarTerms(false),
 OtherScalarTerms(false),
+NonLocalRhoTerms(false),
+NonLocalScalarTerms(false),
 AnyNumerics(false),
 is_init(false),
 adaptive_step(true),
@@ -48,11 +143,35 @@ h_min(std::numeric_limits<double>::min()),
 h_max(std::numeric_limits<double>::max()),
 abs_error(1e-20),
 rel_error(1e-20),
+h_set(false),
+persistent_driver(false),
+driver(nullptr,gsl_odeiv2_driver_free),
+h_last(0),
+method(integrator::gsl),
+split_step(0),
+multirate_levels(0),
+multirate_sync(0),
+grid_tolerance(0),
+grid_interval(0),
+grid_max_nodes(0),
+x_interpolation(interpolation::linear),
+dense_output(false),
+schedule(nullptr),
 last_dstate_ptr(nullptr),
-last_estate_ptr(nullptr)
+last_estate_ptr(nullptr),
+nthreads(1),
+thread_chunk(0),
+thread_affinity(false),
+term_ticks(),
+interaction_picture(false),
+static_hi(false),
+static_gamma(false),
+static_map_coherent(false),
+static_map_noncoherent(false),
+kernel_tolerance(0)
 {
   sys.function = &RHS;
-  sys.jacobian = NULL;
+  sys.jacobian = &JAC;
   sys.dimension = 0;
   sys.params = this;
 }
@@ -68,6 +187,8 @@ NonCoherentRhoTerms(other.NonCoherentRhoTerms),
 OtherRhoTerms(other.OtherRhoTerms),
 GammaScalarTerms(other.GammaScalarTerms),
 OtherScalarTerms(other.OtherScalarTerms),
+NonLocalRhoTerms(other.NonLocalRhoTerms),
+NonLocalScalarTerms(other.NonLocalScalarTerms),
 AnyNumerics(other.AnyNumerics),
 is_init(other.is_init),
 adaptive_step(other.adaptive_step),
@@ -85,6 +206,30 @@ h_min(other.h_min),
 h_max(other.h_max),
 abs_error(other.abs_error),
 rel_error(other.rel_error),
+h_set(other.h_set),
+persistent_driver(other.persistent_driver),
+driver(std::move(other.driver)),
+h_last(other.h_last),
+method(other.method),
+split_step(other.split_step),
+multirate_levels(other.multirate_levels),
+multirate_sync(other.multirate_sync),
+multirate_groups(std::move(other.multirate_groups)),
+multirate_h(std::move(other.multirate_h)),
+multirate_buffers(std::move(other.multirate_buffers)),
+grid_tolerance(other.grid_tolerance),
+grid_interval(other.grid_interval),
+grid_max_nodes(other.grid_max_nodes),
+grid_base(std::move(other.grid_base)),
+x_index(std::move(other.x_index)),
+x_interpolation(other.x_interpolation),
+x_slopes(std::move(other.x_slopes)),
+dense_output(other.dense_output),
+dense(std::move(other.dense)),
+dense_system(std::move(other.dense_system)),
+dense_state(std::move(other.dense_state)),
+schedule(nullptr),
+rk_work(std::move(other.rk_work)),
 dstate(std::move(other.dstate)),
 nx(other.nx),
 nsun(other.nsun),
@@ -94,12 +239,114 @@ params(std::move(other.params)),
 state(std::move(other.state)),
 estate(std::move(other.estate)),
 last_dstate_ptr(other.last_dstate_ptr),
-last_estate_ptr(other.last_estate_ptr)
+last_estate_ptr(other.last_estate_ptr),
+nthreads(other.nthreads),
+thread_chunk(other.thread_chunk),
+thread_affinity(other.thread_affinity),
+pool(std::move(other.pool)),
+workspaces(std::move(other.workspaces)),
+stats(other.stats),
+term_ticks(other.term_ticks),
+interaction_picture(other.interaction_picture),
+h0_cache(std::move(other.h0_cache)),
+evolve_buffers(std::move(other.evolve_buffers)),
+evolve_buffer_times(std::move(other.evolve_buffer_times)),
+reduction_partials(std::move(other.reduction_partials)),
+static_hi(other.static_hi),
+static_gamma(other.static_gamma),
+static_terms(std::move(other.static_terms)),
+static_maps(std::move(other.static_maps)),
+static_map_coherent(other.static_map_coherent),
+static_map_noncoherent(other.static_map_noncoherent),
+rho_kernels(std::move(other.rho_kernels)),
+scalar_kernels(std::move(other.scalar_kernels)),
+kernel_tolerance(other.kernel_tolerance),
+magnus_h1(std::move(other.magnus_h1)),
+magnus_h2(std::move(other.magnus_h2)),
+magnus_buffers(std::move(other.magnus_buffers)),
+jacobian_scratch(std::move(other.jacobian_scratch))
 {
   sys.params=this;
+  if(driver)
+    driver->sys=&sys;
   other.is_init=false; //other is no longer usable, since we stole its contents
 }
 
+SQuIDS::SQuIDS(const SQuIDS& other):
+SQuIDS(){
+  thread_chunk=other.thread_chunk;
+  thread_affinity=other.thread_affinity;
+  Set_NumThreads(other.nthreads);
+  if(other.is_init)
+    CopyStateFrom(other);
+}
+
+void SQuIDS::CopyStateFrom(const SQuIDS& other){
+  if(&other==this)
+    return;
+  if(!other.is_init)
+    throw std::runtime_error("SQUIDS::CopyStateFrom : The system to copy has not been initialized");
+  if(!is_init || other.nx!=nx || other.nsun!=nsun || other.nrhos!=nrhos || other.nscalars!=nscalars)
+    ini(other.nx,other.nsun,other.nrhos,other.nscalars,other.t_ini);
+  t_ini=other.t_ini;
+  t=other.t;
+  Set_xrange(other.x);
+  for(unsigned int i=0; i<nsun; i++){
+    for(unsigned int j=i+1; j<nsun; j++){
+      params.SetMixingAngle(i,j,other.params.GetMixingAngle(i,j));
+      params.SetPhase(i,j,other.params.GetPhase(i,j));
+    }
+    if(i>0)
+      params.SetEnergyDifference(i,other.params.GetEnergyDifference(i));
+  }
+  
+  CoherentRhoTerms=other.CoherentRhoTerms;
+  NonCoherentRhoTerms=other.NonCoherentRhoTerms;
+  OtherRhoTerms=other.OtherRhoTerms;
+  GammaScalarTerms=other.GammaScalarTerms;
+  OtherScalarTerms=other.OtherScalarTerms;
+  NonLocalRhoTerms=other.NonLocalRhoTerms;
+  NonLocalScalarTerms=other.NonLocalScalarTerms;
+  AnyNumerics=other.AnyNumerics;
+  adaptive_step=other.adaptive_step;
+  nsteps=other.nsteps;
+  step=other.step;
+  h=other.h;
+  h_min=other.h_min;
+  h_max=other.h_max;
+  abs_error=other.abs_error;
+  rel_error=other.rel_error;
+  h_set=other.h_set;
+  persistent_driver=other.persistent_driver;
+  method=other.method;
+  split_step=other.split_step;
+  multirate_levels=other.multirate_levels;
+  multirate_sync=other.multirate_sync;
+  grid_tolerance=other.grid_tolerance;
+  grid_interval=other.grid_interval;
+  grid_max_nodes=other.grid_max_nodes;
+  grid_base=other.grid_base;
+  x_index=other.x_index;
+  x_interpolation=other.x_interpolation;
+  dense_output=other.dense_output;
+  interaction_picture=other.interaction_picture;
+  static_hi=other.static_hi;
+  static_gamma=other.static_gamma;
+  kernel_tolerance=other.kernel_tolerance;
+  
+  //anything derived from the previous state or settings is stale
+  driver.reset();
+  static_terms.clear();
+  rho_kernels.clear();
+  scalar_kernels.clear();
+  multirate_groups.clear();
+  dense.clear();
+  h_last=other.h_last;
+  
+  std::copy(other.system.get(),other.system.get()+nx*size_state,system.get());
+  x_slopes=other.x_slopes;
+}
+
 void SQuIDS::ini(unsigned int n, unsigned int nsu, unsigned int nrh, unsigned int nsc, double ti){
   /*
     Setting the number of energy bins, number of components for the density matrix and
@@ -122,6 +369,8 @@ void SQuIDS::ini(unsigned int n, unsigned int nsu, unsigned int nrh, unsigned in
   unsigned int numeqn=nx*size_state;
   system.reset(new double[numeqn]);
   sys.dimension = static_cast<size_t>(numeqn);
+  driver.reset();
+  h_last=0;
 
   /*
     Initializing the SU algebra object, needed to compute algebraic operations like commutators,
@@ -130,7 +379,27 @@ void SQuIDS::ini(unsigned int n, unsigned int nsu, unsigned int nrh, unsigned in
 
   //Allocate memory
   x.resize(nx);
+  grid_base.clear();
+  x_index.clear();
+  x_slopes.clear();
+  allocate_states();
+  //the dimension may have changed
+  workspaces.clear();
+  h0_cache.clear();
+  static_terms.clear();
+  rho_kernels.clear();
+  scalar_kernels.clear();
+  magnus_h1.clear();
+  magnus_h2.clear();
+  multirate_groups.clear();
+  dense.clear();
+  dense_system.reset();
+  dense_state.reset();
 
+  is_init=true;
+};
+
+void SQuIDS::allocate_states(){
   state.reset(new SU_state[nx]);
   estate.reset(new SU_state[nx]);
   dstate.reset(new SU_state[nx]);
@@ -154,10 +423,8 @@ void SQuIDS::ini(unsigned int n, unsigned int nsu, unsigned int nrh, unsigned in
     }
   }
   last_dstate_ptr=nullptr;
-  last_estate_ptr=nullptr;
-
-  is_init=true;
-};
+  last_estate_ptr=system.get();
+}
 
 void SQuIDS::set_system_pointers(double* sp, double* dp){
   //If the memory we're told to use is the same as in the last call,
@@ -191,6 +458,8 @@ SQuIDS& SQuIDS::operator=(SQuIDS&& other){
   OtherRhoTerms=other.OtherRhoTerms;
   GammaScalarTerms=other.GammaScalarTerms;
   OtherScalarTerms=other.OtherScalarTerms;
+  NonLocalRhoTerms=other.NonLocalRhoTerms;
+  NonLocalScalarTerms=other.NonLocalScalarTerms;
   AnyNumerics=other.AnyNumerics;
   is_init=other.is_init;
   adaptive_step=other.adaptive_step;
@@ -208,6 +477,33 @@ SQuIDS& SQuIDS::operator=(SQuIDS&& other){
   h_max=other.h_max;
   abs_error=other.abs_error;
   rel_error=other.rel_error;
+  h_set=other.h_set;
+  persistent_driver=other.persistent_driver;
+  driver=std::move(other.driver);
+  h_last=other.h_last;
+  method=other.method;
+  split_step=other.split_step;
+  multirate_levels=other.multirate_levels;
+  multirate_sync=other.multirate_sync;
+  multirate_groups=std::move(other.multirate_groups);
+  multirate_h=std::move(other.multirate_h);
+  multirate_buffers=std::move(other.multirate_buffers);
+  grid_tolerance=other.grid_tolerance;
+  grid_interval=other.grid_interval;
+  grid_max_nodes=other.grid_max_nodes;
+  grid_base=std::move(other.grid_base);
+  x_index=std::move(other.x_index);
+  x_interpolation=other.x_interpolation;
+  x_slopes=std::move(other.x_slopes);
+  dense_output=other.dense_output;
+  dense=std::move(other.dense);
+  dense_system=std::move(other.dense_system);
+  dense_state=std::move(other.dense_state);
+  schedule=nullptr;
+  rk_work=std::move(other.rk_work);
+  magnus_h1=std::move(other.magnus_h1);
+  magnus_h2=std::move(other.magnus_h2);
+  magnus_buffers=std::move(other.magnus_buffers);
   dstate=std::move(other.dstate);
   nx=other.nx;
   nsun=other.nsun;
@@ -218,7 +514,31 @@ SQuIDS& SQuIDS::operator=(SQuIDS&& other){
   estate=std::move(other.estate);
   last_dstate_ptr=other.last_dstate_ptr;
   last_estate_ptr=other.last_estate_ptr;
+  nthreads=other.nthreads;
+  thread_chunk=other.thread_chunk;
+  thread_affinity=other.thread_affinity;
+  pool=std::move(other.pool);
+  workspaces=std::move(other.workspaces);
+  stats=other.stats;
+  term_ticks=other.term_ticks;
+  jacobian_scratch=std::move(other.jacobian_scratch);
+  interaction_picture=other.interaction_picture;
+  h0_cache=std::move(other.h0_cache);
+  evolve_buffers=std::move(other.evolve_buffers);
+  evolve_buffer_times=std::move(other.evolve_buffer_times);
+  reduction_partials=std::move(other.reduction_partials);
+  static_hi=other.static_hi;
+  static_gamma=other.static_gamma;
+  static_terms=std::move(other.static_terms);
+  static_maps=std::move(other.static_maps);
+  static_map_coherent=other.static_map_coherent;
+  static_map_noncoherent=other.static_map_noncoherent;
+  rho_kernels=std::move(other.rho_kernels);
+  scalar_kernels=std::move(other.scalar_kernels);
+  kernel_tolerance=other.kernel_tolerance;
   sys.params=this;
+  if(driver)
+    driver->sys=&sys;
   other.is_init=false; //other is no longer usable, since we stole its contents
   
   return(*this);
@@ -230,8 +550,17 @@ SQuIDS& SQuIDS::operator=(SQuIDS&& other){
  */
 
 void SQuIDS::Set_xrange(double xi, double xf, std::string type){
+  h0_cache.clear();
+  x_slopes.clear();
+  static_terms.clear();
+  rho_kernels.clear();
+  scalar_kernels.clear();
+  multirate_groups.clear();
+  dense.clear();
   if (xi == xf){
     x[0] = xi;
+    grid_base=x;
+    x_index.build(x,detail::grid_index::spacing::arbitrary);
     return;
   }
 
@@ -255,6 +584,9 @@ void SQuIDS::Set_xrange(double xi, double xf, std::string type){
   }else{
     throw std::runtime_error("SQUIDS::Set_xrange : Not well deffined X range");
   }
+  grid_base=x;
+  x_index.build(x,type=="log" || type=="Log" ? detail::grid_index::spacing::logarithmic
+                                             : detail::grid_index::spacing::linear);
 }
 
 double SQuIDS::GetExpectationValue(SU_vector op, unsigned int nrh, unsigned int i) const{
@@ -269,18 +601,47 @@ double SQuIDS::GetExpectationValue(SU_vector op, unsigned int nrh, unsigned int
   return state[i].rho[nrh]*op.Evolve(evol_buf.get());
 }
 
+const SQuIDS::SU_state* SQuIDS::GetStateAt(double at){
+  if(!dense.contains(at))
+    throw std::runtime_error("SQUIDS::GetStateAt : No interpolant covers the requested time");
+  prepare_dense_state();
+  dense.evaluate(at,0,nx*size_state,dense_system.get());
+  return dense_state.get();
+}
+
+void SQuIDS::prepare_dense_state(){
+  if(dense_state)
+    return;
+  dense_system.reset(new double[nx*size_state]);
+  dense_state.reset(new SU_state[nx]);
+  for(unsigned int ei = 0; ei < nx; ei++){
+    dense_state[ei].rho.reset(new SU_vector[nrhos]);
+    for(unsigned int i=0;i<nrhos;i++)
+      dense_state[ei].rho[i]=SU_vector(nsun,&(dense_system[ei*size_state+i*size_rho]));
+    dense_state[ei].scalar=&(dense_system[ei*size_state+nrhos*size_rho]);
+  }
+}
+
+double SQuIDS::GetExpectationValueAt(SU_vector op, unsigned int nrh, unsigned int i, double at) const{
+  if(!dense.contains(at))
+    throw std::runtime_error("SQUIDS::GetExpectationValueAt : No interpolant covers the requested time");
+  std::unique_ptr<double[]> rho_buf(new double[size_rho]);
+  dense.evaluate(at,i*size_state+nrh*size_rho,size_rho,rho_buf.get());
+  SU_vector rho(nsun,rho_buf.get());
+  SU_vector h0=H0(x[i],nrh);
+  return rho*op.Evolve(h0,at-t_ini);
+}
+
 SU_vector SQuIDS::GetIntermediateState(unsigned int nrh, double xi) const{
   //find bracketing state entries
-  auto xit=std::lower_bound(x.begin(),x.end(),xi);
-  if(xit==x.end())
+  size_t xid=x_index.lower_bound(x,xi);
+  if(xid==nx)
     throw std::runtime_error("SQUIDS::GetExpectationValueD : x value not in the array.");
-  if(xit!=x.begin())
-    xit--;
-  size_t xid=std::distance(x.begin(),xit);
-  //linearly interpolate between the two states
-  double f2=((xi-x[xid])/(x[xid+1]-x[xid]));
-  double f1=1-f2;
-  return f1*state[xid].rho[nrh] + f2*state[xid+1].rho[nrh];
+  if(xid>0)
+    xid--;
+  SU_vector result(nsun);
+  interpolate_rho(nrh,xi,xid,result);
+  return result;
 }
 
 double SQuIDS::GetExpectationValueD(const SU_vector& op, unsigned int nrh, double xi) const{
@@ -304,18 +665,13 @@ double SQuIDS::GetExpectationValueD(const SU_vector& op, unsigned int nrh, doubl
 double SQuIDS::GetExpectationValueD(const SU_vector& op, unsigned int nrh, double xi,
                                     SQuIDS::expectationValueDBuffer& buf) const{
   //find bracketing state entries
-  auto xit=std::lower_bound(x.begin(),x.end(),xi);
-  if(xit==x.end())
+  size_t xid=x_index.lower_bound(x,xi);
+  if(xid==nx)
     throw std::runtime_error("SQUIDS::GetExpectationValueD : x value not in the array.");
-  if(xit!=x.begin())
-    xit--;
-  size_t xid=std::distance(x.begin(),xit);
+  if(xid>0)
+    xid--;
 
-  //linearly interpolate between the two states
-  double f2=((xi-x[xid])/(x[xid+1]-x[xid]));
-  double f1=1-f2;
-  buf.state =f1*state[xid].rho[nrh];
-  buf.state+=f2*state[xid+1].rho[nrh];
+  interpolate_rho(nrh,xi,xid,buf.state);
   //compute the evolved operator
   buf.op=op.Evolve(H0(xi,nrh),t-t_ini);
   //apply operator to state
@@ -326,64 +682,370 @@ double SQuIDS::GetExpectationValueD(const SU_vector& op, unsigned int nrh, doubl
                                     SQuIDS::expectationValueDBuffer& buf,
                                     double scale, std::vector<bool>& avr) const{
   //find bracketing state entries
-  auto xit=std::lower_bound(x.begin(),x.end(),xi);
-  if(xit==x.end())
+  size_t xid=x_index.lower_bound(x,xi);
+  if(xid==nx)
     throw std::runtime_error("SQUIDS::GetExpectationValueD : x value not in the array.");
-  if(xit!=x.begin())
-    xit--;
-  size_t xid=std::distance(x.begin(),xit);
+  if(xid>0)
+    xid--;
 
-  //linearly interpolate between the two states
-  double f2=((xi-x[xid])/(x[xid+1]-x[xid]));
-  double f1=1-f2;
-  buf.state =f1*state[xid].rho[nrh];
-  buf.state+=f2*state[xid+1].rho[nrh];
   //compute the evolved operator
   std::unique_ptr<double[]> evol_buf(new double[H0(xi,nrh).GetEvolveBufferSize()]);
   H0(xi,nrh).PrepareEvolve(evol_buf.get(),t-t_ini,scale,avr);
   buf.op=op.Evolve(evol_buf.get());
+  if(x_interpolation!=interpolation::linear){
+    interpolate_rho(nrh,xi,xid,buf.state);
+    return buf.state*buf.op;
+  }
   //apply operator to state
+  double f2=((xi-x[xid])/(x[xid+1]-x[xid]));
+  double f1=1-f2;
   return (buf.op*state[xid].rho[nrh])*f1 + (buf.op*state[xid+1].rho[nrh])*f2;
   //return buf.state*buf.op;
 }
 
+void SQuIDS::GetExpectationValuesD(const std::vector<SU_vector>& ops, unsigned int nrh,
+                                   const std::vector<double>& xs, double* out) const{
+  GetExpectationValuesD(ops,nrh,xs,out,std::numeric_limits<double>::infinity());
+}
+
+void SQuIDS::GetExpectationValuesD(const std::vector<SU_vector>& ops, unsigned int nrh,
+                                   const std::vector<double>& xs, double* out, double scale) const{
+#ifdef SQUIDS_THREAD_LOCAL
+  static SQUIDS_THREAD_LOCAL expectationValuesDBuffer buf;
+#else //slow way, without thread local storage
+  expectationValuesDBuffer buf;
+#endif
+  GetExpectationValuesD(ops,nrh,xs,out,buf,scale);
+}
+
+void SQuIDS::GetExpectationValuesD(const std::vector<SU_vector>& ops, unsigned int nrh,
+                                   const std::vector<double>& xs, double* out,
+                                   SQuIDS::expectationValuesDBuffer& buf) const{
+  //no oscillation is averaged with an infinite scale
+  GetExpectationValuesD(ops,nrh,xs,out,buf,std::numeric_limits<double>::infinity());
+}
+
+void SQuIDS::GetExpectationValuesD(const std::vector<SU_vector>& ops, unsigned int nrh,
+                                   const std::vector<double>& xs, double* out,
+                                   SQuIDS::expectationValuesDBuffer& buf, double scale) const{
+  if(nrh>=nrhos)
+    throw std::runtime_error("SQUIDS::GetExpectationValuesD : Invalid rho index");
+  for(const SU_vector& op : ops){
+    if(op.Dim()!=nsun)
+      throw std::runtime_error("SQUIDS::GetExpectationValuesD : Operator dimension does not match the system");
+  }
+  for(double xi : xs){
+    if(xi>x.back())
+      throw std::runtime_error("SQUIDS::GetExpectationValuesD : x value not in the array.");
+  }
+  const unsigned int nqueries=xs.size(), nops=ops.size();
+  const unsigned int nworkers=(pool && nqueries>1 ? pool->size() : 1);
+  const size_t evolve_size=nsun*(nsun-1);
+  const size_t worker_size=evolve_size+2*size_rho;
+  if(buf.scratch.size()<nworkers*worker_size)
+    buf.scratch.resize(nworkers*worker_size);
+  if(buf.averaged.size()<nworkers)
+    buf.averaged.resize(nworkers);
+  for(unsigned int w=0; w<nworkers; w++){
+    if(buf.averaged[w].size()<evolve_size/2)
+      buf.averaged[w].resize(evolve_size/2);
+  }
+  //H0 is not among the functions which may be called concurrently, so the
+  //calling thread evaluates it for all queries before they are split up
+  if(nworkers>1){
+    if(buf.h0.size()<static_cast<size_t>(nqueries)*size_rho)
+      buf.h0.resize(static_cast<size_t>(nqueries)*size_rho);
+    for(unsigned int i=0; i<nqueries; i++){
+      SU_vector h0(nsun,&buf.h0[static_cast<size_t>(i)*size_rho]);
+      h0=H0(xs[i],nrh);
+    }
+  }
+  
+  auto evaluate=[&](unsigned int begin, unsigned int end, unsigned int worker){
+    double* evolve_buf=&buf.scratch[worker*worker_size];
+    SU_vector interpolated(nsun,evolve_buf+evolve_size);
+    SU_vector rotated(nsun,evolve_buf+evolve_size+size_rho);
+    std::vector<bool>& avr=buf.averaged[worker];
+    //the position of the first node not before the previous x
+    size_t upper=0;
+    for(unsigned int i=begin; i<end; i++){
+      const double xi=xs[i];
+      if(i==begin || xi<xs[i-1])
+        upper=x_index.lower_bound(x,xi);
+      else{
+        while(x[upper]<xi)
+          upper++;
+      }
+      const size_t xid=(upper>0 ? upper-1 : 0);
+      interpolate_rho(nrh,xi,xid,interpolated);
+      //rotating the state back is equivalent to rotating each operator forward
+      if(nworkers>1)
+        SU_vector(nsun,&buf.h0[static_cast<size_t>(i)*size_rho]).PrepareEvolve(evolve_buf,-(t-t_ini),scale,avr);
+      else
+        H0(xi,nrh).PrepareEvolve(evolve_buf,-(t-t_ini),scale,avr);
+      rotated=interpolated.Evolve(evolve_buf);
+      double* result=out+static_cast<size_t>(i)*nops;
+      for(unsigned int j=0; j<nops; j++)
+        result[j]=rotated*ops[j];
+    }
+  };
+  if(nworkers>1){
+    const unsigned int chunk=std::max(1u,std::min(64u,nqueries/(4*nworkers)));
+    pool->parallel_for(nqueries,chunk,evaluate);
+  }else if(nqueries>0)
+    evaluate(0,nqueries,0);
+}
+
 void SQuIDS::Set_xrange(const std::vector<double>& xs){
   if(xs.size()!=nx)
     throw std::runtime_error("SQUIDS::Set_xrange : wrong number of x values");
   if(!std::is_sorted(xs.begin(),xs.end()))
     throw std::runtime_error("SQUIDS::Set_xrange : x values must be sorted");
   x=xs;
+  grid_base=x;
+  x_index.build(x,detail::grid_index::spacing::arbitrary);
+  x_slopes.clear();
+  h0_cache.clear();
+  static_terms.clear();
+  rho_kernels.clear();
+  scalar_kernels.clear();
+  multirate_groups.clear();
+  dense.clear();
 }
 
-unsigned int SQuIDS::Get_i(double xi) const{
-  double xl, xr;
-  unsigned int nr=nx-1;
-  unsigned int nl=0;
+double SQuIDS::node_difference(unsigned int ix, unsigned int jx) const{
+  double difference=0;
+  const double* a=&system[ix*size_state];
+  const double* b=&system[jx*size_state];
+  for(unsigned int i=0; i<nrhos; i++, a+=size_rho, b+=size_rho){
+    double norm_a=0, norm_b=0, norm_d=0;
+    for(unsigned int k=0; k<size_rho; k++){
+      norm_a+=a[k]*a[k];
+      norm_b+=b[k]*b[k];
+      norm_d+=(a[k]-b[k])*(a[k]-b[k]);
+    }
+    if(norm_d>0)
+      difference=std::max(difference,std::sqrt(norm_d/std::max(norm_a,norm_b)));
+  }
+  for(unsigned int is=0; is<nscalars; is++){
+    if(a[is]!=b[is])
+      difference=std::max(difference,std::abs(a[is]-b[is])/std::max(std::abs(a[is]),std::abs(b[is])));
+  }
+  return(difference);
+}
 
-  xl=x[nl];
-  xr=x[nr];
+bool SQuIDS::AdaptGrid(){
+  if(!is_init || nx<2 || grid_tolerance<=0)
+    return(false);
+  std::vector<double> difference(nx-1);
+  for(unsigned int ix=0; ix+1<nx; ix++)
+    difference[ix]=node_difference(ix,ix+1);
+  
+  //inserted nodes are removed where the state changes little on either side
+  const double coarsen_tolerance=grid_tolerance/4;
+  std::vector<bool> keep(nx,true);
+  unsigned int kept=nx;
+  for(unsigned int ix=1; ix+1<nx; ix++){
+    if(keep[ix-1] && difference[ix-1]<coarsen_tolerance && difference[ix]<coarsen_tolerance
+       && !std::binary_search(grid_base.begin(),grid_base.end(),x[ix])){
+      keep[ix]=false;
+      kept--;
+    }
+  }
+  //and inserted between nodes whose states differ too much, evenly spaced
+  //so that the interpolated states should differ by about the tolerance, as
+  //far as the nodes can be represented
+  std::vector<unsigned int> insert(nx-1,0);
+  std::vector<unsigned int> refined;
+  size_t inserted=0;
+  for(unsigned int ix=0; ix+1<nx; ix++){
+    if(difference[ix]<=grid_tolerance)
+      continue;
+    const double wanted=std::ceil(difference[ix]/grid_tolerance)-1;
+    const double spacing=(x[ix+1]-x[ix])/(wanted+1);
+    if(!(x[ix]+spacing>x[ix]) || !(x[ix+1]-spacing<x[ix+1]))
+      continue;
+    insert[ix]=std::min<double>(wanted,std::numeric_limits<unsigned int>::max()/2);
+    refined.push_back(ix);
+    inserted+=insert[ix];
+  }
+  if(grid_max_nodes>0 && kept+inserted>grid_max_nodes){
+    //the pairs which differ most are refined first
+    size_t allowed=(grid_max_nodes>kept ? grid_max_nodes-kept : 0);
+    std::stable_sort(refined.begin(),refined.end(),
+                     [&](unsigned int a, unsigned int b){ return(difference[a]>difference[b]); });
+    for(unsigned int ix : refined){
+      insert[ix]=std::min<size_t>(insert[ix],allowed);
+      allowed-=insert[ix];
+    }
+    inserted=0;
+    for(unsigned int ix : refined)
+      inserted+=insert[ix];
+  }
+  if(kept==nx && inserted==0)
+    return(false);
+  
+  const unsigned int new_nx=kept+inserted;
+  std::vector<double> new_x;
+  new_x.reserve(new_nx);
+  std::unique_ptr<double[]> new_system(new double[static_cast<size_t>(new_nx)*size_state]);
+  double* out=new_system.get();
+  for(unsigned int ix=0; ix<nx; ix++){
+    const double* node=&system[ix*size_state];
+    if(keep[ix]){
+      new_x.push_back(x[ix]);
+      out=std::copy(node,node+size_state,out);
+    }
+    if(ix+1==nx)
+      break;
+    //the states are interpolated with the cubic through the four nearest
+    //nodes, which keeps the error made by repeated refinements small
+    const unsigned int first=(nx<4 ? ix : std::min(std::max(ix,1u)-1,nx-4));
+    const unsigned int npoints=(nx<4 ? 2 : 4);
+    for(unsigned int j=1; j<=insert[ix]; j++){
+      const double f=static_cast<double>(j)/(insert[ix]+1);
+      const double xi=(1-f)*x[ix]+f*x[ix+1];
+      new_x.push_back(xi);
+      double weights[4];
+      for(unsigned int a=0; a<npoints; a++){
+        weights[a]=1;
+        for(unsigned int b=0; b<npoints; b++){
+          if(b!=a)
+            weights[a]*=(xi-x[first+b])/(x[first+a]-x[first+b]);
+        }
+      }
+      for(unsigned int k=0; k<size_state; k++){
+        double value=0;
+        for(unsigned int a=0; a<npoints; a++)
+          value+=weights[a]*system[(first+a)*size_state+k];
+        *out++=value;
+      }
+    }
+  }
+  
+  nx=new_nx;
+  x=std::move(new_x);
+  x_index.build(x,detail::grid_index::spacing::arbitrary);
+  system=std::move(new_system);
+  sys.dimension=static_cast<size_t>(nx)*size_state;
+  allocate_states();
+  //anything computed for the previous nodes is stale
+  driver.reset();
+  h0_cache.clear();
+  static_terms.clear();
+  rho_kernels.clear();
+  scalar_kernels.clear();
+  multirate_groups.clear();
+  dense.clear();
+  dense_system.reset();
+  dense_state.reset();
+  update_slopes();
+  GridChanged();
+  return(true);
+}
 
-  if(xi>xr || xi<xl)
-    throw std::runtime_error(" Error SQUIDS::Get_i :  value  out of bounds");
+void SQuIDS::Set_Interpolation(interpolation method){
+  x_interpolation=method;
+  if(is_init)
+    update_slopes();
+}
 
-  while((nr-nl)>1){
-    if(((nr-nl)%2)!=0){
-      if(nr<nx-1)nr++;
-      else if(nl>0)nl--;
+interpolation SQuIDS::Get_Interpolation() const{
+  return x_interpolation;
+}
+
+double SQuIDS::interpolation_slope(unsigned int ix, unsigned int irho, unsigned int k) const{
+  if(nx<2)
+    return(0);
+  auto secant=[&](unsigned int i){
+    const double width=x[i+1]-x[i];
+    return(width>0 ? (state[i+1].rho[irho][k]-state[i].rho[irho][k])/width : 0.);
+  };
+  if(nx==2)
+    return(secant(0));
+  const bool monotone=(x_interpolation==interpolation::monotone_cubic);
+  if(ix==0 || ix==nx-1){
+    //the derivative of the parabola through the last three nodes, with the
+    //interval at the end first
+    const unsigned int end=(ix==0 ? 0 : nx-2), next=(ix==0 ? 1 : nx-3);
+    const double w0=x[end+1]-x[end], w1=x[next+1]-x[next];
+    const double d0=secant(end), d1=secant(next);
+    double slope=((2*w0+w1)*d0-w0*d1)/(w0+w1);
+    if(monotone){
+      if(slope*d0<=0)
+        slope=0;
+      else if(d0*d1<0 && std::abs(slope)>3*std::abs(d0))
+        slope=3*d0;
     }
-    if(xi<(xl+(xr-xl)/2)){
-      nr=nl+(nr-nl)/2;
-      xr=x[nr];
-    }else{
-      nl=nl+(nr-nl)/2;
-      xl=x[nl];
+    return(slope);
+  }
+  const double w0=x[ix]-x[ix-1], w1=x[ix+1]-x[ix];
+  const double d0=secant(ix-1), d1=secant(ix);
+  if(monotone){
+    //a weighted harmonic mean of the secants, which is zero at extrema
+    if(d0*d1<=0)
+      return(0);
+    const double a=2*w1+w0, b=w1+2*w0;
+    return((a+b)/(a/d0+b/d1));
+  }
+  return((w1*d0+w0*d1)/(w0+w1));
+}
+
+void SQuIDS::update_slopes(){
+  if(x_interpolation==interpolation::linear){
+    x_slopes.clear();
+    return;
+  }
+  x_slopes.resize(static_cast<size_t>(nx)*nrhos*size_rho);
+  double* slope=x_slopes.data();
+  for(unsigned int ix=0; ix<nx; ix++){
+    for(unsigned int irho=0; irho<nrhos; irho++){
+      for(unsigned int k=0; k<size_rho; k++)
+        *slope++=interpolation_slope(ix,irho,k);
     }
   }
-  return nl;
+}
+
+void SQuIDS::interpolate_rho(unsigned int irho, double xi, size_t ix, SU_vector& out) const{
+  const double width=x[ix+1]-x[ix];
+  const double s=(xi-x[ix])/width;
+  if(x_interpolation==interpolation::linear){
+    //linearly interpolate between the two states
+    out =(1-s)*state[ix].rho[irho];
+    out+=s*state[ix+1].rho[irho];
+    return;
+  }
+  //the cubic Hermite basis functions, with the slopes scaled to the interval
+  const double r=1-s;
+  const double h00=(1+2*s)*r*r, h01=s*s*(3-2*s);
+  const double h10=width*s*r*r, h11=-width*s*s*r;
+  const SU_vector& left=state[ix].rho[irho];
+  const SU_vector& right=state[ix+1].rho[irho];
+  if(x_slopes.empty()){
+    for(unsigned int k=0; k<size_rho; k++)
+      out[k]=h00*left[k]+h01*right[k]+h10*interpolation_slope(ix,irho,k)+h11*interpolation_slope(ix+1,irho,k);
+    return;
+  }
+  const double* m0=&x_slopes[(ix*nrhos+irho)*size_rho];
+  const double* m1=m0+nrhos*size_rho;
+  for(unsigned int k=0; k<size_rho; k++)
+    out[k]=h00*left[k]+h01*right[k]+h10*m0[k]+h11*m1[k];
+}
+
+unsigned int SQuIDS::Get_i(double xi) const{
+  if(xi>x[nx-1] || xi<x[0])
+    throw std::runtime_error(" Error SQUIDS::Get_i :  value  out of bounds");
+  size_t i=x_index.lower_bound(x,xi);
+  //the last node not after xi, which starts an interval
+  if(i==nx || x[i]>xi)
+    i--;
+  return(std::min<size_t>(i,nx>1 ? nx-2 : 0));
 }
 
 void SQuIDS::Set_GSL_step(gsl_odeiv2_step_type const* opt){
   step = opt;
+  driver.reset();
+  h_last=0;
 }
 
 void SQuIDS::Set_AdaptiveStep(bool opt){
@@ -391,23 +1053,45 @@ void SQuIDS::Set_AdaptiveStep(bool opt){
 }
 void SQuIDS::Set_CoherentRhoTerms(bool opt){
   CoherentRhoTerms=opt;
-  AnyNumerics=(CoherentRhoTerms||NonCoherentRhoTerms||OtherRhoTerms||GammaScalarTerms||OtherScalarTerms);
+  AnyNumerics=(CoherentRhoTerms||NonCoherentRhoTerms||OtherRhoTerms||GammaScalarTerms||OtherScalarTerms||NonLocalRhoTerms||NonLocalScalarTerms);
 }
 void SQuIDS::Set_NonCoherentRhoTerms(bool opt){
   NonCoherentRhoTerms=opt;
-  AnyNumerics=(CoherentRhoTerms||NonCoherentRhoTerms||OtherRhoTerms||GammaScalarTerms||OtherScalarTerms);
+  AnyNumerics=(CoherentRhoTerms||NonCoherentRhoTerms||OtherRhoTerms||GammaScalarTerms||OtherScalarTerms||NonLocalRhoTerms||NonLocalScalarTerms);
 }
 void SQuIDS::Set_OtherRhoTerms(bool opt){
   OtherRhoTerms=opt;
-  AnyNumerics=(CoherentRhoTerms||NonCoherentRhoTerms||OtherRhoTerms||GammaScalarTerms||OtherScalarTerms);
+  AnyNumerics=(CoherentRhoTerms||NonCoherentRhoTerms||OtherRhoTerms||GammaScalarTerms||OtherScalarTerms||NonLocalRhoTerms||NonLocalScalarTerms);
 }
 void SQuIDS::Set_GammaScalarTerms(bool opt){
   GammaScalarTerms=opt;
-  AnyNumerics=(CoherentRhoTerms||NonCoherentRhoTerms||OtherRhoTerms||GammaScalarTerms||OtherScalarTerms);
+  AnyNumerics=(CoherentRhoTerms||NonCoherentRhoTerms||OtherRhoTerms||GammaScalarTerms||OtherScalarTerms||NonLocalRhoTerms||NonLocalScalarTerms);
 }
 void SQuIDS::Set_OtherScalarTerms(bool opt){
   OtherScalarTerms=opt;
-  AnyNumerics=(CoherentRhoTerms||NonCoherentRhoTerms||OtherRhoTerms||GammaScalarTerms||OtherScalarTerms);
+  AnyNumerics=(CoherentRhoTerms||NonCoherentRhoTerms||OtherRhoTerms||GammaScalarTerms||OtherScalarTerms||NonLocalRhoTerms||NonLocalScalarTerms);
+}
+
+void SQuIDS::Set_NonLocalRhoTerms(bool opt){
+  NonLocalRhoTerms=opt;
+  AnyNumerics=(CoherentRhoTerms||NonCoherentRhoTerms||OtherRhoTerms||GammaScalarTerms||OtherScalarTerms||NonLocalRhoTerms||NonLocalScalarTerms);
+  rho_kernels.clear();
+}
+void SQuIDS::Set_NonLocalScalarTerms(bool opt){
+  NonLocalScalarTerms=opt;
+  AnyNumerics=(CoherentRhoTerms||NonCoherentRhoTerms||OtherRhoTerms||GammaScalarTerms||OtherScalarTerms||NonLocalRhoTerms||NonLocalScalarTerms);
+  scalar_kernels.clear();
+}
+
+void SQuIDS::Set_KernelCompression(double tolerance){
+  if(tolerance<0)
+    throw std::runtime_error("SQUIDS::Set_KernelCompression : The tolerance must not be negative");
+  kernel_tolerance=tolerance;
+  rho_kernels.clear();
+  scalar_kernels.clear();
+}
+double SQuIDS::Get_KernelCompression() const{
+  return kernel_tolerance;
 }
 
 void SQuIDS::Set_AnyNumerics(bool opt){
@@ -438,6 +1122,9 @@ void SQuIDS::Set_h_max(double opt){
 
 void SQuIDS::Set_h(double opt){
   h=opt;
+  h_set=true;
+  h_last=0;
+  multirate_groups.clear();
 }
 
 double SQuIDS::Get_h_min() const{
@@ -454,10 +1141,16 @@ double SQuIDS::Get_h() const{
 
 void SQuIDS::Set_rel_error(double opt){
   rel_error=opt;
+  driver.reset();
+  h_last=0;
+  multirate_groups.clear();
 }
 
 void SQuIDS::Set_abs_error(double opt){
   abs_error=opt;
+  driver.reset();
+  h_last=0;
+  multirate_groups.clear();
 }
 
 void SQuIDS::Set_NumSteps(unsigned int opt){
@@ -476,26 +1169,459 @@ double SQuIDS::Get_NumSteps() const{
   return nsteps;
 }
 
+void SQuIDS::Set_PersistentDriver(bool opt){
+  persistent_driver=opt;
+  if(!persistent_driver){
+    driver.reset();
+    h_last=0;
+  }
+}
+
+bool SQuIDS::Get_PersistentDriver() const{
+  return persistent_driver;
+}
+
+void SQuIDS::Set_Integrator(integrator opt){
+  method=opt;
+  h_last=0;
+  multirate_groups.clear();
+}
+
+integrator SQuIDS::Get_Integrator() const{
+  return method;
+}
+
+void SQuIDS::Set_SplitStep(double opt){
+  if(opt<0)
+    throw std::runtime_error("SQUIDS::Set_SplitStep : The split step size must not be negative");
+  split_step=opt;
+}
+
+double SQuIDS::Get_SplitStep() const{
+  return split_step;
+}
+
+void SQuIDS::Set_MultiRate(unsigned int levels, double sync_step){
+  if(sync_step<0)
+    throw std::runtime_error("SQUIDS::Set_MultiRate : The synchronization step must not be negative");
+  multirate_levels=levels;
+  multirate_sync=sync_step;
+  multirate_groups.clear();
+}
+
+unsigned int SQuIDS::Get_MultiRateLevels() const{
+  return multirate_levels;
+}
+
+const std::vector<unsigned int>& SQuIDS::Get_MultiRateGroups() const{
+  return multirate_groups;
+}
+
+void SQuIDS::Set_AdaptiveGrid(double tolerance, double interval, unsigned int max_nodes){
+  if(tolerance<0)
+    throw std::runtime_error("SQUIDS::Set_AdaptiveGrid : The tolerance must not be negative");
+  if(interval<0)
+    throw std::runtime_error("SQUIDS::Set_AdaptiveGrid : The interval must not be negative");
+  if(max_nodes==1)
+    throw std::runtime_error("SQUIDS::Set_AdaptiveGrid : The grid needs at least two nodes");
+  grid_tolerance=tolerance;
+  grid_interval=interval;
+  grid_max_nodes=max_nodes;
+}
+
+double SQuIDS::Get_AdaptiveGridTolerance() const{
+  return grid_tolerance;
+}
+
+void SQuIDS::Set_DenseOutput(bool opt){
+  dense_output=opt;
+  if(!opt)
+    dense.clear();
+}
+
+bool SQuIDS::Get_DenseOutput() const{
+  return dense_output;
+}
+
+double SQuIDS::Get_DenseOutputStart() const{
+  return (dense.empty() ? t : dense.t0);
+}
+
+void SQuIDS::Set_InteractionPicture(bool opt){
+  interaction_picture=opt;
+  h0_cache.clear();
+}
+
+bool SQuIDS::Get_InteractionPicture() const{
+  return interaction_picture;
+}
+
+void SQuIDS::Set_StaticHI(bool opt){
+  static_hi=opt;
+  static_terms.clear();
+}
+
+bool SQuIDS::Get_StaticHI() const{
+  return static_hi;
+}
+
+void SQuIDS::Set_StaticGammaRho(bool opt){
+  static_gamma=opt;
+  static_terms.clear();
+}
+
+bool SQuIDS::Get_StaticGammaRho() const{
+  return static_gamma;
+}
+
+double SQuIDS::Get_h_last() const{
+  return h_last;
+}
+
+void SQuIDS::Set_NumThreads(unsigned int n){
+  if(n==0)
+    n=std::max(1u,std::thread::hardware_concurrency());
+  nthreads=n;
+  if(nthreads>1)
+    pool.reset(new detail::thread_pool(nthreads,thread_affinity));
+  else
+    pool.reset();
+}
+
+unsigned int SQuIDS::Get_NumThreads() const{
+  return nthreads;
+}
+
+void SQuIDS::Set_ThreadChunkSize(unsigned int n){
+  thread_chunk=n;
+}
+
+unsigned int SQuIDS::Get_ThreadChunkSize() const{
+  return thread_chunk;
+}
+
+void SQuIDS::Set_ThreadAffinity(bool opt){
+  thread_affinity=opt;
+  //the binding is done when the threads are started
+  if(pool && pool->pinned()!=thread_affinity)
+    pool.reset(new detail::thread_pool(nthreads,thread_affinity));
+}
+
+bool SQuIDS::Get_ThreadAffinity() const{
+  return thread_affinity;
+}
+
+SQuIDS::solverStats SQuIDS::GetStats() const{
+  solverStats result=stats;
+#ifdef SQUIDS_TIMERS
+  result.timed=true;
+  const double scale=1/ticks_per_second();
+  result.pre_derive_time=term_ticks[pre_derive_term]*scale;
+  result.hi_time=term_ticks[hi_term]*scale;
+  result.gamma_rho_time=term_ticks[gamma_rho_term]*scale;
+  result.interactions_rho_time=term_ticks[interactions_rho_term]*scale;
+  result.scalar_time=term_ticks[scalar_term]*scale;
+  result.nonlocal_time=term_ticks[nonlocal_term]*scale;
+#endif
+  return result;
+}
+
+void SQuIDS::ResetStats(){
+  stats=solverStats();
+  term_ticks.fill(0);
+}
+
+void SQuIDS::record_step(double hs){
+  stats.accepted_steps++;
+  stats.min_step=std::min(stats.min_step,std::abs(hs));
+}
+
+void SQuIDS::prepare_interaction_picture(){
+  h0_cache.resize(nx*nrhos);
+  for(unsigned int ei=0; ei<nx; ei++){
+    for(unsigned int i=0; i<nrhos; i++)
+      h0_cache[ei*nrhos+i]=H0(x[ei],i);
+  }
+  evolve_buffers.resize(nx*nrhos*h0_cache.front().GetEvolveBufferSize());
+  evolve_buffer_times.assign(nx,std::numeric_limits<double>::quiet_NaN());
+}
+
+const double* SQuIDS::evolve_buffer(unsigned int ix, unsigned int irho){
+  const size_t buffer_size=h0_cache.front().GetEvolveBufferSize();
+  double* node_buffers=&evolve_buffers[ix*nrhos*buffer_size];
+  //this is only ever called by the thread responsible for this node
+  if(evolve_buffer_times[ix]!=t){
+    for(unsigned int i=0; i<nrhos; i++)
+      h0_cache[ix*nrhos+i].PrepareEvolve(node_buffers+i*buffer_size,t-t_ini);
+    evolve_buffer_times[ix]=t;
+  }
+  return node_buffers+irho*buffer_size;
+}
+
+void SQuIDS::add_rho_term_block(double* block, size_t stride, const SU_vector* H, const SU_vector* G) const{
+  //iCommutator(rho,H) contributes c*rho[a]*H[b] to component k
+  if(H){
+    for(const detail::bilinear_term& term : detail::commutator_terms(nsun))
+      block[term.k*stride+term.a]+=term.c*(*H)[term.b];
+  }
+  //-ACommutator(Gamma,rho) contributes -c*Gamma[a]*rho[b] to component k
+  if(G){
+    for(const detail::bilinear_term& term : detail::anticommutator_terms(nsun))
+      block[term.k*stride+term.b]-=term.c*(*G)[term.a];
+  }
+}
+
+void SQuIDS::prepare_static_terms(){
+  static_map_coherent=use_static_hi();
+  static_map_noncoherent=use_static_gamma();
+  static_terms.resize(2*nrhos*nx,SU_vector(nsun));
+  for(unsigned int i=0; i<nrhos; i++){
+    for(unsigned int ei=0; ei<nx; ei++){
+      if(static_map_coherent)
+        static_terms[i*nx+ei]=HI(ei,i,t);
+      if(static_map_noncoherent)
+        static_terms[(nrhos+i)*nx+ei]=GammaRho(ei,i,t);
+    }
+  }
+  static_maps.clear();
+  if(nsun!=2)
+    return;
+  const size_t block_size=static_cast<size_t>(size_rho)*size_rho;
+  static_maps.assign(nx*nrhos*block_size,0.);
+  for(unsigned int ei=0; ei<nx; ei++){
+    for(unsigned int i=0; i<nrhos; i++){
+      add_rho_term_block(&static_maps[(ei*nrhos+i)*block_size],size_rho,
+                         static_map_coherent ? &static_terms[i*nx+ei] : nullptr,
+                         static_map_noncoherent ? &static_terms[(nrhos+i)*nx+ei] : nullptr);
+    }
+  }
+}
+
+void SQuIDS::prepare_kernels(){
+  auto tabulate=[this](std::vector<node_kernel>& kernels, unsigned int count, bool rho){
+    kernels.resize(count);
+    for(unsigned int k=0; k<count; k++){
+      node_kernel& kernel=kernels[k];
+      kernel.entries.resize(static_cast<size_t>(nx)*nx);
+      kernel.bounds.resize(2*nx);
+      //each row is filled by one thread, which also finds its nonzero columns
+      auto fill_rows=[&](unsigned int ix_begin, unsigned int ix_end, unsigned int){
+        for(unsigned int ix=ix_begin; ix<ix_end; ix++){
+          double* row=&kernel.entries[static_cast<size_t>(ix)*nx];
+          unsigned int first=nx, last=0;
+          for(unsigned int jx=0; jx<nx; jx++){
+            row[jx]=(rho ? RhoKernel(ix,jx,k) : ScalarKernel(ix,jx,k));
+            if(row[jx]!=0){
+              first=std::min(first,jx);
+              last=jx+1;
+            }
+          }
+          kernel.bounds[2*ix]=std::min(first,last);
+          kernel.bounds[2*ix+1]=last;
+        }
+      };
+      if(pool && nx>1)
+        pool->parallel_for(nx,node_chunk_size(),fill_rows);
+      else
+        fill_rows(0,nx,0);
+      if(kernel_tolerance>0){
+        size_t nonzero=0;
+        for(unsigned int ix=0; ix<nx; ix++)
+          nonzero+=kernel.bounds[2*ix+1]-kernel.bounds[2*ix];
+        kernel.compressed.compress(nx,kernel.entries.data(),kernel_tolerance);
+        //the approximation is only used if it saves a good part of the work
+        if(2*kernel.compressed.stored_values()<nonzero)
+          std::vector<double>().swap(kernel.entries);
+        else
+          kernel.compressed.clear();
+      }
+    }
+  };
+  if(NonLocalRhoTerms && rho_kernels.empty())
+    tabulate(rho_kernels,nrhos,true);
+  if(NonLocalScalarTerms && scalar_kernels.empty())
+    tabulate(scalar_kernels,nscalars,false);
+}
+
+void SQuIDS::add_kernel_term(const node_kernel& kernel, unsigned int ix_begin, unsigned int ix_end,
+                             unsigned int width, const double* in, double* out) const{
+  if(kernel.entries.empty())
+    kernel.compressed.apply(ix_begin,ix_end,width,in,size_state,kernel.projections.data(),out,size_state);
+  else
+    detail::kernel_product(ix_end-ix_begin,width,&kernel.entries[static_cast<size_t>(ix_begin)*nx],nx,
+                           &kernel.bounds[2*ix_begin],in,size_state,out,size_state);
+}
+
+unsigned int SQuIDS::node_chunk_size() const{
+  if(thread_chunk)
+    return thread_chunk;
+  //aim for several chunks per thread so that idle threads have work to steal
+  return std::max(1u,nx/(8*nthreads));
+}
+
+void SQuIDS::prepare_workspaces(unsigned int nworkspaces, unsigned int capacity){
+  if(workspaces.size()<nworkspaces)
+    workspaces.resize(nworkspaces);
+  for(unsigned int i=0; i<nworkspaces; i++){
+    derive_workspace& ws=workspaces[i];
+    if(ws.hi.size()<capacity){
+      ws.hi.resize(capacity,SU_vector(nsun));
+      ws.gamma.resize(capacity,SU_vector(nsun));
+      ws.interactions.resize(capacity,SU_vector(nsun));
+      ws.frame=SU_vector(nsun);
+      ws.generator=SU_vector(nsun);
+    }
+  }
+}
+
 void SQuIDS::Derive(double at){
+  DeriveRange(at,0,nx);
+}
+
+void SQuIDS::DeriveRange(double at, unsigned int ix_begin, unsigned int ix_end){
   t=at;
+  stats.rhs_calls++;
+  section_timer timer(term_ticks.data());
+  timer.enter(pre_derive_term);
   PreDerive(at);
-  for(unsigned int ei = 0; ei < nx; ei++){
-    // Density matrix
-    for(unsigned int i = 0; i < nrhos; i++){
-      // Coherent interaction
-      if(CoherentRhoTerms)
-        dstate[ei].rho[i] = iCommutator(estate[ei].rho[i],HI(ei,i,t));
-      else
+  timer.stop();
+  if(interaction_picture && h0_cache.empty())
+    prepare_interaction_picture();
+  if((use_static_hi() || use_static_gamma()) &&
+     (static_terms.empty() || static_map_coherent!=use_static_hi() || static_map_noncoherent!=use_static_gamma()))
+    prepare_static_terms();
+  if((NonLocalRhoTerms && rho_kernels.empty()) || (NonLocalScalarTerms && scalar_kernels.empty()))
+    prepare_kernels();
+  //the projections onto the compressed kernels involve all nodes, so they
+  //are computed before the nodes are divided between the threads
+  for(unsigned int i=0; i<rho_kernels.size(); i++){
+    node_kernel& kernel=rho_kernels[i];
+    if(kernel.entries.empty()){
+      kernel.projections.resize(kernel.compressed.projection_size()*size_rho);
+      kernel.compressed.project(size_rho,&estate[0].rho[i][0],size_state,kernel.projections.data());
+    }
+  }
+  for(unsigned int is=0; is<scalar_kernels.size(); is++){
+    node_kernel& kernel=scalar_kernels[is];
+    if(kernel.entries.empty()){
+      kernel.projections.resize(kernel.compressed.projection_size());
+      kernel.compressed.project(1,estate[0].scalar+is,size_state,kernel.projections.data());
+    }
+  }
+  const unsigned int count=ix_end-ix_begin;
+  if(pool && count>1){
+    unsigned int chunk=node_chunk_size();
+    prepare_workspaces(nthreads,std::min(chunk,count));
+    pool->parallel_for(count,chunk,[this,ix_begin](unsigned int b, unsigned int e, unsigned int worker){
+      DeriveNodes(ix_begin+b,ix_begin+e,workspaces[worker]);
+    });
+  }else{
+    prepare_workspaces(1,count);
+    DeriveNodes(ix_begin,ix_end,workspaces[0]);
+  }
+#ifdef SQUIDS_TIMERS
+  for(derive_workspace& ws : workspaces){
+    for(unsigned int term=0; term<timed_terms; term++){
+      term_ticks[term]+=ws.ticks[term];
+      ws.ticks[term]=0;
+    }
+  }
+#endif
+}
+
+void SQuIDS::DeriveNodes(unsigned int ix_begin, unsigned int ix_end, derive_workspace& ws){
+  //the library's own handling of the terms takes precedence over DeriveLocalTerms
+  if(interaction_picture || use_static_hi() || use_static_gamma() || !DeriveLocalTerms(ix_begin,ix_end))
+    DeriveLocalNodes(ix_begin,ix_end,ws);
+  // Non-local terms, coupling each node to all others
+  section_timer timer(ws.ticks.data());
+  if(NonLocalRhoTerms || NonLocalScalarTerms)
+    timer.enter(nonlocal_term);
+  if(NonLocalRhoTerms){
+    for(unsigned int i = 0; i < nrhos; i++)
+      add_kernel_term(rho_kernels[i],ix_begin,ix_end,size_rho,&estate[0].rho[i][0],&dstate[ix_begin].rho[i][0]);
+  }
+  if(NonLocalScalarTerms){
+    for(unsigned int is=0;is<nscalars;is++)
+      add_kernel_term(scalar_kernels[is],ix_begin,ix_end,1,estate[0].scalar+is,dstate[ix_begin].scalar+is);
+  }
+}
+
+void SQuIDS::DeriveLocalNodes(unsigned int ix_begin, unsigned int ix_end, derive_workspace& ws){
+  const bool static_coherent=use_static_hi(), static_noncoherent=use_static_gamma();
+  const bool dense_maps=(static_coherent || static_noncoherent) && !static_maps.empty();
+  const size_t block_size=static_cast<size_t>(size_rho)*size_rho;
+  section_timer timer(ws.ticks.data());
+  // Density matrix
+  for(unsigned int i = 0; i < nrhos; i++){
+    // Coherent interaction
+    timer.enter(hi_term);
+    if(static_coherent && !dense_maps)
+      DeriveBatched(ix_begin,ix_end,i,&static_terms[i*nx+ix_begin],true,ws);
+    else if(CoherentRhoTerms && !static_coherent){
+      if(HI_batch(ix_begin,ix_end,i,t,ws.hi.data()))
+        DeriveBatched(ix_begin,ix_end,i,ws.hi.data(),true,ws);
+      else{
+        for(unsigned int ei = ix_begin; ei < ix_end; ei++){
+          if(interaction_picture){
+            ws.frame = HI(ei,i,t).Evolve(evolve_buffer(ei,i));
+            dstate[ei].rho[i] = iCommutator(estate[ei].rho[i],ws.frame);
+          }else
+            dstate[ei].rho[i] = iCommutator(estate[ei].rho[i],HI(ei,i,t));
+        }
+      }
+    }else{
+      for(unsigned int ei = ix_begin; ei < ix_end; ei++)
         dstate[ei].rho[i].SetAllComponents(0.);
+    }
+    
+    // Time independent terms, applied with their precomputed maps
+    if(dense_maps){
+      for(unsigned int ei = ix_begin; ei < ix_end; ei++){
+        const double* map=&static_maps[(ei*nrhos+i)*block_size];
+        const double* rho=&estate[ei].rho[i][0];
+        double* drho=&dstate[ei].rho[i][0];
+        for(unsigned int k=0; k<size_rho; k++){
+          double sum=0;
+          for(unsigned int a=0; a<size_rho; a++)
+            sum+=map[k*size_rho+a]*rho[a];
+          drho[k]+=sum;
+        }
+      }
+    }
 
-      // Non coherent interaction
-      if(NonCoherentRhoTerms)
-        dstate[ei].rho[i] -= ACommutator(GammaRho(ei,i,t),estate[ei].rho[i]);
-      // Other possible interaction, for example involving the Scalars or non linear terms in rho.
-      if(OtherRhoTerms)
-        dstate[ei].rho[i] += InteractionsRho(ei,i,t);
+    // Non coherent interaction
+    timer.enter(gamma_rho_term);
+    if(static_noncoherent && !dense_maps)
+      DeriveBatched(ix_begin,ix_end,i,&static_terms[(nrhos+i)*nx+ix_begin],false,ws);
+    else if(NonCoherentRhoTerms && !static_noncoherent){
+      if(GammaRho_batch(ix_begin,ix_end,i,t,ws.gamma.data()))
+        DeriveBatched(ix_begin,ix_end,i,ws.gamma.data(),false,ws);
+      else{
+        for(unsigned int ei = ix_begin; ei < ix_end; ei++){
+          if(interaction_picture){
+            ws.frame = GammaRho(ei,i,t).Evolve(evolve_buffer(ei,i));
+            dstate[ei].rho[i] -= ACommutator(ws.frame,estate[ei].rho[i]);
+          }else
+            dstate[ei].rho[i] -= ACommutator(GammaRho(ei,i,t),estate[ei].rho[i]);
+        }
+      }
+    }
+    // Other possible interaction, for example involving the Scalars or non linear terms in rho.
+    timer.enter(interactions_rho_term);
+    if(OtherRhoTerms){
+      if(InteractionsRho_batch(ix_begin,ix_end,i,t,ws.interactions.data())){
+        for(unsigned int ei = ix_begin; ei < ix_end; ei++)
+          dstate[ei].rho[i] += ws.interactions[ei-ix_begin];
+      }else{
+        for(unsigned int ei = ix_begin; ei < ix_end; ei++)
+          dstate[ei].rho[i] += InteractionsRho(ei,i,t);
+      }
     }
-    //Scalars
+  }
+  //Scalars
+  timer.enter(scalar_term);
+  for(unsigned int ei = ix_begin; ei < ix_end; ei++){
     for(unsigned int is=0;is<nscalars;is++){
       dstate[ei].scalar[is]=0.;
       if(GammaScalarTerms)
@@ -506,12 +1632,831 @@ void SQuIDS::Derive(double at){
   }
 }
 
-void SQuIDS::Evolve(double dt){
-  if(AnyNumerics){
-    int gsl_status = GSL_SUCCESS;
+void SQuIDS::DeriveBatched(unsigned int ix_begin, unsigned int ix_end, unsigned int irho,
+                           const SU_vector* ops, bool coherent, derive_workspace& ws){
+  //The nodes are processed in tiles of several batches, which are small
+  //enough to keep the batch layout copies in the L1 cache.
+  const unsigned int tile=32, size=nsun*nsun;
+  const unsigned int buffer_size=(interaction_picture ? h0_cache.front().GetEvolveBufferSize() : 0);
+  ws.batch.resize((4*size+buffer_size)*tile);
+  double* rho=ws.batch.data();
+  double* op=rho+size*tile;
+  double* frame=op+size*tile;
+  double* out=frame+size*tile;
+  double* buffers=out+size*tile;
+  const double* term=(interaction_picture ? frame : op);
+  const double* src[tile];
+  double* dst[tile];
+  for(unsigned int b=ix_begin; b<ix_end; b+=tile){
+    const unsigned int count=std::min(tile,ix_end-b);
+    const unsigned int nbatches=(count+detail::batch_lanes-1)/detail::batch_lanes;
+    for(unsigned int j=0; j<count; j++)
+      src[j]=&estate[b+j].rho[irho][0];
+    detail::batch_gather(size,src,count,rho);
+    for(unsigned int j=0; j<count; j++)
+      src[j]=&ops[b-ix_begin+j][0];
+    detail::batch_gather(size,src,count,op);
+    if(interaction_picture){
+      for(unsigned int j=0; j<count; j++)
+        src[j]=evolve_buffer(b+j,irho);
+      detail::batch_gather(buffer_size,src,count,buffers);
+      detail::batch_evolve(nsun,nbatches,buffers,op,frame);
+    }
+    for(unsigned int j=0; j<count; j++)
+      dst[j]=&dstate[b+j].rho[irho][0];
+    if(coherent)
+      detail::batch_icommutator(nsun,nbatches,rho,term,out);
+    else{
+      detail::batch_gather(size,dst,count,out);
+      detail::batch_subtract_acommutator(nsun,nbatches,term,rho,out);
+    }
+    detail::batch_scatter(size,out,count,dst);
+  }
+}
 
-    // initial time
-    
+void SQuIDS::SumRho(SU_vector& result, unsigned int irho, const double* weights){
+  if(!is_init)
+    throw std::runtime_error("SQUIDS::SumRho : The system has not been initialized");
+  if(irho>=nrhos)
+    throw std::runtime_error("SQUIDS::SumRho : rho index out of range");
+  //the block size must not depend on the number of threads
+  const unsigned int block=32;
+  const unsigned int nblocks=(nx+block-1)/block;
+  reduction_partials.resize(nblocks*size_rho);
+  auto sum_blocks=[&](unsigned int b_begin, unsigned int b_end, unsigned int){
+    for(unsigned int b=b_begin; b<b_end; b++){
+      double* partial=&reduction_partials[b*size_rho];
+      std::fill(partial,partial+size_rho,0.);
+      const unsigned int e=std::min(nx,(b+1)*block);
+      for(unsigned int ei=b*block; ei<e; ei++){
+        const double* rho=&estate[ei].rho[irho][0];
+        const double w=(weights ? weights[ei] : 1.);
+        for(unsigned int k=0; k<size_rho; k++)
+          partial[k]+=w*rho[k];
+      }
+    }
+  };
+  if(pool && nblocks>1)
+    pool->parallel_for(nblocks,1,sum_blocks);
+  else
+    sum_blocks(0,nblocks,0);
+  //combine the partial sums as a binary tree, leaving the total in the first
+  for(unsigned int stride=1; stride<nblocks; stride*=2){
+    for(unsigned int b=0; b+stride<nblocks; b+=2*stride){
+      double* partial=&reduction_partials[b*size_rho];
+      const double* other=&reduction_partials[(b+stride)*size_rho];
+      for(unsigned int k=0; k<size_rho; k++)
+        partial[k]+=other[k];
+    }
+  }
+  if(result.Dim()!=nsun)
+    result=SU_vector(nsun);
+  for(unsigned int k=0; k<size_rho; k++)
+    result[k]=reduction_partials[k];
+}
+
+void SQuIDS::Jacobian(double at, double* dfdy, double* dfdt){
+  const size_t n=sys.dimension;
+  double* sp=last_estate_ptr;
+  
+  //Estimate the explicit time dependence by finite differences. The
+  //derivative at the requested time is computed last so that anything which
+  //PreDerive computes is left consistent with that time.
+  jacobian_scratch.resize(2*n);
+  double* f0=jacobian_scratch.data();
+  double* f1=f0+n;
+  const double dt=std::sqrt(std::numeric_limits<double>::epsilon())*std::max(std::abs(at),1.);
+  set_system_pointers(sp,f1);
+  Derive(at+dt);
+  set_system_pointers(sp,f0);
+  Derive(at);
+  for(size_t i=0; i<n; i++)
+    dfdt[i]=(f1[i]-f0[i])/dt;
+  
+  std::fill(dfdy,dfdy+n*n,0.0);
+  //compressed kernels enter through their approximations
+  std::vector<std::vector<double>> expansions;
+  std::vector<const double*> rho_entries, scalar_entries;
+  auto kernel_entries=[&](const node_kernel& kernel)->const double*{
+    if(!kernel.entries.empty())
+      return kernel.entries.data();
+    expansions.emplace_back(static_cast<size_t>(nx)*nx);
+    kernel.compressed.expand(expansions.back().data());
+    return expansions.back().data();
+  };
+  for(const node_kernel& kernel : rho_kernels)
+    rho_entries.push_back(kernel_entries(kernel));
+  for(const node_kernel& kernel : scalar_kernels)
+    scalar_entries.push_back(kernel_entries(kernel));
+  //Each node only writes the rows which belong to it
+  auto fill_nodes=[&](unsigned int ix_begin, unsigned int ix_end, unsigned int worker){
+    derive_workspace& ws=workspaces[worker];
+    for(unsigned int i=0; i<nrhos; i++){
+      if(CoherentRhoTerms){
+        bool batched=HI_batch(ix_begin,ix_end,i,t,ws.hi.data());
+        for(unsigned int ei=ix_begin; ei<ix_end; ei++){
+          if(!batched)
+            ws.hi[ei-ix_begin]=HI(ei,i,t);
+          if(interaction_picture){
+            ws.frame=ws.hi[ei-ix_begin].Evolve(evolve_buffer(ei,i));
+            ws.hi[ei-ix_begin]=ws.frame;
+          }
+          add_rho_term_block(dfdy+Get_StateIndex(ei,i,0)*n+Get_StateIndex(ei,i,0),n,&ws.hi[ei-ix_begin],nullptr);
+        }
+      }
+      if(NonCoherentRhoTerms){
+        bool batched=GammaRho_batch(ix_begin,ix_end,i,t,ws.gamma.data());
+        for(unsigned int ei=ix_begin; ei<ix_end; ei++){
+          if(!batched)
+            ws.gamma[ei-ix_begin]=GammaRho(ei,i,t);
+          if(interaction_picture){
+            ws.frame=ws.gamma[ei-ix_begin].Evolve(evolve_buffer(ei,i));
+            ws.gamma[ei-ix_begin]=ws.frame;
+          }
+          add_rho_term_block(dfdy+Get_StateIndex(ei,i,0)*n+Get_StateIndex(ei,i,0),n,nullptr,&ws.gamma[ei-ix_begin]);
+        }
+      }
+      //the non-local terms couple each component to the same component of other nodes
+      if(NonLocalRhoTerms){
+        const node_kernel& kernel=rho_kernels[i];
+        for(unsigned int ei=ix_begin; ei<ix_end; ei++){
+          for(unsigned int ej=kernel.bounds[2*ei]; ej<kernel.bounds[2*ei+1]; ej++){
+            const double entry=rho_entries[i][static_cast<size_t>(ei)*nx+ej];
+            for(unsigned int k=0; k<size_rho; k++)
+              dfdy[Get_StateIndex(ei,i,k)*n+Get_StateIndex(ej,i,k)]+=entry;
+          }
+        }
+      }
+    }
+    if(GammaScalarTerms){
+      for(unsigned int ei=ix_begin; ei<ix_end; ei++){
+        for(unsigned int is=0; is<nscalars; is++){
+          size_t idx=Get_ScalarIndex(ei,is);
+          dfdy[idx*n+idx]=-GammaScalar(ei,is,t);
+        }
+      }
+    }
+    if(NonLocalScalarTerms){
+      for(unsigned int is=0; is<nscalars; is++){
+        const node_kernel& kernel=scalar_kernels[is];
+        for(unsigned int ei=ix_begin; ei<ix_end; ei++){
+          for(unsigned int ej=kernel.bounds[2*ei]; ej<kernel.bounds[2*ei+1]; ej++)
+            dfdy[Get_ScalarIndex(ei,is)*n+Get_ScalarIndex(ej,is)]+=scalar_entries[is][static_cast<size_t>(ei)*nx+ej];
+        }
+      }
+    }
+  };
+  if(pool && nx>1){
+    unsigned int chunk=node_chunk_size();
+    prepare_workspaces(nthreads,std::min(chunk,nx));
+    pool->parallel_for(nx,chunk,fill_nodes);
+  }else{
+    prepare_workspaces(1,nx);
+    fill_nodes(0,nx,0);
+  }
+  
+  if(OtherRhoTerms || OtherScalarTerms)
+    InteractionsJacobian(t,dfdy);
+}
+
+double SQuIDS::InitialStepSize(double dt, unsigned int order){
+  const size_t n=sys.dimension;
+  const double* y0=system.get();
+  //Derive updates t, so it must be restored afterwards
+  const double t0=t;
+  std::vector<double> f0(n), y1(n), f1(n);
+  RHS(t0,y0,f0.data(),this);
+  //RMS norms weighted by the tolerance for each component
+  double d0=0, d1=0;
+  for(size_t i=0; i<n; i++){
+    double sc=abs_error+std::abs(y0[i])*rel_error;
+    d0+=(y0[i]/sc)*(y0[i]/sc);
+    d1+=(f0[i]/sc)*(f0[i]/sc);
+  }
+  d0=std::sqrt(d0/n);
+  d1=std::sqrt(d1/n);
+  double h0=(d0<1e-5 || d1<1e-5) ? 1e-6 : 0.01*d0/d1;
+  h0=std::min(h0,std::abs(dt));
+  //take an explicit Euler step to estimate the second derivative
+  const double dir=(dt<0?-1:1);
+  for(size_t i=0; i<n; i++)
+    y1[i]=y0[i]+dir*h0*f0[i];
+  RHS(t0+dir*h0,y1.data(),f1.data(),this);
+  t=t0;
+  double d2=0;
+  for(size_t i=0; i<n; i++){
+    double sc=abs_error+std::abs(y0[i])*rel_error;
+    d2+=((f1[i]-f0[i])/sc)*((f1[i]-f0[i])/sc);
+  }
+  d2=std::sqrt(d2/n)/h0;
+  double dmax=std::max(d1,d2);
+  double h1=(dmax<=1e-15) ? std::max(1e-6,h0*1e-3) : std::pow(0.01/dmax,1./(order+1));
+  return std::min(std::min(100*h0,h1),std::abs(dt));
+}
+
+int SQuIDS::EvolvePersistent(double dt){
+  if(!driver){
+    driver.reset(gsl_odeiv2_driver_alloc_y_new(&sys,step,h,abs_error,rel_error));
+    h_last=0;
+  }
+  //the state may have been changed since the last call, so any history kept
+  //by the stepper cannot be trusted
+  gsl_odeiv2_driver_reset(driver.get());
+  
+  double* gsl_sys = system.get();
+  const double t1=t+dt;
+  const double dir=(dt<0?-1:1);
+  
+  if(!adaptive_step){
+    for(unsigned int i=0; i<nsteps; i++){
+      int status=gsl_odeiv2_evolve_apply_fixed_step(driver->e,driver->c,driver->s,&sys,&t,dt/nsteps,gsl_sys);
+      if(status!=GSL_SUCCESS)
+        return status;
+      record_step(dt/nsteps);
+    }
+    return GSL_SUCCESS;
+  }
+  
+  double hs;
+  if(h_last!=0)
+    hs=h_last;
+  else if(h_set)
+    hs=h;
+  else
+    hs=InitialStepSize(dt,gsl_odeiv2_step_order(driver->s));
+  hs=dir*std::min(std::max(std::abs(hs),h_min),h_max);
+  
+  while(t!=t1){
+    const double h_prev=hs, t_prev=t;
+    const unsigned long failed=driver->e->failed_steps;
+    int status=gsl_odeiv2_evolve_apply(driver->e,driver->c,driver->s,&sys,&t,t1,&hs,gsl_sys);
+    stats.rejected_steps+=driver->e->failed_steps-failed;
+    if(status!=GSL_SUCCESS)
+      return status;
+    record_step(t-t_prev);
+    //The step which reaches the end of the interval is usually cut short,
+    //and the step size suggested after it is based on that shortened step.
+    //Unless the step had to be retried, keep the longer step for next time.
+    if(t==t1 && driver->e->failed_steps==failed && std::abs(hs)<std::abs(h_prev))
+      hs=h_prev;
+    if(std::abs(hs)>h_max)
+      hs=dir*h_max;
+    if(std::abs(hs)<h_min && t!=t1)
+      return GSL_ENOPROG;
+  }
+  h_last=std::abs(hs);
+  return GSL_SUCCESS;
+}
+
+template<typename Attempt, typename Accept>
+bool SQuIDS::AdaptiveSteps(double dt, unsigned int order, unsigned int error_order,
+                           double& h_carried, Attempt attempt, Accept accept){
+  detail::step_controller control(error_order);
+  const double t1=t+dt;
+  const double dir=(dt<0?-1:1);
+  double hs;
+  if(h_carried!=0)
+    hs=h_carried;
+  else if(h_set)
+    hs=h;
+  else
+    hs=InitialStepSize(dt,order);
+  hs=dir*std::min(std::max(std::abs(hs),h_min),h_max);
+  
+  double tc=t;
+  while(tc!=t1){
+    //do not step past the end of the interval
+    const bool last=(dir*(tc+hs-t1)>=0);
+    const double h_step=(last ? t1-tc : hs);
+    double factor;
+    if(control.judge(attempt(tc,h_step),factor)){
+      accept();
+      record_step(h_step);
+      tc=(last ? t1 : tc+h_step);
+      //like the GSL path, keep the full step when the last one was cut short
+      if(!(last && std::abs(h_step)<std::abs(hs)))
+        hs=h_step*factor;
+    }else{
+      stats.rejected_steps++;
+      hs=h_step*factor;
+    }
+    if(std::abs(hs)>h_max)
+      hs=dir*h_max;
+    if(tc!=t1 && (std::abs(hs)<h_min || tc+hs==tc)){
+      t=tc;
+      return false;
+    }
+  }
+  h_carried=std::abs(hs);
+  t=t1;
+  return true;
+}
+
+template<typename Tableau>
+void SQuIDS::EvolveRK(double dt){
+  const size_t n=sys.dimension;
+  rk_work.resize(n,Tableau::stages);
+  auto derivative=[this](double at, const double* y, double* dydt){ RHS(at,y,dydt,this); };
+  //the new state is written to the other buffer, and the two are swapped
+  //when a step is accepted, so the state is never copied between steps
+  double* y=system.get();
+  double* y_new=rk_work.y_new.data();
+  bool first_stage_valid=false;
+  bool success=true;
+  //the start and size of the last step, for dense output
+  double step_t=t, step_h=0;
+  
+  if(!adaptive_step){
+    const double t0=t, hs=dt/nsteps;
+    for(unsigned int i=0; i<nsteps; i++){
+      detail::rk_step<Tableau>(derivative,t0+i*hs,hs,0,n,y,y_new,rk_work,first_stage_valid,false,abs_error,rel_error);
+      record_step(hs);
+      std::swap(y,y_new);
+      if(Tableau::fsal)
+        std::swap(rk_work.k.front(),rk_work.k.back());
+      first_stage_valid=Tableau::fsal;
+      if(schedule)
+        ObserveStep<Tableau>(t0+i*hs,hs,y_new);
+    }
+    t=t0+dt;
+    if(nsteps>0){
+      step_t=t0+(nsteps-1)*hs;
+      step_h=hs;
+    }
+  }else{
+    double try_t=t, try_h=0;
+    success=AdaptiveSteps(dt,Tableau::order,Tableau::error_order,h_last,
+      [&](double at, double hs){
+        double err=detail::rk_step<Tableau>(derivative,at,hs,0,n,y,y_new,rk_work,first_stage_valid,true,abs_error,rel_error);
+        //k[0] holds the derivative at the start of the step until it is accepted
+        first_stage_valid=true;
+        try_t=at;
+        try_h=hs;
+        return err;
+      },
+      [&](){
+        std::swap(y,y_new);
+        if(Tableau::fsal)
+          std::swap(rk_work.k.front(),rk_work.k.back());
+        else
+          first_stage_valid=false;
+        step_t=try_t;
+        step_h=try_h;
+        if(schedule)
+          ObserveStep<Tableau>(step_t,step_h,y_new);
+      });
+  }
+  //the interpolant may have been built for a schedule of output times, in
+  //which case the stages may no longer be available
+  const bool dense_current=(!dense.empty() && dense.t0==step_t && dense.h==step_h);
+  if(!dense_output)
+    dense.clear();
+  else if(success && step_h!=0 && !dense_current){
+    //y_new still holds the state at the start of the last step, and the
+    //stages are in order apart from the swap made for reuse
+    const double* k[Tableau::stages];
+    for(unsigned int i=0; i<Tableau::stages; i++)
+      k[i]=rk_work.k[i];
+    if(Tableau::fsal)
+      std::swap(k[0],k[Tableau::stages-1]);
+    if(!detail::rk_continuous_extension<Tableau>(dense,step_t,step_h,n,y_new,k)){
+      const double t_end=t;
+      double* f1=rk_work.y_stage.data();
+      RHS(step_t+step_h,y,f1,this);
+      t=t_end;
+      detail::hermite_dense_output(dense,step_t,step_h,n,y_new,y,k[0],f1);
+    }
+  }
+  if(y!=system.get())
+    std::copy(y,y+n,system.get());
+  if(!success)
+    throw std::runtime_error("SQUIDS::Evolve: step size became too small");
+}
+
+double SQuIDS::stateView::GetExpectationValue(SU_vector op, unsigned int irho, unsigned int ix) const{
+  SU_vector h0=sys->H0(sys->x[ix],irho);
+  return states[ix].rho[irho]*op.Evolve(h0,t-sys->t_ini);
+}
+
+struct SQuIDS::output_schedule{
+  const SQuIDS* owner;
+  const std::vector<double>& times;
+  const observerFunction& observer;
+  ///+1 when evolving forward, -1 when evolving backward
+  double dir;
+  ///the index of the next output time
+  size_t next;
+  
+  //When the observer runs on its own thread, copies of the states are passed
+  //to it through a small set of snapshots which are reused.
+  struct snapshot{
+    double t;
+    std::unique_ptr<double[]> data;
+    std::unique_ptr<SU_state[]> states;
+  };
+  std::vector<snapshot> snapshots;
+  ///indices of snapshots waiting for the observer, and of unused snapshots
+  std::deque<size_t> ready, unused;
+  std::mutex mut;
+  std::condition_variable cond;
+  bool finished;
+  std::exception_ptr error;
+  std::thread worker;
+  
+  output_schedule(const SQuIDS* owner, const std::vector<double>& times,
+                  const observerFunction& observer, double dir, bool threaded):
+  owner(owner),times(times),observer(observer),dir(dir),next(0),finished(false){
+    if(!threaded)
+      return;
+    const size_t size=owner->nx*owner->size_state;
+    snapshots.resize(4);
+    for(size_t j=0; j<snapshots.size(); j++){
+      snapshot& snap=snapshots[j];
+      snap.data.reset(new double[size]);
+      snap.states.reset(new SU_state[owner->nx]);
+      for(unsigned int ei = 0; ei < owner->nx; ei++){
+        snap.states[ei].rho.reset(new SU_vector[owner->nrhos]);
+        for(unsigned int i=0;i<owner->nrhos;i++)
+          snap.states[ei].rho[i]=SU_vector(owner->nsun,&(snap.data[ei*owner->size_state+i*owner->size_rho]));
+        snap.states[ei].scalar=&(snap.data[ei*owner->size_state+owner->nrhos*owner->size_rho]);
+      }
+      unused.push_back(j);
+    }
+    worker=std::thread(&output_schedule::observe,this);
+  }
+  
+  ~output_schedule(){
+    if(worker.joinable()){
+      {
+        std::lock_guard<std::mutex> lock(mut);
+        finished=true;
+      }
+      cond.notify_all();
+      worker.join();
+    }
+  }
+  
+  ///Whether the next output time is reached at time at
+  bool due(double at) const{
+    return(next<times.size() && dir*(times[next]-at)<=0);
+  }
+  
+  ///Passes the state at the next output time to the observer
+  ///\param at the time of the state
+  ///\param data the state, laid out like the system
+  ///\param states views of data
+  void deliver(double at, const double* data, const SU_state* states){
+    next++;
+    if(!worker.joinable()){
+      observer(stateView(owner,states,at));
+      return;
+    }
+    size_t j;
+    {
+      std::unique_lock<std::mutex> lock(mut);
+      cond.wait(lock,[this]{ return(!unused.empty() || error); });
+      if(error)
+        std::rethrow_exception(error);
+      j=unused.front();
+      unused.pop_front();
+    }
+    snapshots[j].t=at;
+    std::copy(data,data+owner->nx*owner->size_state,snapshots[j].data.get());
+    {
+      std::lock_guard<std::mutex> lock(mut);
+      ready.push_back(j);
+    }
+    cond.notify_all();
+  }
+  
+  ///Waits for the observer to handle all states, and rethrows its exception if it failed
+  void finish(){
+    if(!worker.joinable())
+      return;
+    {
+      std::lock_guard<std::mutex> lock(mut);
+      finished=true;
+    }
+    cond.notify_all();
+    worker.join();
+    if(error)
+      std::rethrow_exception(error);
+  }
+  
+  ///The body of the observer thread
+  void observe(){
+    while(true){
+      size_t j;
+      {
+        std::unique_lock<std::mutex> lock(mut);
+        cond.wait(lock,[this]{ return(!ready.empty() || finished); });
+        if(ready.empty())
+          return;
+        j=ready.front();
+        ready.pop_front();
+      }
+      try{
+        observer(stateView(owner,snapshots[j].states.get(),snapshots[j].t));
+      }catch(...){
+        {
+          std::lock_guard<std::mutex> lock(mut);
+          error=std::current_exception();
+        }
+        cond.notify_all();
+        return;
+      }
+      {
+        std::lock_guard<std::mutex> lock(mut);
+        unused.push_back(j);
+      }
+      cond.notify_all();
+    }
+  }
+};
+
+template<typename Tableau>
+void SQuIDS::ObserveStep(double step_t, double step_h, const double* y0){
+  if(!schedule->due(step_t+step_h))
+    return;
+  const size_t n=sys.dimension;
+  const double* k[Tableau::stages];
+  for(unsigned int i=0; i<Tableau::stages; i++)
+    k[i]=rk_work.k[i];
+  if(Tableau::fsal)
+    std::swap(k[0],k[Tableau::stages-1]);
+  //Evolve only sets a schedule for methods with a continuous extension
+  detail::rk_continuous_extension<Tableau>(dense,step_t,step_h,n,y0,k);
+  prepare_dense_state();
+  while(schedule->due(step_t+step_h)){
+    const double at=schedule->times[schedule->next];
+    dense.evaluate(at,0,n,dense_system.get());
+    schedule->deliver(at,dense_system.get(),dense_state.get());
+  }
+}
+
+template<typename NodeFunction>
+void SQuIDS::ForNodeRanges(NodeFunction f){
+  if(pool && nx>1){
+    unsigned int chunk=node_chunk_size();
+    prepare_workspaces(nthreads,std::min(chunk,nx));
+    pool->parallel_for(nx,chunk,[&](unsigned int ix_begin, unsigned int ix_end, unsigned int worker){
+      f(ix_begin,ix_end,workspaces[worker]);
+    });
+  }else{
+    prepare_workspaces(1,nx);
+    f(0,nx,workspaces[0]);
+  }
+}
+
+void SQuIDS::SampleHamiltonian(double at, std::vector<SU_vector>& out){
+  t=at;
+  PreDerive(at);
+  if(interaction_picture && h0_cache.empty())
+    prepare_interaction_picture();
+  out.resize(nx*nrhos,SU_vector(nsun));
+  ForNodeRanges([&](unsigned int ix_begin, unsigned int ix_end, derive_workspace& ws){
+    for(unsigned int i = 0; i < nrhos; i++){
+      bool batched=HI_batch(ix_begin,ix_end,i,at,ws.hi.data());
+      for(unsigned int ei = ix_begin; ei < ix_end; ei++){
+        SU_vector& H=out[ei*nrhos+i];
+        if(batched)
+          H=ws.hi[ei-ix_begin];
+        else
+          H=HI(ei,i,at);
+        //HI is given in the frame of H0, so the total Hamiltonian is needed
+        if(interaction_picture)
+          H+=h0_cache[ei*nrhos+i];
+      }
+    }
+  });
+}
+
+void SQuIDS::MagnusStep(double t0, double hs, const double* y_in, double* y_out){
+  //estate is read by HI and by the transformation, and the result is written through dstate
+  set_system_pointers(const_cast<double*>(y_in),y_out);
+  //the Hamiltonian is sampled at the Gauss-Legendre points of the step
+  const double c=std::sqrt(3.)/6;
+  SampleHamiltonian(t0+(0.5-c)*hs,magnus_h1);
+  SampleHamiltonian(t0+(0.5+c)*hs,magnus_h2);
+  const double commutator_weight=std::sqrt(3.)*hs*hs/12;
+  ForNodeRanges([&](unsigned int ix_begin, unsigned int ix_end, derive_workspace& ws){
+    SQUIDS_THREAD_LOCAL math_detail::gsl_matrix_complex_holder generator_matrix;
+    SQUIDS_THREAD_LOCAL math_detail::gsl_matrix_complex_holder propagator;
+    generator_matrix.reset(nsun,nsun);
+    propagator.reset(nsun,nsun);
+    for(unsigned int ei = ix_begin; ei < ix_end; ei++){
+      for(unsigned int i = 0; i < nrhos; i++){
+        const SU_vector& H1=magnus_h1[ei*nrhos+i];
+        const SU_vector& H2=magnus_h2[ei*nrhos+i];
+        //the fourth order Magnus expansion of the Hamiltonian over the step
+        ws.generator=iCommutator(H1,H2);
+        ws.generator*=commutator_weight;
+        ws.generator+=(0.5*hs)*H1;
+        ws.generator+=(0.5*hs)*H2;
+        ws.generator.GetGSLMatrix(generator_matrix);
+        math_detail::unitary_exponential(propagator,generator_matrix,1.);
+        if(interaction_picture){
+          //move to the frame in which the Hamiltonian was sampled and back
+          ws.frame=estate[ei].rho[i].Evolve(h0_cache[ei*nrhos+i],t_ini-t0);
+          ws.frame=ws.frame.UTransform(propagator);
+          dstate[ei].rho[i]=ws.frame.Evolve(h0_cache[ei*nrhos+i],t0+hs-t_ini);
+        }else
+          dstate[ei].rho[i]=estate[ei].rho[i].UTransform(propagator);
+      }
+      for(unsigned int is = 0; is < nscalars; is++)
+        dstate[ei].scalar[is]=estate[ei].scalar[is];
+    }
+  });
+}
+
+void SQuIDS::EvolveMagnus(double dt){
+  if(NonCoherentRhoTerms || OtherRhoTerms || GammaScalarTerms || OtherScalarTerms || NonLocalRhoTerms || NonLocalScalarTerms)
+    throw std::runtime_error("SQUIDS::Evolve : The Magnus integrator only supports coherent terms");
+  const size_t n=sys.dimension;
+  magnus_buffers.resize(3*n);
+  double* y=system.get();
+  double* full=magnus_buffers.data();
+  double* mid=full+n;
+  double* half=mid+n;
+  bool success=true;
+  
+  if(!adaptive_step){
+    const double t0=t, hs=dt/nsteps;
+    for(unsigned int i=0; i<nsteps; i++){
+      MagnusStep(t0+i*hs,hs,y,full);
+      record_step(hs);
+      std::swap(y,full);
+    }
+    t=t0+dt;
+  }else{
+    //estimate the error by comparing one step with two steps of half the size
+    const double e[2]={1./15,-1./15};
+    success=AdaptiveSteps(dt,4,4,h_last,
+      [&](double at, double hs){
+        MagnusStep(at,hs,y,full);
+        MagnusStep(at,hs/2,y,mid);
+        MagnusStep(at+hs/2,hs/2,mid,half);
+        const double* k[2]={half,full};
+        return detail::rk_error_norm(n,y,half,1.,e,k,2,abs_error,rel_error);
+      },
+      [&](){ std::swap(y,half); });
+  }
+  if(y!=system.get())
+    std::copy(y,y+n,system.get());
+  if(!success)
+    throw std::runtime_error("SQUIDS::Evolve: step size became too small");
+}
+
+void SQuIDS::ClassifyNodes(unsigned int order){
+  const size_t n=sys.dimension;
+  const double* y0=system.get();
+  //Derive updates t, so it must be restored afterwards
+  const double t0=t;
+  std::vector<double> f0(n), y1(n), f1(n);
+  RHS(t0,y0,f0.data(),this);
+  //estimate the step size each node needs, as InitialStepSize does for the
+  //whole system, but using a common probe step
+  std::vector<double> d0(nx,0), d1(nx,0), d2(nx,0);
+  for(unsigned int ei=0; ei<nx; ei++){
+    for(size_t i=ei*size_state; i<(ei+1)*size_state; i++){
+      double sc=abs_error+std::abs(y0[i])*rel_error;
+      d0[ei]+=(y0[i]/sc)*(y0[i]/sc);
+      d1[ei]+=(f0[i]/sc)*(f0[i]/sc);
+    }
+    d0[ei]=std::sqrt(d0[ei]/size_state);
+    d1[ei]=std::sqrt(d1[ei]/size_state);
+  }
+  double h0=std::numeric_limits<double>::max();
+  for(unsigned int ei=0; ei<nx; ei++)
+    h0=std::min(h0,(d0[ei]<1e-5 || d1[ei]<1e-5) ? 1e-6 : 0.01*d0[ei]/d1[ei]);
+  for(size_t i=0; i<n; i++)
+    y1[i]=y0[i]+h0*f0[i];
+  RHS(t0+h0,y1.data(),f1.data(),this);
+  t=t0;
+  std::vector<double> node_h(nx);
+  for(unsigned int ei=0; ei<nx; ei++){
+    for(size_t i=ei*size_state; i<(ei+1)*size_state; i++){
+      double sc=abs_error+std::abs(y0[i])*rel_error;
+      d2[ei]+=((f1[i]-f0[i])/sc)*((f1[i]-f0[i])/sc);
+    }
+    d2[ei]=std::sqrt(d2[ei]/size_state)/h0;
+    double dmax=std::max(d1[ei],d2[ei]);
+    node_h[ei]=(dmax<=1e-15) ? std::max(1e-6,h0*1e-3) : std::pow(0.01/dmax,1./(order+1));
+  }
+  
+  //divide the logarithmic range of step sizes into equal bins, and make a
+  //group of each run of consecutive nodes in the same bin
+  const double h_lo=*std::min_element(node_h.begin(),node_h.end());
+  const double h_hi=*std::max_element(node_h.begin(),node_h.end());
+  const double range=std::log(h_hi/h_lo);
+  auto level=[&](unsigned int ei)->unsigned int{
+    //differences of less than a factor of two are not worth separating
+    if(range<std::log(2.))
+      return 0;
+    return std::min(multirate_levels-1,(unsigned int)(multirate_levels*std::log(node_h[ei]/h_lo)/range));
+  };
+  multirate_groups.assign(1,0);
+  multirate_h.clear();
+  double group_h=node_h[0];
+  for(unsigned int ei=1; ei<nx; ei++){
+    if(level(ei)!=level(ei-1)){
+      multirate_groups.push_back(ei);
+      multirate_h.push_back(group_h);
+      group_h=node_h[ei];
+    }else
+      group_h=std::min(group_h,node_h[ei]);
+  }
+  multirate_groups.push_back(nx);
+  multirate_h.push_back(group_h);
+  if(h_set){
+    for(double& hg : multirate_h)
+      hg=h;
+  }
+}
+
+template<typename Tableau>
+void SQuIDS::EvolveMultiRate(double dt){
+  if(!adaptive_step){
+    EvolveRK<Tableau>(dt);
+    return;
+  }
+  const size_t n=sys.dimension;
+  if(multirate_groups.empty())
+    ClassifyNodes(Tableau::order);
+  rk_work.resize(n,Tableau::stages);
+  multirate_buffers.resize(2*n);
+  double* frozen=multirate_buffers.data();
+  double* y_a=frozen+n;
+  double* y_b=rk_work.y_new.data();
+  double* y_stage=rk_work.y_stage.data();
+  const unsigned int nsync=(multirate_sync>0 ? std::max(1.,std::ceil(std::abs(dt)/multirate_sync)) : 1);
+  const double hsync=dt/nsync;
+  const double t0=t;
+  
+  for(unsigned int k=0; k<nsync; k++){
+    const double tk=t0+k*hsync;
+    //the groups exchange their states only here
+    std::copy(system.get(),system.get()+n,frozen);
+    for(unsigned int g=0; g+1<multirate_groups.size(); g++){
+      const unsigned int ix_begin=multirate_groups[g], ix_end=multirate_groups[g+1];
+      const size_t offset=ix_begin*size_state, len=(ix_end-ix_begin)*size_state;
+      //while this group is stepped the others keep their synchronized state
+      std::copy(frozen,frozen+n,y_a);
+      std::copy(frozen,frozen+n,y_b);
+      std::copy(frozen,frozen+n,y_stage);
+      double* y=y_a;
+      double* y_new=y_b;
+      auto derivative=[&](double at, const double* ys, double* dydt){
+        set_system_pointers(const_cast<double*>(ys),dydt);
+        DeriveRange(at,ix_begin,ix_end);
+      };
+      bool first_stage_valid=false;
+      t=tk;
+      bool success=AdaptiveSteps(hsync,Tableau::order,Tableau::error_order,multirate_h[g],
+        [&](double at, double hs){
+          double err=detail::rk_step<Tableau>(derivative,at,hs,offset,len,y,y_new,rk_work,first_stage_valid,true,abs_error,rel_error);
+          first_stage_valid=true;
+          return err;
+        },
+        [&](){
+          std::swap(y,y_new);
+          if(Tableau::fsal)
+            std::swap(rk_work.k.front(),rk_work.k.back());
+          else
+            first_stage_valid=false;
+        });
+      std::copy(y+offset,y+offset+len,system.get()+offset);
+      if(!success)
+        throw std::runtime_error("SQUIDS::Evolve: step size became too small");
+    }
+  }
+  t=t0+dt;
+  //the smallest step of any group, for consistency with the other integrators
+  h_last=*std::min_element(multirate_h.begin(),multirate_h.end());
+}
+
+void SQuIDS::Integrate(double dt){
+  if(multirate_levels>1){
+    switch(method){
+      case integrator::dormand_prince_54: EvolveMultiRate<detail::dormand_prince_54>(dt); return;
+      case integrator::tsitouras_54: EvolveMultiRate<detail::tsitouras_54>(dt); return;
+      case integrator::verner_65: EvolveMultiRate<detail::verner_65>(dt); return;
+      default:
+        throw std::runtime_error("SQUIDS::Evolve : Multi-rate stepping requires a native Runge-Kutta integrator");
+    }
+  }
+  switch(method){
+    case integrator::dormand_prince_54: EvolveRK<detail::dormand_prince_54>(dt); return;
+    case integrator::tsitouras_54: EvolveRK<detail::tsitouras_54>(dt); return;
+    case integrator::verner_65: EvolveRK<detail::verner_65>(dt); return;
+    case integrator::magnus_4: EvolveMagnus(dt); return;
+    case integrator::gsl: break;
+  }
+  
+  int gsl_status = GSL_SUCCESS;
+  if(persistent_driver)
+    gsl_status = EvolvePersistent(dt);
+  else{
     // ODE system error control
     gsl_odeiv2_driver* d = gsl_odeiv2_driver_alloc_y_new(&sys,step,h,abs_error,rel_error);
     gsl_odeiv2_driver_set_hmin(d,h_min);
@@ -524,13 +2469,81 @@ void SQuIDS::Evolve(double dt){
       gsl_status = gsl_odeiv2_driver_apply(d, &t, t+dt, gsl_sys);
     }else{
       gsl_status = gsl_odeiv2_driver_apply_fixed_step(d, &t, dt/nsteps , nsteps , gsl_sys);
+      if(nsteps>0)
+        stats.min_step=std::min(stats.min_step,std::abs(dt/nsteps));
     }
+    //the driver only counts the steps
+    stats.accepted_steps+=d->e->count;
+    stats.rejected_steps+=d->e->failed_steps;
     
     gsl_odeiv2_driver_free(d);
-    if( gsl_status != GSL_SUCCESS ){
-      throw std::runtime_error("SQUIDS::Evolve: Error in GSL ODE solver ("
-                               +std::string(gsl_strerror(gsl_status))+")");
+  }
+  if( gsl_status != GSL_SUCCESS ){
+    throw std::runtime_error("SQUIDS::Evolve: Error in GSL ODE solver ("
+                             +std::string(gsl_strerror(gsl_status))+")");
+  }
+}
+
+void SQuIDS::EvolveSplit(double dt){
+  if(method==integrator::magnus_4)
+    throw std::runtime_error("SQUIDS::Evolve : The Magnus integrator cannot integrate the non-coherent part of a split step");
+  const bool other_terms=(NonCoherentRhoTerms || OtherRhoTerms || GammaScalarTerms || OtherScalarTerms
+                          || NonLocalRhoTerms || NonLocalScalarTerms);
+  const size_t n=sys.dimension;
+  magnus_buffers.resize(3*n);
+  double* y=system.get();
+  double* coherent=magnus_buffers.data();
+  const unsigned int nsplit=std::max(1.,std::ceil(std::abs(dt)/split_step));
+  const double hs=dt/nsplit;
+  const double t0=t;
+  
+  for(unsigned int k=0; k<nsplit; k++){
+    const double tk=t0+k*hs;
+    //Strang splitting: half a step of the coherent evolution, a full step of
+    //everything else, and another half step of the coherent evolution
+    MagnusStep(tk,hs/2,y,coherent);
+    std::copy(coherent,coherent+n,y);
+    if(other_terms){
+      t=tk;
+      CoherentRhoTerms=false;
+      try{
+        Integrate(hs);
+      }catch(...){
+        CoherentRhoTerms=true;
+        dense.clear();
+        throw;
+      }
+      CoherentRhoTerms=true;
+      //an interpolant left by Integrate covers only part of the split step
+      dense.clear();
     }
+    MagnusStep(tk+hs/2,hs/2,y,coherent);
+    std::copy(coherent,coherent+n,y);
+  }
+  t=t0+dt;
+}
+
+void SQuIDS::Evolve(double dt){
+  if(grid_tolerance<=0){
+    EvolveFixedGrid(dt);
+    return;
+  }
+  const unsigned int nintervals=(grid_interval>0 ? std::max(1.,std::ceil(std::abs(dt)/grid_interval)) : 1);
+  const double t0=t;
+  for(unsigned int k=0; k<nintervals; k++){
+    const double t_end=(k+1==nintervals ? t0+dt : t0+(k+1)*(dt/nintervals));
+    EvolveFixedGrid(t_end-t);
+    AdaptGrid();
+  }
+}
+
+void SQuIDS::EvolveFixedGrid(double dt){
+  dense.clear();
+  if(AnyNumerics){
+    if(split_step>0 && CoherentRhoTerms)
+      EvolveSplit(dt);
+    else
+      Integrate(dt);
     
     //after evolving, make estate alias state again
     for(unsigned int ei = 0; ei < nx; ei++){
@@ -539,10 +2552,360 @@ void SQuIDS::Evolve(double dt){
       if(nscalars>0)
         estate[ei].scalar=&(system[ei*size_state+nrhos*size_rho]);
     }
+    //the integration buffers may be reused by the next evolution, so make sure
+    //that set_system_pointers does not mistake them for the current backing store
+    last_estate_ptr=system.get();
   }else{
     t+=dt;
     PreDerive(t);
   }
+  update_slopes();
+}
+
+void SQuIDS::Evolve(const std::vector<double>& times, const observerFunction& observer, bool threaded){
+  if(times.empty())
+    return;
+  const double dir=(times.back()<t ? -1 : 1);
+  double previous=t;
+  for(double at : times){
+    if(dir*(at-previous)<0)
+      throw std::runtime_error("SQUIDS::Evolve : Output times must be ordered in the direction of the evolution");
+    previous=at;
+  }
+  
+  output_schedule sched(this,times,observer,dir,threaded);
+  //output times at the current time need no evolution
+  while(sched.due(t))
+    sched.deliver(times[sched.next],system.get(),state.get());
+  
+  //Verner's method has no continuous extension of its own, and the cubic
+  //Hermite interpolant used for its dense output is much less accurate than
+  //its steps, so its steps are clipped at the output times instead
+  const bool continuous=(method==integrator::dormand_prince_54 || method==integrator::tsitouras_54);
+  if(AnyNumerics && continuous && multirate_levels<=1 && !(split_step>0 && CoherentRhoTerms)){
+    //a single sweep, with EvolveRK passing the output times to ObserveStep
+    schedule=&sched;
+    try{
+      EvolveFixedGrid(times.back()-t);
+    }catch(...){
+      schedule=nullptr;
+      throw;
+    }
+    schedule=nullptr;
+  }else{
+    const bool persistent=persistent_driver;
+    persistent_driver=true;
+    try{
+      while(sched.next<times.size()){
+        EvolveFixedGrid(times[sched.next]-t);
+        sched.deliver(times[sched.next],system.get(),state.get());
+      }
+    }catch(...){
+      persistent_driver=persistent;
+      if(!persistent)
+        driver.reset();
+      throw;
+    }
+    persistent_driver=persistent;
+    if(!persistent)
+      driver.reset();
+  }
+  //the end of the sweep may differ from the last output times by rounding
+  while(sched.next<times.size())
+    sched.deliver(times[sched.next],system.get(),state.get());
+  sched.finish();
+}
+
+namespace{
+  ///The fixed part at the start of a checkpoint file
+  struct checkpoint_header{
+    char magic[8];
+    uint32_t version;
+    ///written as 0x01020304, to detect files from machines with another byte order
+    uint32_t byte_order;
+    uint32_t header_size;
+    uint32_t nx, nsun, nrhos, nscalars;
+    uint32_t flags;
+    uint32_t method;
+    ///the index of the GSL stepper in checkpoint_steppers, or unknown_stepper
+    uint32_t gsl_step;
+    uint32_t nsteps;
+    uint32_t multirate_levels;
+    uint32_t grid_max_nodes;
+    ///the number of nodes set with Set_xrange, which the adaptive grid keeps
+    uint32_t grid_base_size;
+    uint32_t interpolation;
+    double t, t_ini;
+    double rel_error, abs_error, h, h_min, h_max, h_last;
+    double split_step, multirate_sync;
+    double grid_tolerance, grid_interval;
+    double kernel_tolerance;
+    uint64_t x_offset, mixing_offset, grid_base_offset, state_offset, file_size;
+  };
+  
+  const char checkpoint_magic[8]={'S','Q','u','I','D','S','c','k'};
+  const uint32_t checkpoint_version=2;
+  const uint32_t checkpoint_byte_order=0x01020304;
+  const uint32_t unknown_stepper=~0u;
+  
+  enum checkpoint_flags{
+    coherent_rho_terms=1<<0, noncoherent_rho_terms=1<<1, other_rho_terms=1<<2,
+    gamma_scalar_terms=1<<3, other_scalar_terms=1<<4, any_numerics=1<<5,
+    adaptive_step_flag=1<<6, h_set_flag=1<<7, persistent_driver_flag=1<<8,
+    interaction_picture_flag=1<<9, dense_output_flag=1<<10,
+    static_hi_flag=1<<11, static_gamma_flag=1<<12,
+    nonlocal_rho_terms=1<<13, nonlocal_scalar_terms=1<<14
+  };
+  
+  ///The GSL steppers which can be recorded in a checkpoint, in a fixed order
+  std::vector<const gsl_odeiv2_step_type*> checkpoint_steppers(){
+    return {gsl_odeiv2_step_rk2, gsl_odeiv2_step_rk4, gsl_odeiv2_step_rkf45,
+      gsl_odeiv2_step_rkck, gsl_odeiv2_step_rk8pd, gsl_odeiv2_step_rk1imp,
+      gsl_odeiv2_step_rk2imp, gsl_odeiv2_step_rk4imp, gsl_odeiv2_step_bsimp,
+      gsl_odeiv2_step_msadams, gsl_odeiv2_step_msbdf};
+  }
+  
+  ///Sections of the file start at multiples of this many bytes
+  const uint64_t checkpoint_alignment=64;
+  uint64_t align_offset(uint64_t offset){
+    return (offset+checkpoint_alignment-1)/checkpoint_alignment*checkpoint_alignment;
+  }
+  
+  ///The contents of a file, mapped into memory where possible
+  class mapped_file{
+  public:
+    explicit mapped_file(const std::string& path):data(nullptr),size(0){
+#ifdef SQUIDS_USE_MMAP
+      int fd=open(path.c_str(),O_RDONLY);
+      if(fd<0)
+        throw std::runtime_error("SQUIDS::LoadCheckpoint : Unable to open "+path);
+      struct stat info;
+      if(fstat(fd,&info)!=0){
+        close(fd);
+        throw std::runtime_error("SQUIDS::LoadCheckpoint : Unable to read "+path);
+      }
+      size=info.st_size;
+      if(size>0){
+        void* mem=mmap(nullptr,size,PROT_READ,MAP_PRIVATE,fd,0);
+        if(mem==MAP_FAILED){
+          close(fd);
+          throw std::runtime_error("SQUIDS::LoadCheckpoint : Unable to map "+path);
+        }
+        data=static_cast<const char*>(mem);
+      }
+      close(fd);
+#else
+      std::ifstream file(path,std::ios::binary);
+      if(!file)
+        throw std::runtime_error("SQUIDS::LoadCheckpoint : Unable to open "+path);
+      contents.assign(std::istreambuf_iterator<char>(file),std::istreambuf_iterator<char>());
+      data=contents.data();
+      size=contents.size();
+#endif
+    }
+    ~mapped_file(){
+#ifdef SQUIDS_USE_MMAP
+      if(data)
+        munmap(const_cast<char*>(data),size);
+#endif
+    }
+    mapped_file(const mapped_file&)=delete;
+    mapped_file& operator=(const mapped_file&)=delete;
+    const char* data;
+    size_t size;
+  private:
+#ifndef SQUIDS_USE_MMAP
+    std::vector<char> contents;
+#endif
+  };
+}
+
+void SQuIDS::SaveCheckpoint(const std::string& path) const{
+  checkpoint_header header;
+  std::memset(&header,0,sizeof(header));
+  std::memcpy(header.magic,checkpoint_magic,sizeof(header.magic));
+  header.version=checkpoint_version;
+  header.byte_order=checkpoint_byte_order;
+  header.header_size=sizeof(checkpoint_header);
+  header.nx=nx;
+  header.nsun=nsun;
+  header.nrhos=nrhos;
+  header.nscalars=nscalars;
+  header.flags=(CoherentRhoTerms ? coherent_rho_terms : 0)
+    | (NonCoherentRhoTerms ? noncoherent_rho_terms : 0)
+    | (OtherRhoTerms ? other_rho_terms : 0)
+    | (GammaScalarTerms ? gamma_scalar_terms : 0)
+    | (OtherScalarTerms ? other_scalar_terms : 0)
+    | (AnyNumerics ? any_numerics : 0)
+    | (adaptive_step ? adaptive_step_flag : 0)
+    | (h_set ? h_set_flag : 0)
+    | (persistent_driver ? persistent_driver_flag : 0)
+    | (interaction_picture ? interaction_picture_flag : 0)
+    | (dense_output ? dense_output_flag : 0)
+    | (static_hi ? static_hi_flag : 0)
+    | (static_gamma ? static_gamma_flag : 0)
+    | (NonLocalRhoTerms ? nonlocal_rho_terms : 0)
+    | (NonLocalScalarTerms ? nonlocal_scalar_terms : 0);
+  header.method=static_cast<uint32_t>(method);
+  const std::vector<const gsl_odeiv2_step_type*> steppers=checkpoint_steppers();
+  auto stepper=std::find(steppers.begin(),steppers.end(),step);
+  header.gsl_step=(stepper==steppers.end() ? unknown_stepper : std::distance(steppers.begin(),stepper));
+  header.nsteps=nsteps;
+  header.multirate_levels=multirate_levels;
+  header.t=t;
+  header.t_ini=t_ini;
+  header.rel_error=rel_error;
+  header.abs_error=abs_error;
+  header.h=h;
+  header.h_min=h_min;
+  header.h_max=h_max;
+  header.h_last=h_last;
+  header.split_step=split_step;
+  header.multirate_sync=multirate_sync;
+  header.grid_tolerance=grid_tolerance;
+  header.grid_interval=grid_interval;
+  header.grid_max_nodes=grid_max_nodes;
+  header.grid_base_size=grid_base.size();
+  header.interpolation=static_cast<uint32_t>(x_interpolation);
+  header.kernel_tolerance=kernel_tolerance;
+  
+  //the upper triangles of the angles and phases, followed by the energy differences
+  std::vector<double> mixing;
+  for(unsigned int i=0; i<nsun; i++){
+    for(unsigned int j=i+1; j<nsun; j++)
+      mixing.push_back(params.GetMixingAngle(i,j));
+  }
+  for(unsigned int i=0; i<nsun; i++){
+    for(unsigned int j=i+1; j<nsun; j++)
+      mixing.push_back(params.GetPhase(i,j));
+  }
+  for(unsigned int i=1; i<nsun; i++)
+    mixing.push_back(params.GetEnergyDifference(i));
+  
+  const uint64_t state_size=uint64_t(nx)*size_state*sizeof(double);
+  header.x_offset=align_offset(sizeof(checkpoint_header));
+  header.mixing_offset=align_offset(header.x_offset+nx*sizeof(double));
+  header.grid_base_offset=align_offset(header.mixing_offset+mixing.size()*sizeof(double));
+  header.state_offset=align_offset(header.grid_base_offset+grid_base.size()*sizeof(double));
+  header.file_size=header.state_offset+state_size;
+  
+  std::ofstream file(path,std::ios::binary|std::ios::trunc);
+  if(!file)
+    throw std::runtime_error("SQUIDS::SaveCheckpoint : Unable to open "+path);
+  const char padding[checkpoint_alignment]={};
+  auto write_section=[&](uint64_t offset, const void* data, uint64_t size){
+    file.write(padding,offset-file.tellp());
+    file.write(static_cast<const char*>(data),size);
+  };
+  file.write(reinterpret_cast<const char*>(&header),sizeof(header));
+  write_section(header.x_offset,x.data(),nx*sizeof(double));
+  write_section(header.mixing_offset,mixing.data(),mixing.size()*sizeof(double));
+  write_section(header.grid_base_offset,grid_base.data(),grid_base.size()*sizeof(double));
+  write_section(header.state_offset,system.get(),state_size);
+  if(!file)
+    throw std::runtime_error("SQUIDS::SaveCheckpoint : Error writing "+path);
+}
+
+void SQuIDS::LoadCheckpoint(const std::string& path){
+  mapped_file file(path);
+  checkpoint_header header;
+  if(file.size<sizeof(header))
+    throw std::runtime_error("SQUIDS::LoadCheckpoint : "+path+" is not a checkpoint file");
+  std::memcpy(&header,file.data,sizeof(header));
+  if(std::memcmp(header.magic,checkpoint_magic,sizeof(header.magic))!=0)
+    throw std::runtime_error("SQUIDS::LoadCheckpoint : "+path+" is not a checkpoint file");
+  if(header.byte_order!=checkpoint_byte_order)
+    throw std::runtime_error("SQUIDS::LoadCheckpoint : "+path+" was written with a different byte order");
+  if(header.version!=checkpoint_version || header.header_size!=sizeof(checkpoint_header))
+    throw std::runtime_error("SQUIDS::LoadCheckpoint : "+path+" has unsupported format version "+std::to_string(header.version));
+  if(header.nsun==0 || header.nsun>SQUIDS_MAX_HILBERT_DIM)
+    throw std::runtime_error("SQUIDS::LoadCheckpoint : "+path+" has an invalid dimension");
+  const uint64_t state_size=uint64_t(header.nx)*(header.nsun*header.nsun*header.nrhos+header.nscalars)*sizeof(double);
+  const uint64_t mixing_size=(header.nsun*(header.nsun-1)+header.nsun-1)*sizeof(double);
+  if(header.file_size>file.size
+     || header.x_offset+header.nx*sizeof(double)>header.mixing_offset
+     || header.mixing_offset+mixing_size>header.grid_base_offset
+     || header.grid_base_size>header.nx
+     || header.grid_base_offset+header.grid_base_size*sizeof(double)>header.state_offset
+     || header.state_offset+state_size!=header.file_size)
+    throw std::runtime_error("SQUIDS::LoadCheckpoint : "+path+" is truncated or corrupt");
+  if(header.method>static_cast<uint32_t>(integrator::magnus_4))
+    throw std::runtime_error("SQUIDS::LoadCheckpoint : "+path+" uses an unknown integrator");
+  const std::vector<const gsl_odeiv2_step_type*> steppers=checkpoint_steppers();
+  if(header.gsl_step!=unknown_stepper && header.gsl_step>=steppers.size())
+    throw std::runtime_error("SQUIDS::LoadCheckpoint : "+path+" uses an unknown GSL stepper");
+  if(header.interpolation>static_cast<uint32_t>(interpolation::monotone_cubic))
+    throw std::runtime_error("SQUIDS::LoadCheckpoint : "+path+" uses an unknown interpolation");
+  
+  if(!is_init || header.nx!=nx || header.nsun!=nsun || header.nrhos!=nrhos || header.nscalars!=nscalars)
+    ini(header.nx,header.nsun,header.nrhos,header.nscalars,header.t_ini);
+  t_ini=header.t_ini;
+  t=header.t;
+  
+  const double* xs=reinterpret_cast<const double*>(file.data+header.x_offset);
+  Set_xrange(std::vector<double>(xs,xs+nx));
+  //the nodes may have been adapted, so the base nodes are restored separately
+  const double* base=reinterpret_cast<const double*>(file.data+header.grid_base_offset);
+  grid_base.assign(base,base+header.grid_base_size);
+  
+  const double* mixing=reinterpret_cast<const double*>(file.data+header.mixing_offset);
+  for(unsigned int i=0; i<nsun; i++){
+    for(unsigned int j=i+1; j<nsun; j++)
+      params.SetMixingAngle(i,j,*mixing++);
+  }
+  for(unsigned int i=0; i<nsun; i++){
+    for(unsigned int j=i+1; j<nsun; j++)
+      params.SetPhase(i,j,*mixing++);
+  }
+  for(unsigned int i=1; i<nsun; i++)
+    params.SetEnergyDifference(i,*mixing++);
+  
+  CoherentRhoTerms=(header.flags & coherent_rho_terms);
+  NonCoherentRhoTerms=(header.flags & noncoherent_rho_terms);
+  OtherRhoTerms=(header.flags & other_rho_terms);
+  GammaScalarTerms=(header.flags & gamma_scalar_terms);
+  OtherScalarTerms=(header.flags & other_scalar_terms);
+  AnyNumerics=(header.flags & any_numerics);
+  adaptive_step=(header.flags & adaptive_step_flag);
+  h_set=(header.flags & h_set_flag);
+  persistent_driver=(header.flags & persistent_driver_flag);
+  interaction_picture=(header.flags & interaction_picture_flag);
+  dense_output=(header.flags & dense_output_flag);
+  static_hi=(header.flags & static_hi_flag);
+  static_gamma=(header.flags & static_gamma_flag);
+  NonLocalRhoTerms=(header.flags & nonlocal_rho_terms);
+  NonLocalScalarTerms=(header.flags & nonlocal_scalar_terms);
+  method=static_cast<integrator>(header.method);
+  //a stepper supplied by the user cannot be recorded, so the current one is kept
+  if(header.gsl_step!=unknown_stepper)
+    step=steppers[header.gsl_step];
+  nsteps=header.nsteps;
+  rel_error=header.rel_error;
+  abs_error=header.abs_error;
+  h=header.h;
+  h_min=header.h_min;
+  h_max=header.h_max;
+  split_step=header.split_step;
+  multirate_levels=header.multirate_levels;
+  multirate_sync=header.multirate_sync;
+  grid_tolerance=header.grid_tolerance;
+  grid_interval=header.grid_interval;
+  grid_max_nodes=header.grid_max_nodes;
+  x_interpolation=static_cast<interpolation>(header.interpolation);
+  kernel_tolerance=header.kernel_tolerance;
+  
+  //anything derived from the previous state or settings is stale
+  driver.reset();
+  h0_cache.clear();
+  static_terms.clear();
+  rho_kernels.clear();
+  scalar_kernels.clear();
+  multirate_groups.clear();
+  dense.clear();
+  h_last=header.h_last;
+  
+  std::memcpy(system.get(),file.data+header.state_offset,state_size);
+  update_slopes();
 }
 
 int RHS(double t, const double* state_dbl_in, double* state_dbl_out, void* par){
@@ -551,5 +2914,12 @@ int RHS(double t, const double* state_dbl_in, double* state_dbl_out, void* par){
   dms->Derive(t);
   return 0;
 }
+
+int JAC(double t, const double* state_dbl_in, double* dfdy, double* dfdt, void* par){
+  SQuIDS* dms=static_cast<SQuIDS*>(par);
+  dms->set_system_pointers(const_cast<double*>(state_dbl_in),dms->last_dstate_ptr);
+  dms->Jacobian(t,dfdy,dfdt);
+  return 0;
+}
   
 } //namespace squids
@@ -0,0 +1,52 @@
+#include "SQuIDS/detail/StructureConstants.h"
+#include "SQuIDS/SUNalg.h"
+
+namespace squids{
+namespace detail{
+
+namespace{
+  template<typename Op>
+  std::vector<bilinear_term> tabulate(unsigned int dim, Op op){
+    std::vector<bilinear_term> terms;
+    const unsigned int size=dim*dim;
+    for(unsigned int a=0; a<size; a++){
+      SU_vector ga=SU_vector::Generator(dim,a);
+      for(unsigned int b=0; b<size; b++){
+        SU_vector r=op(ga,SU_vector::Generator(dim,b));
+        for(unsigned int k=0; k<size; k++){
+          if(r[k]!=0)
+            terms.push_back(bilinear_term{(unsigned char)a,(unsigned char)b,(unsigned char)k,r[k]});
+        }
+      }
+    }
+    return(terms);
+  }
+  
+  struct term_tables{
+    std::vector<bilinear_term> commutator[SQUIDS_MAX_HILBERT_DIM+1];
+    std::vector<bilinear_term> anticommutator[SQUIDS_MAX_HILBERT_DIM+1];
+    term_tables(){
+      for(unsigned int dim=2; dim<=SQUIDS_MAX_HILBERT_DIM; dim++){
+        commutator[dim]=tabulate(dim,[](const SU_vector& u, const SU_vector& v){ return(SU_vector(iCommutator(u,v))); });
+        anticommutator[dim]=tabulate(dim,[](const SU_vector& u, const SU_vector& v){ return(SU_vector(ACommutator(u,v))); });
+      }
+    }
+  };
+  
+  const term_tables& tables(){
+    //initialization of function-local statics is thread safe
+    static const term_tables t;
+    return(t);
+  }
+}
+
+const std::vector<bilinear_term>& commutator_terms(unsigned int dim){
+  return(tables().commutator[dim]);
+}
+
+const std::vector<bilinear_term>& anticommutator_terms(unsigned int dim){
+  return(tables().anticommutator[dim]);
+}
+
+} //namespace detail
+} //namespace squids
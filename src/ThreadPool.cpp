@@ -0,0 +1,147 @@
+#include "SQuIDS/detail/ThreadPool.h"
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace squids{
+namespace detail{
+
+namespace{
+  void pin_thread(std::thread& th, unsigned int core){
+#if defined(__linux__)
+    unsigned int ncores=std::thread::hardware_concurrency();
+    if(ncores==0)
+      return;
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(core%ncores,&cpus);
+    //failure to set the affinity is not an error, it only costs performance
+    pthread_setaffinity_np(th.native_handle(),sizeof(cpu_set_t),&cpus);
+#endif
+  }
+}
+
+thread_pool::thread_pool(unsigned int n, bool p):
+nthreads(n>0?n:1),
+pin(p),
+shares(new share[nthreads]),
+generation(0),
+active(0),
+stopping(false),
+job(nullptr),
+job_chunk(1),
+failed(false)
+{
+  for(unsigned int i=0; i<nthreads; i++){
+    shares[i].next.store(0);
+    shares[i].end=0;
+  }
+  workers.reserve(nthreads-1);
+  for(unsigned int i=1; i<nthreads; i++){
+    workers.emplace_back(&thread_pool::worker_main,this,i);
+    if(pin)
+      pin_thread(workers.back(),i);
+  }
+}
+
+thread_pool::~thread_pool(){
+  {
+    std::lock_guard<std::mutex> lock(mut);
+    stopping=true;
+  }
+  start_cond.notify_all();
+  for(auto& worker : workers)
+    worker.join();
+}
+
+void thread_pool::worker_main(unsigned int index){
+  unsigned long seen=0;
+  while(true){
+    {
+      std::unique_lock<std::mutex> lock(mut);
+      start_cond.wait(lock,[&]{ return(stopping || generation!=seen); });
+      if(stopping)
+        return;
+      seen=generation;
+    }
+    run(index);
+    {
+      std::lock_guard<std::mutex> lock(mut);
+      if(--active==0)
+        done_cond.notify_one();
+    }
+  }
+}
+
+bool thread_pool::claim(unsigned int s, unsigned int& begin, unsigned int& end){
+  share& sh=shares[s];
+  //cheap check first to avoid hammering exhausted shares
+  if(sh.next.load(std::memory_order_relaxed)>=sh.end)
+    return(false);
+  begin=sh.next.fetch_add(job_chunk,std::memory_order_relaxed);
+  if(begin>=sh.end)
+    return(false);
+  end=(sh.end-begin>job_chunk ? begin+job_chunk : sh.end);
+  return(true);
+}
+
+void thread_pool::run(unsigned int index){
+  unsigned int begin, end;
+  try{
+    //first drain our own share, then go looking for work in the others
+    for(unsigned int i=0; i<nthreads; i++){
+      unsigned int s=(index+i)%nthreads;
+      while(!failed.load(std::memory_order_relaxed) && claim(s,begin,end))
+        (*job)(begin,end,index);
+    }
+  }catch(...){
+    std::lock_guard<std::mutex> lock(mut);
+    if(!failed.exchange(true))
+      error=std::current_exception();
+  }
+}
+
+void thread_pool::parallel_for(unsigned int n, unsigned int chunk, const chunk_function& f){
+  if(n==0)
+    return;
+  if(chunk==0)
+    chunk=1;
+  //if there is nothing to share, skip the synchronization entirely
+  if(nthreads==1 || n<=chunk){
+    f(0,n,0);
+    return;
+  }
+  unsigned int per_thread=n/nthreads, extra=n%nthreads, start=0;
+  for(unsigned int i=0; i<nthreads; i++){
+    unsigned int len=per_thread+(i<extra?1:0);
+    shares[i].next.store(start,std::memory_order_relaxed);
+    shares[i].end=start+len;
+    start+=len;
+  }
+  job=&f;
+  job_chunk=chunk;
+  failed.store(false);
+  error=nullptr;
+  {
+    std::lock_guard<std::mutex> lock(mut);
+    active=nthreads-1;
+    generation++;
+  }
+  start_cond.notify_all();
+  run(0);
+  {
+    std::unique_lock<std::mutex> lock(mut);
+    done_cond.wait(lock,[&]{ return(active==0); });
+  }
+  job=nullptr;
+  if(error){
+    std::exception_ptr e=error;
+    error=nullptr;
+    std::rethrow_exception(e);
+  }
+}
+
+} //namespace detail
+} //namespace squids
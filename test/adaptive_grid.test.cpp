@@ -0,0 +1,125 @@
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+#include <SQuIDS/SQuIDS.h>
+
+using squids::SU_vector;
+using squids::integrator;
+
+//A two level system which precesses much faster in a narrow range of x, so
+//that the states of neighbouring nodes there drift apart as it evolves
+class resonance : public squids::SQuIDS{
+	SU_vector B;
+	//the frequency at each node, recomputed when the grid changes
+	std::vector<double> frequency;
+public:
+	unsigned int grid_changes;
+	resonance(unsigned int nx):
+	SQuIDS(nx,2,1,1,0.),
+	B(SU_vector::Generator(2,1)),
+	grid_changes(0){
+		Set_xrange(0.,10.,"lin");
+		Set_CoherentRhoTerms(true);
+		Set_GammaScalarTerms(true);
+		Set_Integrator(integrator::tsitouras_54);
+		Set_rel_error(1e-10);
+		Set_abs_error(1e-10);
+		for(unsigned int ix=0; ix<nx; ix++){
+			state[ix].rho[0]=SU_vector::Projector(2,0);
+			state[ix].scalar[0]=1.;
+		}
+		GridChanged();
+		grid_changes=0;
+	}
+	void GridChanged(){
+		frequency.resize(nx);
+		for(unsigned int ix=0; ix<nx; ix++)
+			frequency[ix]=1.+std::exp(-std::pow((Get_x(ix)-5.)/0.3,2));
+		grid_changes++;
+	}
+	SU_vector HI(unsigned int ix, unsigned int irho, double t) const{
+		return(frequency[ix]*B);
+	}
+	double GammaScalar(unsigned int ix, unsigned int is, double t) const{
+		return(0.1);
+	}
+	const SU_vector& Rho(unsigned int ix) const{ return(state[ix].rho[0]); }
+	double Scalar(unsigned int ix) const{ return(state[ix].scalar[0]); }
+};
+
+int main(){
+	const double duration=3.;
+	resonance reference(4001);
+	reference.Evolve(duration);
+
+	resonance adaptive(41);
+	adaptive.Set_AdaptiveGrid(0.05,0.05);
+	if(adaptive.Get_AdaptiveGridTolerance()!=0.05)
+		std::cout << "Tolerance not stored" << std::endl;
+	adaptive.Evolve(duration);
+	if(adaptive.Get_t()!=duration)
+		std::cout << "Evolved to " << adaptive.Get_t() << " instead of " << duration << std::endl;
+	if(adaptive.grid_changes==0)
+		std::cout << "GridChanged was not called" << std::endl;
+	const std::vector<double>& xs=adaptive.Get_xrange();
+	if(xs.size()!=adaptive.Get_nx() || xs.front()!=0. || xs.back()!=10.)
+		std::cout << "The ends of the grid moved" << std::endl;
+	//the nodes gather around the resonance, and are removed elsewhere
+	unsigned int near=0;
+	for(unsigned int ix=0; ix<xs.size(); ix++){
+		if(ix>0 && !(xs[ix]>xs[ix-1]))
+			std::cout << "Nodes " << ix-1 << " and " << ix << " are not increasing" << std::endl;
+		if(std::abs(xs[ix]-5.)<1.)
+			near++;
+	}
+	if(xs.size()>400 || 2*near<xs.size())
+		std::cout << "Unexpected grid: " << xs.size() << " nodes, " << near << " near the resonance" << std::endl;
+	for(unsigned int ix=0; ix+1<xs.size(); ix++){
+		SU_vector d=adaptive.Rho(ix)-adaptive.Rho(ix+1);
+		if(std::sqrt(d*d)>0.2)
+			std::cout << "Nodes " << ix << " and " << ix+1 << " differ by " << std::sqrt(d*d) << std::endl;
+	}
+	//the interpolated state is about as accurate as the tolerance, and much
+	//more accurate than with the same number of evenly spaced nodes
+	const SU_vector op=SU_vector::Generator(2,3);
+	resonance uniform(adaptive.Get_nx());
+	uniform.Evolve(duration);
+	double largest=0, largest_uniform=0;
+	for(double x=0; x<=10.; x+=0.01){
+		double expected=reference.GetExpectationValueD(op,0,x);
+		largest=std::max(largest,std::abs(adaptive.GetExpectationValueD(op,0,x)-expected));
+		largest_uniform=std::max(largest_uniform,std::abs(uniform.GetExpectationValueD(op,0,x)-expected));
+	}
+	if(largest>0.02 || largest*2>largest_uniform)
+		std::cout << "Interpolated expectation values differ by up to " << largest
+		<< ", and by up to " << largest_uniform << " for a uniform grid" << std::endl;
+	for(unsigned int ix=0; ix<xs.size(); ix++){
+		if(std::abs(adaptive.Scalar(ix)-std::exp(-0.1*duration))>1e-8)
+			std::cout << "Scalar at node " << ix << " is " << adaptive.Scalar(ix) << std::endl;
+	}
+
+	//the number of nodes is limited, and AdaptGrid can be used directly
+	resonance limited(41);
+	limited.Evolve(duration);
+	if(limited.AdaptGrid())
+		std::cout << "A fixed grid was adapted" << std::endl;
+	limited.Set_AdaptiveGrid(0.001,0,60);
+	while(limited.AdaptGrid()){
+		if(limited.Get_nx()>60){
+			std::cout << "The grid grew to " << limited.Get_nx() << " nodes" << std::endl;
+			break;
+		}
+	}
+	limited.Evolve(0.5);
+	if(limited.Get_nx()>60)
+		std::cout << "The grid grew to " << limited.Get_nx() << " nodes" << std::endl;
+
+	try{
+		limited.Set_AdaptiveGrid(-1.);
+		std::cout << "Negative tolerance accepted" << std::endl;
+	}catch(std::runtime_error&){}
+	try{
+		limited.Set_AdaptiveGrid(0.1,-1.);
+		std::cout << "Negative interval accepted" << std::endl;
+	}catch(std::runtime_error&){}
+}
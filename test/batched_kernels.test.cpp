@@ -0,0 +1,170 @@
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+#include <SQuIDS/SQuIDS.h>
+#include <SQuIDS/detail/BatchKernels.h>
+
+using squids::SU_vector;
+using squids::detail::batch_lanes;
+
+SU_vector random_vector(unsigned int dim, std::mt19937& rng){
+	std::uniform_real_distribution<double> dist(-1.,1.);
+	SU_vector v(dim);
+	for(unsigned int k=0; k<dim*dim; k++)
+		v[k]=dist(rng);
+	return(v);
+}
+
+//Compares the batched kernels to the SU_vector operations, which they must
+//reproduce exactly
+void check_kernels(unsigned int dim, unsigned int count, std::mt19937& rng){
+	const unsigned int size=dim*dim;
+	const unsigned int nbatches=(count+batch_lanes-1)/batch_lanes;
+	const unsigned int lanes=nbatches*batch_lanes;
+	std::vector<SU_vector> u, v, d, op;
+	for(unsigned int j=0; j<count; j++){
+		u.push_back(random_vector(dim,rng));
+		v.push_back(random_vector(dim,rng));
+		d.push_back(random_vector(dim,rng));
+		SU_vector h(dim);
+		for(unsigned int i=0; i<dim; i++)
+			h+=(1.+i+0.1*j)*SU_vector::Projector(dim,i);
+		op.push_back(h);
+	}
+	const size_t buffer_size=op.front().GetEvolveBufferSize();
+	std::vector<double> buffers(count*buffer_size);
+	for(unsigned int j=0; j<count; j++)
+		op[j].PrepareEvolve(&buffers[j*buffer_size],0.7+0.3*j);
+
+	std::vector<const double*> src(count);
+	std::vector<double> bu(size*lanes), bv(size*lanes), bd(size*lanes);
+	std::vector<double> bb(buffer_size*lanes), out(size*lanes);
+	for(unsigned int j=0; j<count; j++)
+		src[j]=&u[j][0];
+	squids::detail::batch_gather(size,src.data(),count,bu.data());
+	for(unsigned int j=0; j<count; j++)
+		src[j]=&v[j][0];
+	squids::detail::batch_gather(size,src.data(),count,bv.data());
+	for(unsigned int j=0; j<count; j++)
+		src[j]=&d[j][0];
+	squids::detail::batch_gather(size,src.data(),count,bd.data());
+	for(unsigned int j=0; j<count; j++)
+		src[j]=&buffers[j*buffer_size];
+	squids::detail::batch_gather(buffer_size,src.data(),count,bb.data());
+
+	auto compare=[&](const char* name, unsigned int j, const SU_vector& expected, const std::vector<double>& result){
+		const double* r=&result[(j/batch_lanes)*size*batch_lanes+j%batch_lanes];
+		for(unsigned int k=0; k<size; k++){
+			if(r[k*batch_lanes]!=expected[k]){
+				std::cout << name << " differs for dimension " << dim << ", node " << j << " of "
+				<< count << ", component " << k << ": " << r[k*batch_lanes]
+				<< " != " << expected[k] << std::endl;
+				return;
+			}
+		}
+	};
+
+	squids::detail::batch_icommutator(dim,nbatches,bu.data(),bv.data(),out.data());
+	for(unsigned int j=0; j<count; j++)
+		compare("iCommutator",j,iCommutator(u[j],v[j]),out);
+
+	out=bd;
+	squids::detail::batch_subtract_acommutator(dim,nbatches,bu.data(),bv.data(),out.data());
+	for(unsigned int j=0; j<count; j++){
+		SU_vector expected=d[j];
+		expected-=ACommutator(u[j],v[j]);
+		compare("ACommutator",j,expected,out);
+	}
+
+	squids::detail::batch_evolve(dim,nbatches,bb.data(),bu.data(),out.data());
+	for(unsigned int j=0; j<count; j++)
+		compare("Evolve",j,u[j].Evolve(&buffers[j*buffer_size]),out);
+
+	//results are only written for the requested lanes
+	std::vector<double> target(count*size,0.), expected(count*size,0.);
+	std::vector<double*> dst(count);
+	for(unsigned int j=0; j<count; j++){
+		dst[j]=&target[j*size];
+		for(unsigned int k=0; k<size; k++)
+			expected[j*size+k]=u[j][k];
+	}
+	squids::detail::batch_scatter(size,bu.data(),count,dst.data());
+	if(target!=expected)
+		std::cout << "Scattering " << count << " vectors of dimension " << dim << " failed" << std::endl;
+}
+
+//A system driven in the interaction picture, computing its terms one node at a time
+class pernode_system : public squids::SQuIDS{
+protected:
+	SU_vector drive, damping;
+public:
+	pernode_system(unsigned int nx):
+	SQuIDS(nx,3,2,0,0.),
+	drive(SU_vector::Generator(3,1)+0.3*SU_vector::Generator(3,5)+0.2*SU_vector::Generator(3,6)),
+	damping(0.01*SU_vector::Generator(3,0)+0.004*SU_vector::Generator(3,2)){
+		Set_xrange(1.,3.,"lin");
+		Set_CoherentRhoTerms(true);
+		Set_NonCoherentRhoTerms(true);
+		Set_InteractionPicture(true);
+		Set_rel_error(1e-8);
+		Set_abs_error(1e-8);
+		for(unsigned int ix=0; ix<nx; ix++){
+			state[ix].rho[0]=SU_vector::Projector(3,0);
+			state[ix].rho[1]=SU_vector::Projector(3,2);
+		}
+	}
+	SU_vector H0(double x, unsigned int irho) const{
+		SU_vector h=SU_vector::Projector(3,1)+2.5*SU_vector::Projector(3,2);
+		h*=x;
+		return(irho==0 ? h : -1.*h);
+	}
+	SU_vector HI(unsigned int ix, unsigned int irho, double t) const{
+		return((0.4*std::cos(Get_x(ix)*t))*drive);
+	}
+	SU_vector GammaRho(unsigned int ix, unsigned int irho, double t) const{
+		return(damping);
+	}
+};
+
+//The same system, computing its terms in batches
+class batched_system : public pernode_system{
+public:
+	batched_system(unsigned int nx):pernode_system(nx){}
+	bool HI_batch(unsigned int ix_begin, unsigned int ix_end, unsigned int irho, double t, SU_vector* out) const{
+		for(unsigned int ix=ix_begin; ix<ix_end; ix++)
+			out[ix-ix_begin]=(0.4*std::cos(Get_x(ix)*t))*drive;
+		return(true);
+	}
+	bool GammaRho_batch(unsigned int ix_begin, unsigned int ix_end, unsigned int irho, double t, SU_vector* out) const{
+		for(unsigned int ix=ix_begin; ix<ix_end; ix++)
+			out[ix-ix_begin]=damping;
+		return(true);
+	}
+};
+
+int main(){
+	std::mt19937 rng(17);
+	for(unsigned int dim=2; dim<=SQUIDS_MAX_HILBERT_DIM; dim++){
+		for(unsigned int count=1; count<=3*batch_lanes; count++)
+			check_kernels(dim,count,rng);
+	}
+
+	//a number of nodes which fills neither the last tile nor the last batch
+	const unsigned int nx=45;
+	pernode_system a(nx);
+	batched_system b(nx);
+	a.Evolve(2.);
+	b.Evolve(2.);
+	for(unsigned int ix=0; ix<nx; ix++){
+		for(unsigned int irho=0; irho<2; irho++){
+			for(unsigned int j=0; j<9; j++){
+				double va=a.GetExpectationValue(SU_vector::Generator(3,j),irho,ix);
+				double vb=b.GetExpectationValue(SU_vector::Generator(3,j),irho,ix);
+				if(va!=vb)
+					std::cout << "Mismatch at node " << ix << " rho " << irho << " component "
+					<< j << ": " << va << " != " << vb << std::endl;
+			}
+		}
+	}
+}
@@ -0,0 +1,95 @@
+#include <cmath>
+#include <iostream>
+#include <SQuIDS/SQuIDS.h>
+#include "alloc_counting.h"
+
+using squids::SU_vector;
+
+//A system which computes its terms one node at a time
+class pernode_system : public squids::SQuIDS{
+protected:
+	SU_vector b1, b2, p0;
+public:
+	pernode_system(unsigned int nx):
+	SQuIDS(nx,3,2,0,0.),
+	b1(SU_vector::Generator(3,1)),
+	b2(SU_vector::Generator(3,5)),
+	p0(SU_vector::Projector(3,0)){
+		Set_xrange(1.,10.,"lin");
+		Set_CoherentRhoTerms(true);
+		Set_NonCoherentRhoTerms(true);
+		Set_OtherRhoTerms(true);
+		Set_AdaptiveStep(false);
+		//fixed steps are checked against the tolerances as well
+		Set_rel_error(1.);
+		Set_abs_error(1.);
+		for(unsigned int ix=0; ix<nx; ix++){
+			for(unsigned int irho=0; irho<nrhos; irho++)
+				state[ix].rho[irho]=SU_vector::Projector(nsun,irho);
+		}
+	}
+	SU_vector HI(unsigned int ix, unsigned int irho, double t) const{
+		return(Get_x(ix)*b1+(irho+std::sin(t))*b2);
+	}
+	SU_vector GammaRho(unsigned int ix, unsigned int irho, double t) const{
+		return(0.01*Get_x(ix)*p0);
+	}
+	SU_vector InteractionsRho(unsigned int ix, unsigned int irho, double t) const{
+		return(0.001*t*p0);
+	}
+};
+
+//The same system, computing its terms in batches
+class batched_system : public pernode_system{
+public:
+	batched_system(unsigned int nx):pernode_system(nx){}
+	bool HI_batch(unsigned int ix_begin, unsigned int ix_end, unsigned int irho, double t, SU_vector* out) const{
+		for(unsigned int ix=ix_begin; ix<ix_end; ix++)
+			out[ix-ix_begin]=Get_x(ix)*b1+(irho+std::sin(t))*b2;
+		return(true);
+	}
+	bool GammaRho_batch(unsigned int ix_begin, unsigned int ix_end, unsigned int irho, double t, SU_vector* out) const{
+		for(unsigned int ix=ix_begin; ix<ix_end; ix++)
+			out[ix-ix_begin]=0.01*Get_x(ix)*p0;
+		return(true);
+	}
+	bool InteractionsRho_batch(unsigned int ix_begin, unsigned int ix_end, unsigned int irho, double t, SU_vector* out) const{
+		for(unsigned int ix=ix_begin; ix<ix_end; ix++)
+			out[ix-ix_begin]=0.001*t*p0;
+		return(true);
+	}
+};
+
+int main(){
+	using namespace alloc_counting;
+	const unsigned int nx=20;
+	pernode_system a(nx);
+	batched_system b(nx);
+	a.Evolve(1.);
+	b.Evolve(1.);
+	
+	for(unsigned int ix=0; ix<nx; ix++){
+		for(unsigned int irho=0; irho<2; irho++){
+			for(unsigned int j=0; j<9; j++){
+				double va=a.GetExpectationValue(SU_vector::Generator(3,j),irho,ix);
+				double vb=b.GetExpectationValue(SU_vector::Generator(3,j),irho,ix);
+				if(va!=vb)
+					std::cout << "Mismatch at node " << ix << " rho " << irho << " component "
+					<< j << ": " << va << " != " << vb << std::endl;
+			}
+		}
+	}
+	
+	//once warmed up, the number of derivative evaluations must not affect the
+	//number of allocations
+	b.Set_NumSteps(10);
+	reset_allocation_counters();
+	b.Evolve(1.);
+	size_t short_allocs=allocations;
+	b.Set_NumSteps(100);
+	reset_allocation_counters();
+	b.Evolve(1.);
+	if(allocations!=short_allocs)
+		std::cout << "Derivative evaluations allocate memory: " << short_allocs
+		<< " allocations for 10 steps, " << allocations << " for 100 steps" << std::endl;
+}
@@ -0,0 +1,138 @@
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <SQuIDS/SQuIDS.h>
+
+using squids::SU_vector;
+using squids::integrator;
+using squids::interpolation;
+
+//A three level system driven at a frequency which varies with x, with some damping
+class driven_system : public squids::SQuIDS{
+	SU_vector drive, splitting, damping;
+public:
+	driven_system(unsigned int nx):
+	SQuIDS(nx,3,1,1,0.),
+	drive(SU_vector::Generator(3,1)+0.5*SU_vector::Generator(3,6)),
+	splitting(SU_vector::Generator(3,3)+0.3*SU_vector::Generator(3,8)),
+	damping(0.05*SU_vector::Generator(3,0)+0.02*SU_vector::Generator(3,8)){
+		Set_xrange(1.,2.,"lin");
+		Set_CoherentRhoTerms(true);
+		Set_NonCoherentRhoTerms(true);
+		Set_OtherScalarTerms(true);
+		for(unsigned int ix=0; ix<nx; ix++){
+			state[ix].rho[0]=SU_vector::Projector(3,0);
+			state[ix].scalar[0]=1;
+		}
+	}
+	void SetAngle(double theta){ params.SetMixingAngle(0,2,theta); }
+	SU_vector HI(unsigned int ix, unsigned int irho, double t) const{
+		return(Get_x(ix)*(drive*std::cos(2*t)+splitting));
+	}
+	SU_vector GammaRho(unsigned int ix, unsigned int irho, double t) const{
+		return(damping);
+	}
+	double InteractionsScalar(unsigned int ix, unsigned int iscalar, double t) const{
+		return(-0.1*estate[ix].scalar[0]);
+	}
+	double Scalar(unsigned int ix) const{ return(state[ix].scalar[0]); }
+	const SU_vector& Rho(unsigned int ix) const{ return(state[ix].rho[0]); }
+};
+
+double max_difference(const driven_system& a, const driven_system& b){
+	double diff=0;
+	for(unsigned int ix=0; ix<a.Get_nx(); ix++){
+		SU_vector d=a.Rho(ix)-b.Rho(ix);
+		diff=std::max(diff,std::sqrt(d*d));
+		diff=std::max(diff,std::abs(a.Scalar(ix)-b.Scalar(ix)));
+	}
+	return(diff);
+}
+
+int main(){
+	const char* path="checkpoint.test.dat";
+	const unsigned int nx=5;
+	
+	driven_system original(nx);
+	original.Set_Integrator(integrator::dormand_prince_54);
+	original.Set_rel_error(1e-9);
+	original.Set_abs_error(1e-9);
+	original.Set_GSL_step(gsl_odeiv2_step_rk8pd);
+	original.Set_KernelCompression(1e-12);
+	original.SetAngle(0.3);
+	original.Set_Interpolation(interpolation::monotone_cubic);
+	original.Evolve(1.);
+	original.SaveCheckpoint(path);
+	
+	//restoring into a system with different dimensions reinitializes it
+	driven_system restored(2);
+	restored.LoadCheckpoint(path);
+	if(restored.Get_nx()!=nx || restored.Get_nscalars()!=1)
+		std::cout << "Dimensions were not restored" << std::endl;
+	if(restored.Get_t()!=original.Get_t() || restored.Get_t_initial()!=original.Get_t_initial())
+		std::cout << "Times were not restored" << std::endl;
+	if(restored.Get_x(nx-1)!=original.Get_x(nx-1))
+		std::cout << "x values were not restored" << std::endl;
+	if(restored.Get_Integrator()!=integrator::dormand_prince_54 || restored.Get_rel_error()!=1e-9
+	   || restored.Get_h_last()!=original.Get_h_last() || restored.Get_KernelCompression()!=1e-12)
+		std::cout << "Integrator settings were not restored" << std::endl;
+	if(restored.GetParams().GetMixingAngle(0,2)!=0.3)
+		std::cout << "Mixing angles were not restored" << std::endl;
+	if(restored.Get_Interpolation()!=interpolation::monotone_cubic)
+		std::cout << "Interpolation was not restored" << std::endl;
+	if(max_difference(original,restored)!=0)
+		std::cout << "State was not restored" << std::endl;
+	
+	//restoring into a system of the same shape reuses its buffers
+	driven_system same(nx);
+	same.Evolve(0.5);
+	same.LoadCheckpoint(path);
+	if(max_difference(original,same)!=0)
+		std::cout << "State was not restored into a system of the same shape" << std::endl;
+	
+	//the restored systems continue exactly like the original
+	original.Evolve(1.);
+	restored.Evolve(1.);
+	same.Evolve(1.);
+	if(max_difference(original,restored)>1e-14 || max_difference(original,same)>1e-14)
+		std::cout << "Restored evolution differs by " << std::max(max_difference(original,restored),max_difference(original,same)) << std::endl;
+	
+	//an adapted grid keeps its settings and the nodes set with Set_xrange
+	{
+		driven_system adapted(nx);
+		adapted.Set_AdaptiveGrid(1e-4,0,9);
+		adapted.Evolve(1.);
+		if(adapted.Get_nx()==nx)
+			std::cout << "Grid was not refined" << std::endl;
+		adapted.SaveCheckpoint(path);
+		driven_system loaded(nx);
+		loaded.LoadCheckpoint(path);
+		if(loaded.Get_nx()!=adapted.Get_nx() || loaded.Get_AdaptiveGridTolerance()!=1e-4)
+			std::cout << "Adaptive grid was not restored" << std::endl;
+		//coarsening as far as possible leaves only the base nodes
+		adapted.Set_AdaptiveGrid(1e3);
+		loaded.Set_AdaptiveGrid(1e3);
+		while(adapted.AdaptGrid());
+		while(loaded.AdaptGrid());
+		if(adapted.Get_nx()!=nx || loaded.Get_nx()!=nx)
+			std::cout << "Base nodes were not restored" << std::endl;
+	}
+
+	//damaged files are rejected
+	{
+		std::ifstream in(path,std::ios::binary);
+		std::string contents((std::istreambuf_iterator<char>(in)),std::istreambuf_iterator<char>());
+		std::ofstream out(path,std::ios::binary|std::ios::trunc);
+		out.write(contents.data(),contents.size()-8);
+	}
+	try{
+		restored.LoadCheckpoint(path);
+		std::cout << "Truncated checkpoint was accepted" << std::endl;
+	}catch(std::runtime_error&){}
+	std::remove(path);
+	try{
+		restored.LoadCheckpoint(path);
+		std::cout << "Missing checkpoint was accepted" << std::endl;
+	}catch(std::runtime_error&){}
+}
@@ -0,0 +1,151 @@
+#include <cmath>
+#include <iostream>
+#include <SQuIDS/SQuIDS.h>
+
+using squids::SU_vector;
+using squids::integrator;
+
+//A three level system driven at a frequency which varies with x, with some damping
+class driven_system : public squids::SQuIDS{
+	SU_vector drive, splitting, damping;
+public:
+	mutable unsigned long evaluations;
+	driven_system(unsigned int nx):
+	SQuIDS(nx,3,1,0,0.),
+	drive(SU_vector::Generator(3,1)+0.5*SU_vector::Generator(3,6)),
+	splitting(SU_vector::Generator(3,3)+0.3*SU_vector::Generator(3,8)),
+	damping(0.05*SU_vector::Generator(3,0)+0.02*SU_vector::Generator(3,8)),
+	evaluations(0){
+		Set_xrange(1.,2.,"lin");
+		Set_CoherentRhoTerms(true);
+		Set_NonCoherentRhoTerms(true);
+		for(unsigned int ix=0; ix<nx; ix++)
+			state[ix].rho[0]=SU_vector::Projector(3,0);
+	}
+	void PreDerive(double t){ evaluations++; }
+	const SU_vector& current(unsigned int ix) const{ return(state[ix].rho[0]); }
+	SU_vector H0(double x, unsigned int irho) const{
+		return(x*SU_vector::Generator(3,3));
+	}
+	SU_vector HI(unsigned int ix, unsigned int irho, double t) const{
+		return(Get_x(ix)*(drive*std::cos(2*t)+splitting));
+	}
+	SU_vector GammaRho(unsigned int ix, unsigned int irho, double t) const{
+		return(damping);
+	}
+};
+
+const char* name(integrator method){
+	switch(method){
+		case integrator::dormand_prince_54: return("Dormand-Prince 5(4)");
+		case integrator::tsitouras_54: return("Tsitouras 5(4)");
+		case integrator::verner_65: return("Verner 6(5)");
+		default: return("GSL");
+	}
+}
+
+//the largest difference of the populations, computed from the interpolant of a
+//and the current state of b
+double max_difference(const driven_system& a, double t, const driven_system& b){
+	double diff=0;
+	for(unsigned int ix=0; ix<a.Get_nx(); ix++){
+		for(unsigned int i=0; i<3; i++){
+			SU_vector p=SU_vector::Projector(3,i);
+			diff=std::max(diff,std::abs(a.GetExpectationValueAt(p,0,ix,t)-b.GetExpectationValue(p,0,ix)));
+		}
+	}
+	return(diff);
+}
+
+int main(){
+	const unsigned int nx=4;
+	const double duration=3.;
+	const integrator methods[]={integrator::dormand_prince_54,integrator::tsitouras_54,integrator::verner_65};
+	
+	for(unsigned int m=0; m<3; m++){
+		driven_system sys(nx);
+		sys.Set_Integrator(methods[m]);
+		sys.Set_rel_error(1e-9);
+		sys.Set_abs_error(1e-9);
+		sys.Set_DenseOutput(true);
+		sys.Evolve(duration);
+		const double t0=sys.Get_DenseOutputStart(), t1=sys.Get_t();
+		if(!(t0<t1))
+			std::cout << name(methods[m]) << ": no interpolant was kept" << std::endl;
+		
+		//queries must not evaluate the derivative
+		const unsigned long evaluations=sys.evaluations;
+		driven_system reference(nx);
+		reference.Set_Integrator(integrator::verner_65);
+		reference.Set_rel_error(1e-13);
+		reference.Set_abs_error(1e-13);
+		reference.Evolve(t0);
+		for(unsigned int i=0; i<=4; i++){
+			double tq=t0+(t1-t0)*i/4;
+			if(i>0)
+				reference.Evolve(tq-reference.Get_t());
+			double diff=max_difference(sys,tq,reference);
+			if(diff>1e-7)
+				std::cout << name(methods[m]) << ": interpolated state at " << tq << " differs by " << diff << std::endl;
+		}
+		if(sys.evaluations!=evaluations)
+			std::cout << name(methods[m]) << ": queries evaluated the derivative" << std::endl;
+		
+		//the full state at the end of the step is the current state
+		const driven_system::SU_state* s=sys.GetStateAt(t1);
+		for(unsigned int ix=0; ix<nx; ix++){
+			SU_vector diff=s[ix].rho[0]-sys.current(ix);
+			if(std::sqrt(diff*diff)>1e-12)
+				std::cout << name(methods[m]) << ": interpolant does not end at the current state" << std::endl;
+		}
+		try{
+			sys.GetStateAt(t1+0.1*(t1-t0));
+			std::cout << name(methods[m]) << ": query after the step did not throw" << std::endl;
+		}catch(std::runtime_error&){}
+		
+		//the interpolation error at the middle of a step must fall with the step size
+		double errors[2];
+		for(unsigned int j=0; j<2; j++){
+			const double h=0.1/(1<<j);
+			driven_system fixed(nx);
+			fixed.Set_Integrator(methods[m]);
+			fixed.Set_AdaptiveStep(false);
+			fixed.Set_NumSteps(1);
+			fixed.Set_DenseOutput(true);
+			fixed.Evolve(h);
+			driven_system exact(nx);
+			exact.Set_rel_error(1e-13);
+			exact.Set_abs_error(1e-13);
+			exact.Evolve(h/2);
+			errors[j]=max_difference(fixed,h/2,exact);
+		}
+		double order=std::log2(errors[0]/errors[1]);
+		if(order<3.5)
+			std::cout << name(methods[m]) << ": interpolation error converges with order " << order
+			<< " (errors " << errors[0] << ", " << errors[1] << ")" << std::endl;
+	}
+	
+	//the GSL integrator keeps no interpolant
+	driven_system gsl(nx);
+	gsl.Set_DenseOutput(true);
+	gsl.Evolve(1.);
+	if(gsl.Get_DenseOutputStart()!=gsl.Get_t())
+		std::cout << "An interpolant was reported for the GSL integrator" << std::endl;
+	try{
+		gsl.GetExpectationValueAt(SU_vector::Projector(3,0),0,0,0.5);
+		std::cout << "Query without an interpolant did not throw" << std::endl;
+	}catch(std::runtime_error&){}
+	
+	//nor do split steps, whose last Runge-Kutta step misses the coherent half step
+	driven_system split(nx);
+	split.Set_Integrator(integrator::dormand_prince_54);
+	split.Set_SplitStep(0.5);
+	split.Set_DenseOutput(true);
+	split.Evolve(2.);
+	if(split.Get_DenseOutputStart()!=split.Get_t())
+		std::cout << "An interpolant was reported for split steps" << std::endl;
+	try{
+		split.GetExpectationValueAt(SU_vector::Projector(3,0),0,0,2.);
+		std::cout << "Query after split steps did not throw" << std::endl;
+	}catch(std::runtime_error&){}
+}
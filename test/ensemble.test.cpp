@@ -0,0 +1,110 @@
+#include <cmath>
+#include <iostream>
+#include <SQuIDS/Ensemble.h>
+
+using squids::SU_vector;
+using squids::integrator;
+
+//Two level systems with a vacuum mixing angle and a constant potential
+class two_flavor : public squids::SQuIDS{
+	double potential;
+	SU_vector flavor;
+public:
+	unsigned long evaluations;
+	two_flavor(unsigned int nx):
+	SQuIDS(nx,2,1,0,0.),
+	potential(0),
+	evaluations(0){
+		Set_xrange(1.,4.,"lin");
+		Set_CoherentRhoTerms(true);
+		Set_Integrator(integrator::tsitouras_54);
+		Set_rel_error(1e-9);
+		Set_abs_error(1e-9);
+		params.SetEnergyDifference(1,1.);
+		flavor=SU_vector::Projector(2,0);
+		flavor.RotateToB1(params);
+		for(unsigned int ix=0; ix<nx; ix++)
+			state[ix].rho[0]=flavor;
+	}
+	void SetParameters(double theta, double v){
+		params.SetMixingAngle(0,1,theta);
+		flavor=SU_vector::Projector(2,0);
+		flavor.RotateToB1(params);
+		for(unsigned int ix=0; ix<nx; ix++)
+			state[ix].rho[0]=flavor;
+		potential=v;
+		evaluations=0;
+	}
+	void PreDerive(double t){ evaluations++; }
+	SU_vector HI(unsigned int ix, unsigned int irho, double t) const{
+		SU_vector h=SU_vector::Projector(2,1)*(0.5/Get_x(ix));
+		//the potential acts on the first flavor, and is rotated to the mass basis
+		SU_vector v=(potential*(1+0.2*std::sin(t)))*flavor;
+		return(h+v);
+	}
+	double Survival(unsigned int ix) const{ return(state[ix].rho[0]*flavor); }
+};
+
+int main(){
+	const unsigned int nx=4, npoints=40;
+	const double duration=10.;
+	auto theta=[](size_t point){ return(0.1+0.02*point); };
+	auto potential=[](size_t point){ return(0.01*(point%10)); };
+	
+	two_flavor prototype(nx);
+	auto setup=[&](two_flavor& sys, size_t point){ sys.SetParameters(theta(point),potential(point)); };
+	auto measure=[](const two_flavor& sys, size_t point, double* row){
+		for(unsigned int ix=0; ix<nx; ix++)
+			row[ix]=sys.Survival(ix);
+		row[nx]=sys.evaluations;
+	};
+	
+	squids::Ensemble<two_flavor> ensemble(prototype,4);
+	ensemble.Run(npoints,duration,setup,nx+1,measure);
+	if(ensemble.Get_NumPoints()!=npoints || ensemble.Get_NumColumns()!=nx+1 || ensemble.GetResults().size()!=npoints*(nx+1))
+		std::cout << "Wrong table dimensions" << std::endl;
+	
+	//each point must agree with a separately constructed system
+	double warm_evaluations=0;
+	for(size_t point=0; point<npoints; point++){
+		two_flavor sys(nx);
+		sys.SetParameters(theta(point),potential(point));
+		sys.Evolve(duration);
+		for(unsigned int ix=0; ix<nx; ix++){
+			double diff=std::abs(ensemble.GetResult(point,ix)-sys.Survival(ix));
+			if(diff>1e-7)
+				std::cout << "Point " << point << " node " << ix << " differs by " << diff << std::endl;
+		}
+		warm_evaluations+=ensemble.GetResult(point,nx);
+	}
+	
+	//reusing the step size of the previous point saves evaluations
+	ensemble.Set_WarmStart(false);
+	ensemble.Run(npoints,duration,setup,nx+1,measure);
+	double cold_evaluations=0;
+	for(size_t point=0; point<npoints; point++)
+		cold_evaluations+=ensemble.GetResult(point,nx);
+	if(warm_evaluations>=cold_evaluations)
+		std::cout << "Warm start used " << warm_evaluations << " evaluations, compared to " << cold_evaluations << std::endl;
+	
+	//a copy of a system evolves exactly like the original
+	two_flavor original(nx);
+	original.SetParameters(0.3,0.05);
+	original.Evolve(1.);
+	two_flavor copy(original);
+	original.Evolve(1.);
+	copy.Evolve(1.);
+	for(unsigned int ix=0; ix<nx; ix++){
+		if(copy.Survival(ix)!=original.Survival(ix))
+			std::cout << "Copy evolved differently from the original" << std::endl;
+	}
+	
+	//exceptions from a point reach the caller
+	try{
+		ensemble.Run(npoints,duration,setup,1,[](const two_flavor&, size_t point, double*){
+			if(point==17)
+				throw std::runtime_error("measurement failure");
+		});
+		std::cout << "Exception from a point was not rethrown" << std::endl;
+	}catch(std::runtime_error&){}
+}
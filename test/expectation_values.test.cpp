@@ -0,0 +1,103 @@
+#include <atomic>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <SQuIDS/SQuIDS.h>
+
+using squids::SU_vector;
+
+//A three level system with an energy dependent H0, whose states have been
+//given arbitrary values at a later time
+class oscillating : public squids::SQuIDS{
+	SU_vector DM2;
+	std::thread::id owner;
+public:
+	//set if H0 is called by a thread other than the one which created the system
+	mutable std::atomic<bool> foreign_h0;
+	oscillating(unsigned int nx, unsigned int nthreads):
+	SQuIDS(nx,3,2,0,0.),
+	DM2(3),
+	owner(std::this_thread::get_id()),
+	foreign_h0(false){
+		Set_xrange(1.,100.,"log");
+		Set_NumThreads(nthreads);
+		params.SetEnergyDifference(1,7.5e-5);
+		params.SetEnergyDifference(2,2.5e-3);
+		DM2=SU_vector::Projector(3,1)*params.GetEnergyDifference(1)
+		+SU_vector::Projector(3,2)*params.GetEnergyDifference(2);
+		std::mt19937 rng(7);
+		std::uniform_real_distribution<double> dist(-1.,1.);
+		for(unsigned int ix=0; ix<nx; ix++){
+			for(unsigned int irho=0; irho<2; irho++){
+				for(unsigned int k=0; k<9; k++)
+					state[ix].rho[irho][k]=dist(rng);
+			}
+		}
+		Set_t(3e3);
+	}
+	SU_vector H0(double x, unsigned int irho) const{
+		if(std::this_thread::get_id()!=owner)
+			foreign_h0=true;
+		return(DM2*(0.5/x));
+	}
+};
+
+int main(){
+	const unsigned int nx=60;
+	oscillating serial(nx,1), threaded(nx,3);
+	std::vector<SU_vector> ops;
+	for(unsigned int i=0; i<3; i++)
+		ops.push_back(SU_vector::Projector(3,i));
+	ops.push_back(SU_vector::Generator(3,1)+0.5*SU_vector::Generator(3,5));
+
+	//sorted values, including the ends of the grid, followed by unsorted ones
+	std::vector<double> xs;
+	for(unsigned int i=0; i<=500; i++)
+		xs.push_back(1.+99.*i/500);
+	std::mt19937 rng(11);
+	std::uniform_real_distribution<double> dist(1.,100.);
+	for(unsigned int i=0; i<500; i++)
+		xs.push_back(dist(rng));
+
+	const double scale=1.;
+	for(unsigned int irho=0; irho<2; irho++){
+		std::vector<double> values(xs.size()*ops.size()), averaged(values.size());
+		std::vector<double> threaded_values(values.size()), threaded_averaged(values.size());
+		serial.GetExpectationValuesD(ops,irho,xs,values.data());
+		serial.GetExpectationValuesD(ops,irho,xs,averaged.data(),scale);
+		squids::SQuIDS::expectationValuesDBuffer buf;
+		threaded.GetExpectationValuesD(ops,irho,xs,threaded_values.data(),buf);
+		threaded.GetExpectationValuesD(ops,irho,xs,threaded_averaged.data(),buf,scale);
+		if(threaded_values!=values || threaded_averaged!=averaged)
+			std::cout << "Results depend on the number of threads for rho " << irho << std::endl;
+		if(threaded.foreign_h0)
+			std::cout << "H0 was called by a pool thread" << std::endl;
+		for(unsigned int i=0; i<xs.size(); i++){
+			for(unsigned int j=0; j<ops.size(); j++){
+				double expected=serial.GetExpectationValueD(ops[j],irho,xs[i]);
+				double value=values[i*ops.size()+j];
+				if(std::abs(value-expected)>1e-12*(1+std::abs(expected)))
+					std::cout << "Mismatch for rho " << irho << " at x=" << xs[i] << " operator " << j
+					<< ": " << value << " != " << expected << std::endl;
+				std::vector<bool> avr(3);
+				expected=serial.GetExpectationValueD(ops[j],irho,xs[i],scale,avr);
+				value=averaged[i*ops.size()+j];
+				if(std::abs(value-expected)>1e-12*(1+std::abs(expected)))
+					std::cout << "Averaged mismatch for rho " << irho << " at x=" << xs[i] << " operator " << j
+					<< ": " << value << " != " << expected << std::endl;
+			}
+		}
+	}
+
+	double out[4];
+	try{
+		serial.GetExpectationValuesD(ops,0,std::vector<double>{101.},out);
+		std::cout << "x beyond the grid accepted" << std::endl;
+	}catch(std::runtime_error&){}
+	try{
+		serial.GetExpectationValuesD(ops,2,std::vector<double>{2.},out);
+		std::cout << "Invalid rho index accepted" << std::endl;
+	}catch(std::runtime_error&){}
+}
@@ -0,0 +1,94 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+#include <SQuIDS/SQuIDS.h>
+#include <SQuIDS/detail/GridIndex.h>
+
+using squids::detail::grid_index;
+
+//Compares the index with std::lower_bound at the nodes, between them, and
+//at random points inside and outside the range of the nodes
+void check_index(const char* name, const std::vector<double>& nodes, grid_index::spacing kind){
+	grid_index index;
+	index.build(nodes,kind);
+	std::vector<double> values;
+	for(unsigned int i=0; i<nodes.size(); i++){
+		values.push_back(nodes[i]);
+		values.push_back(std::nextafter(nodes[i],-INFINITY));
+		values.push_back(std::nextafter(nodes[i],INFINITY));
+		if(i+1<nodes.size())
+			values.push_back((nodes[i]+nodes[i+1])/2);
+	}
+	std::mt19937 rng(11);
+	double width=nodes.back()-nodes.front();
+	std::uniform_real_distribution<double> dist(nodes.front()-0.1*width,nodes.back()+0.1*width);
+	for(unsigned int i=0; i<10000; i++)
+		values.push_back(dist(rng));
+	for(double value : values){
+		size_t expected=std::distance(nodes.begin(),std::lower_bound(nodes.begin(),nodes.end(),value));
+		size_t found=index.lower_bound(nodes,value);
+		if(found!=expected){
+			std::cout << name << ": position of " << value << " is " << found << " instead of " << expected << std::endl;
+			return;
+		}
+	}
+}
+
+class grid : public squids::SQuIDS{
+public:
+	grid(unsigned int nx):SQuIDS(nx,2,1,0,0.){}
+	//checks that Get_i returns the interval containing each value
+	void check_intervals(const char* name){
+		std::vector<double> values;
+		for(unsigned int i=0; i<nx; i++){
+			values.push_back(Get_x(i));
+			if(i+1<nx)
+				values.push_back((Get_x(i)+Get_x(i+1))/2);
+		}
+		for(double value : values){
+			unsigned int i=Get_i(value);
+			if(i+1>=nx || Get_x(i)>value || Get_x(i+1)<value || (Get_x(i+1)==value && i+2<nx))
+				std::cout << name << ": Get_i(" << value << ") returned " << i << std::endl;
+		}
+		try{
+			Get_i(Get_x(nx-1)*1.01);
+			std::cout << name << ": Value above the grid accepted" << std::endl;
+		}catch(std::runtime_error&){}
+	}
+};
+
+int main(){
+	const unsigned int n=1000;
+	std::vector<double> linear(n), logarithmic(n), clustered(n);
+	for(unsigned int i=0; i<n; i++){
+		linear[i]=-3.+7.*i/(n-1);
+		logarithmic[i]=std::exp(std::log(1e-3)+std::log(1e9)*i/(n-1));
+		//most nodes crowded around one point, as left by an adaptive grid
+		double u=double(i)/(n-1);
+		clustered[i]=2.+std::pow(u-0.3,3)*50;
+	}
+	check_index("linear",linear,grid_index::spacing::linear);
+	check_index("logarithmic",logarithmic,grid_index::spacing::logarithmic);
+	check_index("clustered",clustered,grid_index::spacing::arbitrary);
+	//spacings which do not match the nodes fall back to buckets
+	check_index("mislabeled",clustered,grid_index::spacing::logarithmic);
+	std::vector<double> repeated={1.,2.,2.,2.,3.,5.,5.,8.};
+	check_index("repeated",repeated,grid_index::spacing::arbitrary);
+	check_index("repeated as linear",repeated,grid_index::spacing::linear);
+
+	grid lin(57), log(57), vec(57);
+	lin.Set_xrange(0.,1.,"lin");
+	lin.check_intervals("lin");
+	log.Set_xrange(1.,1e6,"log");
+	log.check_intervals("log");
+	std::vector<double> xs(57);
+	for(unsigned int i=0; i<xs.size(); i++)
+		xs[i]=std::sqrt(double(i));
+	vec.Set_xrange(xs);
+	vec.check_intervals("vector");
+	grid copy(57);
+	copy.CopyStateFrom(log);
+	copy.check_intervals("copy");
+}
@@ -0,0 +1,94 @@
+#include <cmath>
+#include <iostream>
+#include <SQuIDS/SQuIDS.h>
+
+using squids::SU_vector;
+
+//A three level system whose driving terms are written in the frame of H0.
+//If manual is set the terms are rotated into the interaction picture by the
+//class itself, otherwise the library is asked to do it.
+class lab_frame_system : public squids::SQuIDS{
+	bool manual;
+	SU_vector drive, damping;
+public:
+	double scale;
+	lab_frame_system(bool manual, double t_ini):
+	SQuIDS(5,3,2,0,t_ini),
+	manual(manual),
+	drive(SU_vector::Generator(3,1)+0.3*SU_vector::Generator(3,5)+0.2*SU_vector::Generator(3,6)),
+	damping(0.01*SU_vector::Generator(3,0)+0.004*SU_vector::Generator(3,2)),
+	scale(1.){
+		Set_xrange(1.,3.,"lin");
+		Set_CoherentRhoTerms(true);
+		Set_NonCoherentRhoTerms(true);
+		Set_InteractionPicture(!manual);
+		Set_rel_error(1e-10);
+		Set_abs_error(1e-10);
+		for(unsigned int ix=0; ix<nx; ix++){
+			state[ix].rho[0]=SU_vector::Projector(3,0);
+			state[ix].rho[1]=SU_vector::Projector(3,2);
+		}
+	}
+	SU_vector H0(double x, unsigned int irho) const{
+		SU_vector h=SU_vector::Projector(3,1)+2.5*SU_vector::Projector(3,2);
+		h*=scale*x;
+		return(irho==0 ? h : -1.*h);
+	}
+	SU_vector HI(unsigned int ix, unsigned int irho, double t) const{
+		SU_vector h=(0.4*std::cos(Get_x(ix)*t))*drive;
+		if(manual)
+			return(h.Evolve(H0(Get_x(ix),irho),t-Get_t_initial()));
+		return(h);
+	}
+	SU_vector GammaRho(unsigned int ix, unsigned int irho, double t) const{
+		if(manual)
+			return(damping.Evolve(H0(Get_x(ix),irho),t-Get_t_initial()));
+		return(damping);
+	}
+};
+
+bool compare(lab_frame_system& manual, lab_frame_system& automatic, const char* label){
+	bool ok=true;
+	const SU_vector op=SU_vector::Projector(3,1);
+	for(unsigned int ix=0; ix<manual.Get_nx(); ix++){
+		for(unsigned int irho=0; irho<2; irho++){
+			double expected=manual.GetExpectationValue(op,irho,ix);
+			double result=automatic.GetExpectationValue(op,irho,ix);
+			if(std::abs(result-expected)>1e-8){
+				std::cout << label << ": node " << ix << " rho " << irho << ": "
+				<< result << " != " << expected << std::endl;
+				ok=false;
+			}
+		}
+	}
+	return(ok);
+}
+
+int main(){
+	lab_frame_system manual(true,0.5), automatic(false,0.5), threaded(false,0.5);
+	threaded.Set_NumThreads(2);
+	threaded.Set_ThreadChunkSize(1);
+	if(manual.Get_InteractionPicture() || !automatic.Get_InteractionPicture())
+		std::cout << "Wrong interaction picture setting" << std::endl;
+	
+	manual.Evolve(5.);
+	automatic.Evolve(5.);
+	threaded.Evolve(5.);
+	compare(manual,automatic,"serial");
+	compare(manual,threaded,"threaded");
+	
+	//the cached H0 must be rebuilt when the x range changes
+	manual.Set_xrange(2.,4.,"lin");
+	automatic.Set_xrange(2.,4.,"lin");
+	manual.Evolve(2.);
+	automatic.Evolve(2.);
+	compare(manual,automatic,"after x range change");
+	
+	//and when requested after parameters change
+	manual.scale=0.5;
+	automatic.scale=0.5;
+	automatic.Set_InteractionPicture(true);
+	manual.Evolve(2.);
+	automatic.Evolve(2.);
+	compare(manual,automatic,"after parameter change");
+}
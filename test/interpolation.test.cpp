@@ -0,0 +1,116 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <vector>
+#include <SQuIDS/SQuIDS.h>
+
+using squids::SU_vector;
+using squids::interpolation;
+
+//A two level system whose states are known functions of x
+class profile : public squids::SQuIDS{
+	SU_vector B;
+public:
+	profile(unsigned int nx, interpolation method, double (*f)(double)):
+	SQuIDS(nx,2,1,0,0.),
+	B(SU_vector::Generator(2,3)){
+		//selected before the nodes, so that no slopes are cached
+		Set_Interpolation(method);
+		Set_xrange(1.,4.,"log");
+		for(unsigned int ix=0; ix<nx; ix++)
+			state[ix].rho[0]=exact(Get_x(ix),f);
+		Set_t(2.);
+	}
+	static SU_vector exact(double x, double (*f)(double)){
+		return(0.5*SU_vector::Generator(2,0)+f(x)*SU_vector::Generator(2,1)
+		       +(0.3*std::cos(2*x))*SU_vector::Generator(2,3));
+	}
+	const SU_vector& Rho(unsigned int ix) const{ return(state[ix].rho[0]); }
+	SU_vector H0(double x, unsigned int irho) const{
+		return(B*x);
+	}
+};
+
+double smooth(double x){ return(0.4*std::sin(3*x)); }
+double step(double x){ return(0.4*std::tanh(8*(x-2.5))); }
+
+//the largest error of the interpolated states at points between the nodes
+double max_error(const profile& p, double (*f)(double)){
+	double error=0;
+	for(unsigned int i=0; i<=3000; i++){
+		double x=1.+3.*i/3000;
+		SU_vector difference=p.GetIntermediateState(0,x)-profile::exact(x,f);
+		for(unsigned int k=0; k<4; k++)
+			error=std::max(error,std::abs(difference[k]));
+	}
+	return(error);
+}
+
+int main(){
+	const unsigned int nx=80;
+	profile linear(nx,interpolation::linear,smooth), cubic(nx,interpolation::cubic_hermite,smooth);
+	double linear_error=max_error(linear,smooth), cubic_error=max_error(cubic,smooth);
+	if(cubic_error*8>linear_error)
+		std::cout << "Cubic interpolation error " << cubic_error << " is not much below the linear error "
+		<< linear_error << std::endl;
+	//interpolation reproduces the nodes
+	for(unsigned int ix=0; ix<nx; ix++){
+		SU_vector node=cubic.GetIntermediateState(0,cubic.Get_x(ix));
+		for(unsigned int k=0; k<4; k++){
+			if(std::abs(node[k]-cubic.Rho(ix)[k])>1e-14)
+				std::cout << "Interpolation differs from node " << ix << std::endl;
+		}
+	}
+
+	//the cached slopes give the same results as slopes computed for each query
+	std::vector<double> xs;
+	for(unsigned int i=0; i<500; i++)
+		xs.push_back(1.+3.*i/499);
+	std::vector<SU_vector> uncached;
+	for(double x : xs)
+		uncached.push_back(cubic.GetIntermediateState(0,x));
+	cubic.Set_Interpolation(interpolation::cubic_hermite);
+	for(unsigned int i=0; i<xs.size(); i++){
+		if(!(cubic.GetIntermediateState(0,xs[i])==uncached[i])){
+			std::cout << "Cached slopes change the result at x=" << xs[i] << std::endl;
+			break;
+		}
+	}
+
+	//all expectation value functions use the selected method
+	std::vector<SU_vector> ops={SU_vector::Generator(2,1),SU_vector::Generator(2,2)};
+	std::vector<double> batch(xs.size()*ops.size());
+	cubic.GetExpectationValuesD(ops,0,xs,batch.data());
+	std::vector<bool> avr(1);
+	for(unsigned int i=0; i<xs.size(); i++){
+		for(unsigned int j=0; j<ops.size(); j++){
+			double expected=cubic.GetIntermediateState(0,xs[i])*ops[j].Evolve(cubic.H0(xs[i],0),cubic.Get_t()-cubic.Get_t_initial());
+			double single=cubic.GetExpectationValueD(ops[j],0,xs[i]);
+			double averaged=cubic.GetExpectationValueD(ops[j],0,xs[i],1e10,avr);
+			if(std::abs(single-expected)>1e-12 || std::abs(averaged-expected)>1e-12
+			   || std::abs(batch[i*ops.size()+j]-expected)>1e-12)
+				std::cout << "Expectation values at x=" << xs[i] << " disagree: " << single << ", " << averaged
+				<< ", " << batch[i*ops.size()+j] << " != " << expected << std::endl;
+		}
+	}
+
+	//monotone interpolation does not overshoot a steep step
+	profile monotone(nx,interpolation::monotone_cubic,step);
+	monotone.Evolve(0.);
+	for(unsigned int ix=0; ix+1<nx; ix++){
+		double low=monotone.Rho(ix)[1], high=monotone.Rho(ix+1)[1];
+		double previous=low;
+		for(unsigned int i=1; i<=20; i++){
+			double x=monotone.Get_x(ix)+(monotone.Get_x(ix+1)-monotone.Get_x(ix))*i/20;
+			double value=monotone.GetIntermediateState(0,x)[1];
+			if(value<previous-1e-15 || value>high+1e-15){
+				std::cout << "Monotone interpolation leaves the range of nodes " << ix << " and " << ix+1
+				<< " at x=" << x << ": " << value << std::endl;
+				break;
+			}
+			previous=value;
+		}
+	}
+	if(monotone.Get_Interpolation()!=interpolation::monotone_cubic)
+		std::cout << "Interpolation method not stored" << std::endl;
+}
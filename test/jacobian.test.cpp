@@ -0,0 +1,124 @@
+#include <cmath>
+#include <iostream>
+#include <vector>
+#include <SQuIDS/SQuIDS.h>
+
+using squids::SU_vector;
+
+const unsigned int dim=3;
+
+SU_vector test_vector(unsigned int seed){
+	SU_vector v(dim);
+	for(unsigned int i=0; i<dim*dim; i++)
+		v[i]=std::sin(1.7*seed+0.9*i);
+	return(v);
+}
+
+class test_system : public squids::SQuIDS{
+public:
+	const double coupling;
+	test_system():
+	SQuIDS(4,dim,2,1,0.),coupling(0.3){
+		Set_xrange(1.,4.,"lin");
+		Set_CoherentRhoTerms(true);
+		Set_NonCoherentRhoTerms(true);
+		Set_OtherRhoTerms(true);
+		Set_GammaScalarTerms(true);
+		Set_rel_error(1e-8);
+		Set_abs_error(1e-8);
+		for(unsigned int ix=0; ix<nx; ix++){
+			for(unsigned int irho=0; irho<nrhos; irho++)
+				state[ix].rho[irho]=0.2*test_vector(10+ix+irho);
+			state[ix].scalar[0]=1;
+		}
+	}
+	SU_vector HI(unsigned int ix, unsigned int irho, double t) const{
+		return(test_vector(ix+3*irho)*std::cos(t));
+	}
+	SU_vector GammaRho(unsigned int ix, unsigned int irho, double t) const{
+		return(0.1*test_vector(20+ix+3*irho));
+	}
+	//each node is driven by its neighbor
+	SU_vector InteractionsRho(unsigned int ix, unsigned int irho, double t) const{
+		if(ix==0)
+			return(SU_vector(dim));
+		return(coupling*estate[ix-1].rho[irho]);
+	}
+	double GammaScalar(unsigned int ix, unsigned int is, double t) const{
+		return(0.5*Get_x(ix));
+	}
+	void InteractionsJacobian(double t, double* dfdy) const{
+		const size_t n=Get_nx()*(Get_nrhos()*dim*dim+Get_nscalars());
+		for(unsigned int ix=1; ix<Get_nx(); ix++){
+			for(unsigned int irho=0; irho<nrhos; irho++){
+				for(unsigned int k=0; k<dim*dim; k++)
+					dfdy[Get_StateIndex(ix,irho,k)*n+Get_StateIndex(ix-1,irho,k)]+=coupling;
+			}
+		}
+	}
+};
+
+int main(){
+	test_system s;
+	const unsigned int nx=s.Get_nx();
+	const size_t n=nx*(2*dim*dim+1);
+	std::vector<double> dfdy(n*n), dfdt(n);
+	const double t=0.7;
+	s.Jacobian(t,dfdy.data(),dfdt.data());
+	
+	//build the expected Jacobian column by column from the SU_vector operations
+	std::vector<double> expected(n*n,0.0);
+	for(unsigned int ix=0; ix<nx; ix++){
+		for(unsigned int irho=0; irho<2; irho++){
+			SU_vector H=s.HI(ix,irho,t), G=s.GammaRho(ix,irho,t);
+			for(unsigned int b=0; b<dim*dim; b++){
+				SU_vector e=SU_vector::Generator(dim,b);
+				SU_vector column=iCommutator(e,H)-ACommutator(G,e);
+				for(unsigned int k=0; k<dim*dim; k++)
+					expected[s.Get_StateIndex(ix,irho,k)*n+s.Get_StateIndex(ix,irho,b)]=column[k];
+				if(ix>0)
+					expected[s.Get_StateIndex(ix,irho,b)*n+s.Get_StateIndex(ix-1,irho,b)]=s.coupling;
+			}
+		}
+		size_t is=s.Get_ScalarIndex(ix,0);
+		expected[is*n+is]=-s.GammaScalar(ix,0,t);
+	}
+	for(size_t i=0; i<n; i++){
+		for(size_t j=0; j<n; j++){
+			if(std::abs(dfdy[i*n+j]-expected[i*n+j])>1e-14)
+				std::cout << "Jacobian entry (" << i << ',' << j << ") is " << dfdy[i*n+j]
+				<< ", expected " << expected[i*n+j] << std::endl;
+		}
+	}
+	
+	//only HI depends explicitly on time
+	for(unsigned int ix=0; ix<nx; ix++){
+		for(unsigned int irho=0; irho<2; irho++){
+			SU_vector rho=0.2*test_vector(10+ix+irho);
+			SU_vector dHdt=-std::sin(t)*test_vector(ix+3*irho);
+			SU_vector d=iCommutator(rho,dHdt);
+			for(unsigned int k=0; k<dim*dim; k++){
+				if(std::abs(dfdt[s.Get_StateIndex(ix,irho,k)]-d[k])>1e-6)
+					std::cout << "Time derivative entry " << s.Get_StateIndex(ix,irho,k) << " is "
+					<< dfdt[s.Get_StateIndex(ix,irho,k)] << ", expected " << d[k] << std::endl;
+			}
+		}
+		if(dfdt[s.Get_ScalarIndex(ix,0)]!=0)
+			std::cout << "Scalar time derivative should be zero" << std::endl;
+	}
+	
+	//an implicit stepper must produce the same evolution as an explicit one
+	test_system implicit, explicit_;
+	implicit.Set_GSL_step(gsl_odeiv2_step_rk4imp);
+	implicit.Evolve(2.);
+	explicit_.Evolve(2.);
+	for(unsigned int ix=0; ix<nx; ix++){
+		for(unsigned int k=0; k<dim*dim; k++){
+			SU_vector g=SU_vector::Generator(dim,k);
+			double a=implicit.GetExpectationValue(g,1,ix), b=explicit_.GetExpectationValue(g,1,ix);
+			if(std::abs(a-b)>1e-5)
+				std::cout << "Implicit evolution differs at node " << ix << " component " << k
+				<< ": " << a << " != " << b << std::endl;
+		}
+	}
+}
@@ -0,0 +1,153 @@
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+#include <SQuIDS/SQuIDS.h>
+#include <SQuIDS/detail/KernelCompression.h>
+
+using squids::SU_vector;
+using squids::integrator;
+using squids::detail::compressed_kernel;
+
+double separable(unsigned int i, unsigned int j){
+	if(j<=i)
+		return(0);
+	return(std::exp(-0.01*i)*(1.+0.001*j));
+}
+
+double smooth(unsigned int i, unsigned int j){
+	return(1./(1.+0.01*(i+j)));
+}
+
+double banded(unsigned int i, unsigned int j){
+	return(std::abs(double(i)-j)<3 ? 1.+0.1*i : 0.);
+}
+
+//Checks the approximation of a kernel and its application to a set of vectors
+void check_kernel(const char* name, double (*kernel)(unsigned int, unsigned int),
+                  unsigned int n, double tolerance, bool compressible){
+	std::vector<double> entries(n*n);
+	double norm=0;
+	for(unsigned int i=0; i<n; i++){
+		for(unsigned int j=0; j<n; j++){
+			entries[i*n+j]=kernel(i,j);
+			norm+=entries[i*n+j]*entries[i*n+j];
+		}
+	}
+	compressed_kernel compressed;
+	compressed.compress(n,entries.data(),tolerance);
+	std::vector<double> expanded(n*n);
+	compressed.expand(expanded.data());
+	double error=0;
+	for(unsigned int i=0; i<n*n; i++)
+		error+=(expanded[i]-entries[i])*(expanded[i]-entries[i]);
+	if(error>tolerance*tolerance*norm)
+		std::cout << name << ": relative error " << std::sqrt(error/norm) << " exceeds " << tolerance << std::endl;
+	if(compressible && compressed.stored_values()*4>n*n)
+		std::cout << name << ": " << compressed.stored_values() << " values stored for " << n*n << " entries" << std::endl;
+
+	//the product with a set of vectors, stored with some padding between them
+	const unsigned int width=4, stride=6;
+	std::mt19937 rng(5);
+	std::uniform_real_distribution<double> dist(-1.,1.);
+	std::vector<double> in(n*stride), whole(n*stride,0.), parts(n*stride,0.);
+	for(double& v : in)
+		v=dist(rng);
+	std::vector<double> projections(compressed.projection_size()*width);
+	compressed.project(width,in.data(),stride,projections.data());
+	compressed.apply(0,n,width,in.data(),stride,projections.data(),whole.data(),stride);
+	for(unsigned int b=0; b<n; b+=37){
+		unsigned int e=std::min(n,b+37);
+		compressed.apply(b,e,width,in.data(),stride,projections.data(),&parts[b*stride],stride);
+	}
+	if(parts!=whole)
+		std::cout << name << ": the product depends on the division of the rows" << std::endl;
+	for(unsigned int i=0; i<n; i++){
+		for(unsigned int k=0; k<width; k++){
+			double expected=0, magnitude=0;
+			for(unsigned int j=0; j<n; j++){
+				expected+=expanded[i*n+j]*in[j*stride+k];
+				magnitude+=std::abs(expanded[i*n+j]*in[j*stride+k]);
+			}
+			if(std::abs(whole[i*stride+k]-expected)>1e-12*magnitude){
+				std::cout << name << ": product differs in row " << i << " component " << k << ": "
+				<< whole[i*stride+k] << " != " << expected << std::endl;
+				return;
+			}
+		}
+	}
+}
+
+double random_entry(unsigned int i, unsigned int j){
+	std::mt19937 rng(i*7919+j);
+	return(std::uniform_real_distribution<double>(-1.,1.)(rng));
+}
+
+//A two level system whose particles are moved to lower energies at a rate
+//which is separable in the initial and final energy
+class cascade : public squids::SQuIDS{
+public:
+	cascade(unsigned int nx, double tolerance, unsigned int nthreads):
+	SQuIDS(nx,2,1,1,0.){
+		Set_xrange(1.,10.,"lin");
+		Set_CoherentRhoTerms(true);
+		Set_NonLocalRhoTerms(true);
+		Set_NonLocalScalarTerms(true);
+		Set_KernelCompression(tolerance);
+		Set_Integrator(integrator::tsitouras_54);
+		Set_rel_error(1e-10);
+		Set_abs_error(1e-10);
+		Set_NumThreads(nthreads);
+		for(unsigned int ix=0; ix<nx; ix++){
+			state[ix].rho[0]=SU_vector::Projector(2,0);
+			state[ix].scalar[0]=1./Get_x(ix);
+		}
+	}
+	SU_vector HI(unsigned int ix, unsigned int irho, double t) const{
+		return((1./Get_x(ix))*SU_vector::Generator(2,1));
+	}
+	double RhoKernel(unsigned int ix, unsigned int jx, unsigned int irho) const{
+		if(jx<ix)
+			return(0);
+		double width=Get_x(1)-Get_x(0);
+		return(jx==ix ? -0.5*(Get_x(ix)-Get_x(0))/Get_x(ix) : 0.5*width/Get_x(jx));
+	}
+	double ScalarKernel(unsigned int ix, unsigned int jx, unsigned int is) const{
+		return(RhoKernel(ix,jx,0));
+	}
+	const SU_vector& Rho(unsigned int ix) const{ return(state[ix].rho[0]); }
+	double Scalar(unsigned int ix) const{ return(state[ix].scalar[0]); }
+};
+
+int main(){
+	const unsigned int n=700;
+	check_kernel("separable",separable,n,1e-10,true);
+	check_kernel("smooth",smooth,n,1e-8,true);
+	check_kernel("banded",banded,n,1e-10,true);
+	check_kernel("random",random_entry,300,1e-6,false);
+
+	const unsigned int nx=500;
+	cascade exact(nx,0.,1), compressed(nx,1e-10,1), threaded(nx,1e-10,3);
+	if(compressed.Get_KernelCompression()!=1e-10)
+		std::cout << "Compression tolerance not stored" << std::endl;
+	try{
+		exact.Set_KernelCompression(-1.);
+		std::cout << "Negative tolerance accepted" << std::endl;
+	}catch(std::runtime_error&){}
+	exact.Evolve(2.);
+	compressed.Evolve(2.);
+	threaded.Evolve(2.);
+	for(unsigned int ix=0; ix<nx; ix++){
+		for(unsigned int k=0; k<4; k++){
+			double expected=exact.Rho(ix)[k];
+			if(std::abs(compressed.Rho(ix)[k]-expected)>1e-7)
+				std::cout << "Mismatch at node " << ix << " component " << k << ": "
+				<< compressed.Rho(ix)[k] << " != " << expected << std::endl;
+			if(threaded.Rho(ix)[k]!=compressed.Rho(ix)[k])
+				std::cout << "Result depends on the number of threads at node " << ix << std::endl;
+		}
+		if(std::abs(compressed.Scalar(ix)-exact.Scalar(ix))>1e-7)
+			std::cout << "Scalar mismatch at node " << ix << ": " << compressed.Scalar(ix)
+			<< " != " << exact.Scalar(ix) << std::endl;
+	}
+}
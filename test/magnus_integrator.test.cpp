@@ -0,0 +1,129 @@
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+#include <SQuIDS/SQuIDS.h>
+
+using squids::SU_vector;
+using squids::integrator;
+
+//Two flavor vacuum oscillations with a slowly varying matter-like potential.
+//HI is written in the frame of H0 and rotated by the library.
+class oscillating_system : public squids::SQuIDS{
+	SU_vector potential;
+public:
+	double modulation;
+	oscillating_system(unsigned int nx):
+	SQuIDS(nx,2,1,0,0.),
+	modulation(0){
+		Set_xrange(1.,2.,"lin");
+		Set_CoherentRhoTerms(true);
+		Set_InteractionPicture(true);
+		params.SetEnergyDifference(1,100.);
+		params.SetMixingAngle(0,1,0.3);
+		potential=SU_vector::Projector(2,0);
+		potential.RotateToB1(params);
+		for(unsigned int ix=0; ix<nx; ix++)
+			state[ix].rho[0]=potential;
+	}
+	SU_vector H0(double x, unsigned int irho) const{
+		return(x*100.*SU_vector::Projector(2,1));
+	}
+	SU_vector HI(unsigned int ix, unsigned int irho, double t) const{
+		return((20.+modulation*std::sin(t))*potential);
+	}
+};
+
+//A driven two level system whose HI is already in the frame of the state
+class driven_system : public squids::SQuIDS{
+	SU_vector b1, b3;
+public:
+	driven_system():
+	SQuIDS(3,2,1,0,0.),
+	b1(SU_vector::Generator(2,1)),
+	b3(SU_vector::Generator(2,3)){
+		Set_xrange(1.,2.,"lin");
+		Set_CoherentRhoTerms(true);
+		for(unsigned int ix=0; ix<nx; ix++)
+			state[ix].rho[0]=SU_vector::Projector(2,0);
+	}
+	SU_vector HI(unsigned int ix, unsigned int irho, double t) const{
+		return(Get_x(ix)*(b1*std::cos(3*t)+b3*std::sin(t)));
+	}
+};
+
+double max_difference(squids::SQuIDS& a, squids::SQuIDS& b){
+	double diff=0;
+	const SU_vector p=SU_vector::Projector(2,0);
+	for(unsigned int ix=0; ix<a.Get_nx(); ix++)
+		diff=std::max(diff,std::abs(a.GetExpectationValue(p,0,ix)-b.GetExpectationValue(p,0,ix)));
+	return(diff);
+}
+
+int main(){
+	//a constant Hamiltonian is integrated exactly by a single step, however
+	//many oscillations it spans
+	oscillating_system reference(4), single(4);
+	reference.Set_Integrator(integrator::verner_65);
+	reference.Set_rel_error(1e-12);
+	reference.Set_abs_error(1e-12);
+	reference.Evolve(3.);
+	single.Set_Integrator(integrator::magnus_4);
+	single.Set_AdaptiveStep(false);
+	single.Set_NumSteps(1);
+	single.Evolve(3.);
+	if(max_difference(reference,single)>1e-7)
+		std::cout << "Single Magnus step differs from the reference by "
+		<< max_difference(reference,single) << std::endl;
+	
+	//with a time dependent potential the adaptive steps are still longer than
+	//those of a Runge-Kutta method at the same tolerance
+	oscillating_system modulated_reference(4), modulated(4), runge_kutta(4);
+	modulated_reference.modulation=modulated.modulation=runge_kutta.modulation=5.;
+	modulated_reference.Set_Integrator(integrator::verner_65);
+	modulated_reference.Set_rel_error(1e-12);
+	modulated_reference.Set_abs_error(1e-12);
+	modulated_reference.Evolve(10.);
+	modulated.Set_Integrator(integrator::magnus_4);
+	runge_kutta.Set_Integrator(integrator::verner_65);
+	for(oscillating_system* s : {&modulated,&runge_kutta}){
+		s->Set_rel_error(1e-8);
+		s->Set_abs_error(1e-8);
+	}
+	modulated.Set_NumThreads(2);
+	modulated.Evolve(10.);
+	runge_kutta.Evolve(10.);
+	if(max_difference(modulated_reference,modulated)>1e-6)
+		std::cout << "Adaptive Magnus evolution differs from the reference by "
+		<< max_difference(modulated_reference,modulated) << std::endl;
+	if(modulated.Get_h_last()<runge_kutta.Get_h_last())
+		std::cout << "Magnus step size " << modulated.Get_h_last()
+		<< " is shorter than Runge-Kutta step size " << runge_kutta.Get_h_last() << std::endl;
+	
+	//the fixed step convergence should be of fourth order
+	driven_system driven_reference;
+	driven_reference.Set_Integrator(integrator::verner_65);
+	driven_reference.Set_rel_error(1e-13);
+	driven_reference.Set_abs_error(1e-13);
+	driven_reference.Evolve(4.);
+	double errors[2];
+	for(unsigned int j=0; j<2; j++){
+		driven_system fixed;
+		fixed.Set_Integrator(integrator::magnus_4);
+		fixed.Set_AdaptiveStep(false);
+		fixed.Set_NumSteps(40<<j);
+		fixed.Evolve(4.);
+		errors[j]=max_difference(driven_reference,fixed);
+	}
+	double order=std::log2(errors[0]/errors[1]);
+	if(std::abs(order-4)>0.5)
+		std::cout << "Observed order " << order << " (errors " << errors[0] << ", " << errors[1] << ")" << std::endl;
+	
+	//other terms cannot be handled
+	driven_system damped;
+	damped.Set_Integrator(integrator::magnus_4);
+	damped.Set_NonCoherentRhoTerms(true);
+	try{
+		damped.Evolve(1.);
+		std::cout << "Magnus integration with non-coherent terms did not fail" << std::endl;
+	}catch(std::runtime_error&){}
+}
@@ -0,0 +1,87 @@
+#include <cmath>
+#include <iostream>
+#include <SQuIDS/SQuIDS.h>
+
+using squids::SU_vector;
+using squids::integrator;
+
+//A two level system whose oscillation frequency falls with x, so that the
+//nodes at small x need much shorter steps than the others
+class spread_system : public squids::SQuIDS{
+	SU_vector splitting;
+public:
+	mutable unsigned long hamiltonians;
+	spread_system(unsigned int nx):
+	SQuIDS(nx,2,1,0,0.),
+	splitting(SU_vector::Generator(2,1)+0.4*SU_vector::Generator(2,3)),
+	hamiltonians(0){
+		Set_xrange(1.,1000.,"log");
+		Set_CoherentRhoTerms(true);
+		for(unsigned int ix=0; ix<nx; ix++)
+			state[ix].rho[0]=SU_vector::Projector(2,0);
+	}
+	SU_vector HI(unsigned int ix, unsigned int irho, double t) const{
+		hamiltonians++;
+		return((50./Get_x(ix))*(1+0.5*std::cos(t))*splitting);
+	}
+};
+
+double max_difference(spread_system& a, spread_system& b){
+	double diff=0;
+	SU_vector p=SU_vector::Projector(2,0);
+	for(unsigned int ix=0; ix<a.Get_nx(); ix++)
+		diff=std::max(diff,std::abs(a.GetExpectationValue(p,0,ix)-b.GetExpectationValue(p,0,ix)));
+	return(diff);
+}
+
+int main(){
+	const unsigned int nx=40;
+	const double duration=4., tolerance=1e-9;
+	
+	spread_system reference(nx);
+	reference.Set_Integrator(integrator::verner_65);
+	reference.Set_rel_error(1e-13);
+	reference.Set_abs_error(1e-13);
+	reference.Evolve(duration);
+	
+	spread_system single(nx);
+	single.Set_Integrator(integrator::dormand_prince_54);
+	single.Set_rel_error(tolerance);
+	single.Set_abs_error(tolerance);
+	single.Evolve(duration);
+	
+	spread_system multi(nx);
+	multi.Set_Integrator(integrator::dormand_prince_54);
+	multi.Set_rel_error(tolerance);
+	multi.Set_abs_error(tolerance);
+	multi.Set_MultiRate(4,1.);
+	if(multi.Get_MultiRateLevels()!=4 || !multi.Get_MultiRateGroups().empty())
+		std::cout << "Wrong multi-rate settings" << std::endl;
+	for(unsigned int i=0; i<4; i++)
+		multi.Evolve(duration/4);
+	if(std::abs(multi.Get_t()-duration)>1e-12)
+		std::cout << "Evolution ended at the wrong time: " << multi.Get_t() << std::endl;
+	
+	const std::vector<unsigned int>& groups=multi.Get_MultiRateGroups();
+	if(groups.size()<3 || groups.front()!=0 || groups.back()!=nx)
+		std::cout << "Nodes were not divided into several groups" << std::endl;
+	for(unsigned int g=1; g<groups.size(); g++){
+		if(groups[g]<=groups[g-1])
+			std::cout << "Empty or unordered node group" << std::endl;
+	}
+	
+	double diff=max_difference(multi,reference);
+	if(diff>1e-6)
+		std::cout << "Multi-rate difference from reference is " << diff << std::endl;
+	if(2*multi.hamiltonians>single.hamiltonians)
+		std::cout << "Multi-rate stepping evaluated " << multi.hamiltonians
+		<< " hamiltonians, compared to " << single.hamiltonians << " without grouping" << std::endl;
+	
+	//grouping is only supported by the native Runge-Kutta methods
+	spread_system gsl(nx);
+	gsl.Set_MultiRate(2);
+	try{
+		gsl.Evolve(1.);
+		std::cout << "Multi-rate stepping with the GSL integrator did not throw" << std::endl;
+	}catch(std::runtime_error&){}
+}
@@ -0,0 +1,119 @@
+#include <cmath>
+#include <iostream>
+#include <SQuIDS/SQuIDS.h>
+
+using squids::SU_vector;
+using squids::integrator;
+
+//A three level system driven at a frequency which varies with x, with some damping
+class driven_system : public squids::SQuIDS{
+	SU_vector drive, splitting, damping;
+public:
+	mutable unsigned long evaluations;
+	driven_system(unsigned int nx):
+	SQuIDS(nx,3,1,0,0.),
+	drive(SU_vector::Generator(3,1)+0.5*SU_vector::Generator(3,6)),
+	splitting(SU_vector::Generator(3,3)+0.3*SU_vector::Generator(3,8)),
+	damping(0.05*SU_vector::Generator(3,0)+0.02*SU_vector::Generator(3,8)),
+	evaluations(0){
+		Set_xrange(1.,2.,"lin");
+		Set_CoherentRhoTerms(true);
+		Set_NonCoherentRhoTerms(true);
+		for(unsigned int ix=0; ix<nx; ix++)
+			state[ix].rho[0]=SU_vector::Projector(3,0);
+	}
+	void PreDerive(double t){ evaluations++; }
+	SU_vector HI(unsigned int ix, unsigned int irho, double t) const{
+		return(Get_x(ix)*(drive*std::cos(2*t)+splitting));
+	}
+	SU_vector GammaRho(unsigned int ix, unsigned int irho, double t) const{
+		return(damping);
+	}
+};
+
+const char* name(integrator method){
+	switch(method){
+		case integrator::dormand_prince_54: return("Dormand-Prince 5(4)");
+		case integrator::tsitouras_54: return("Tsitouras 5(4)");
+		case integrator::verner_65: return("Verner 6(5)");
+		default: return("GSL");
+	}
+}
+
+double max_difference(driven_system& a, driven_system& b){
+	double diff=0;
+	for(unsigned int ix=0; ix<a.Get_nx(); ix++){
+		for(unsigned int i=0; i<3; i++){
+			SU_vector p=SU_vector::Projector(3,i);
+			diff=std::max(diff,std::abs(a.GetExpectationValue(p,0,ix)-b.GetExpectationValue(p,0,ix)));
+		}
+	}
+	return(diff);
+}
+
+int main(){
+	const unsigned int nx=6;
+	const double duration=5., tolerance=1e-8;
+	const integrator methods[]={integrator::dormand_prince_54,integrator::tsitouras_54,integrator::verner_65};
+	const unsigned int orders[]={5,5,6};
+	
+	driven_system reference(nx);
+	reference.Set_rel_error(1e-13);
+	reference.Set_abs_error(1e-13);
+	reference.Evolve(duration);
+	
+	driven_system rkf45(nx);
+	rkf45.Set_rel_error(tolerance);
+	rkf45.Set_abs_error(tolerance);
+	rkf45.Evolve(duration);
+	if(max_difference(rkf45,reference)>1e-5)
+		std::cout << "GSL result is inaccurate" << std::endl;
+	
+	for(unsigned int m=0; m<3; m++){
+		//adaptive stepping, split over several calls
+		driven_system sys(nx);
+		sys.Set_Integrator(methods[m]);
+		if(sys.Get_Integrator()!=methods[m])
+			std::cout << name(methods[m]) << ": wrong integrator setting" << std::endl;
+		sys.Set_rel_error(tolerance);
+		sys.Set_abs_error(tolerance);
+		for(unsigned int i=0; i<10; i++)
+			sys.Evolve(duration/10);
+		if(std::abs(sys.Get_t()-duration)>1e-12)
+			std::cout << name(methods[m]) << ": evolution ended at the wrong time: " << sys.Get_t() << std::endl;
+		if(sys.Get_h_last()<=0)
+			std::cout << name(methods[m]) << ": no step size was carried over" << std::endl;
+		double diff=max_difference(sys,reference);
+		if(diff>1e-5)
+			std::cout << name(methods[m]) << ": difference from reference is " << diff << std::endl;
+		if(sys.evaluations>=rkf45.evaluations)
+			std::cout << name(methods[m]) << " used " << sys.evaluations
+			<< " derivative evaluations, compared to " << rkf45.evaluations << " for rkf45" << std::endl;
+		
+		//the convergence of fixed steps should reflect the order of the method
+		double errors[2];
+		for(unsigned int j=0; j<2; j++){
+			driven_system fixed(nx);
+			fixed.Set_Integrator(methods[m]);
+			fixed.Set_AdaptiveStep(false);
+			fixed.Set_NumSteps(40<<j);
+			fixed.Evolve(duration);
+			errors[j]=max_difference(fixed,reference);
+		}
+		double order=std::log2(errors[0]/errors[1]);
+		if(std::abs(order-orders[m])>0.6)
+			std::cout << name(methods[m]) << ": observed order " << order
+			<< " (errors " << errors[0] << ", " << errors[1] << ")" << std::endl;
+	}
+	
+	//evolving backwards should return to the initial state
+	driven_system round_trip(nx);
+	round_trip.Set_Integrator(integrator::verner_65);
+	round_trip.Set_rel_error(1e-10);
+	round_trip.Set_abs_error(1e-10);
+	round_trip.Evolve(duration);
+	round_trip.Evolve(-duration);
+	driven_system initial(nx);
+	if(max_difference(round_trip,initial)>1e-6)
+		std::cout << "Backward evolution did not return to the initial state" << std::endl;
+}
@@ -0,0 +1,135 @@
+#include <cmath>
+#include <iostream>
+#include <vector>
+#include <SQuIDS/SQuIDS.h>
+
+using squids::SU_vector;
+using squids::integrator;
+
+//A two level system whose particles are moved from higher to lower energies,
+//with a scalar which is redistributed in the same way
+class redistribution : public squids::SQuIDS{
+protected:
+	SU_vector B;
+	//the probability per unit time to move from node j to node i
+	double rate(unsigned int i, unsigned int j) const{
+		if(i>=j)
+			return(0);
+		return(0.3*Get_x(i)/(Get_x(j)*Get_x(j))*(Get_x(1)-Get_x(0)));
+	}
+	//the total probability per unit time to leave node j
+	double loss(unsigned int j) const{
+		double sum=0;
+		for(unsigned int i=0; i<j; i++)
+			sum+=rate(i,j);
+		return(sum);
+	}
+public:
+	redistribution(unsigned int nx, unsigned int nthreads):
+	SQuIDS(nx,2,1,1,0.),
+	B(SU_vector::Generator(2,1)+0.3*SU_vector::Generator(2,3)){
+		Set_xrange(1.,10.,"lin");
+		Set_CoherentRhoTerms(true);
+		Set_Integrator(integrator::tsitouras_54);
+		Set_rel_error(1e-10);
+		Set_abs_error(1e-10);
+		Set_NumThreads(nthreads);
+		for(unsigned int ix=0; ix<nx; ix++){
+			state[ix].rho[0]=(1.+0.1*ix)*SU_vector::Projector(2,0);
+			state[ix].scalar[0]=std::exp(-Get_x(ix));
+		}
+	}
+	SU_vector HI(unsigned int ix, unsigned int irho, double t) const{
+		return((1./Get_x(ix))*B);
+	}
+	const SU_vector& Rho(unsigned int ix) const{ return(state[ix].rho[0]); }
+	double Scalar(unsigned int ix) const{ return(state[ix].scalar[0]); }
+};
+
+//computes the redistribution in InteractionsRho and InteractionsScalar
+class explicit_sum : public redistribution{
+public:
+	explicit_sum(unsigned int nx):redistribution(nx,1){
+		Set_OtherRhoTerms(true);
+		Set_OtherScalarTerms(true);
+	}
+	SU_vector InteractionsRho(unsigned int ix, unsigned int irho, double t) const{
+		SU_vector sum(2);
+		for(unsigned int jx=0; jx<nx; jx++){
+			SU_vector term=rate(ix,jx)*estate[jx].rho[0];
+			sum+=term;
+		}
+		SU_vector term=loss(ix)*estate[ix].rho[0];
+		sum-=term;
+		return(sum);
+	}
+	double InteractionsScalar(unsigned int ix, unsigned int is, double t) const{
+		double sum=-loss(ix)*estate[ix].scalar[0];
+		for(unsigned int jx=0; jx<nx; jx++)
+			sum+=rate(ix,jx)*estate[jx].scalar[0];
+		return(sum);
+	}
+};
+
+//declares the redistribution as a non-local kernel
+class kernel_terms : public redistribution{
+public:
+	kernel_terms(unsigned int nx, unsigned int nthreads):redistribution(nx,nthreads){
+		Set_NonLocalRhoTerms(true);
+		Set_NonLocalScalarTerms(true);
+	}
+	double RhoKernel(unsigned int ix, unsigned int jx, unsigned int irho) const{
+		return(rate(ix,jx)-(ix==jx ? loss(jx) : 0.));
+	}
+	double ScalarKernel(unsigned int ix, unsigned int jx, unsigned int is) const{
+		return(rate(ix,jx)-(ix==jx ? loss(jx) : 0.));
+	}
+};
+
+int main(){
+	const unsigned int nx=150;
+	explicit_sum reference(nx);
+	kernel_terms serial(nx,1), threaded(nx,3);
+	reference.Evolve(3.);
+	serial.Evolve(3.);
+	threaded.Evolve(3.);
+	for(unsigned int ix=0; ix<nx; ix++){
+		for(unsigned int k=0; k<4; k++){
+			double expected=reference.Rho(ix)[k];
+			if(std::abs(serial.Rho(ix)[k]-expected)>1e-8*(1.+std::abs(expected)))
+				std::cout << "Mismatch at node " << ix << " component " << k << ": "
+				<< serial.Rho(ix)[k] << " != " << expected << std::endl;
+			if(threaded.Rho(ix)[k]!=serial.Rho(ix)[k])
+				std::cout << "Result depends on the number of threads at node " << ix << std::endl;
+		}
+		if(std::abs(serial.Scalar(ix)-reference.Scalar(ix))>1e-8*(1.+std::abs(reference.Scalar(ix))))
+			std::cout << "Scalar mismatch at node " << ix << ": " << serial.Scalar(ix)
+			<< " != " << reference.Scalar(ix) << std::endl;
+	}
+
+	//the kernels enter the Jacobian, coupling each component to the same
+	//component of the other nodes
+	const unsigned int nsmall=6;
+	kernel_terms small(nsmall,1);
+	small.Set_CoherentRhoTerms(false);
+	const size_t n=nsmall*5;
+	std::vector<double> dfdy(n*n), dfdt(n);
+	small.Jacobian(0.,dfdy.data(),dfdt.data());
+	for(unsigned int ix=0; ix<nsmall; ix++){
+		for(unsigned int jx=0; jx<nsmall; jx++){
+			double expected=small.RhoKernel(ix,jx,0);
+			for(unsigned int k=0; k<4; k++){
+				for(unsigned int l=0; l<4; l++){
+					double entry=dfdy[small.Get_StateIndex(ix,0,k)*n+small.Get_StateIndex(jx,0,l)];
+					if(entry!=(k==l ? expected : 0.))
+						std::cout << "Jacobian entry for nodes " << ix << ", " << jx << " and components "
+						<< k << ", " << l << " is " << entry << std::endl;
+				}
+			}
+			double entry=dfdy[small.Get_ScalarIndex(ix,0)*n+small.Get_ScalarIndex(jx,0)];
+			if(entry!=expected)
+				std::cout << "Jacobian entry for the scalars of nodes " << ix << " and " << jx
+				<< " is " << entry << " instead of " << expected << std::endl;
+		}
+	}
+}
@@ -0,0 +1,140 @@
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <SQuIDS/ObservableRecorder.h>
+
+using squids::SU_vector;
+using squids::integrator;
+
+//Two level systems oscillating with a frequency proportional to x
+class oscillator : public squids::SQuIDS{
+	SU_vector splitting;
+public:
+	oscillator(unsigned int nx):
+	SQuIDS(nx,2,1,0,0.),
+	splitting(SU_vector::Generator(2,1)+0.2*SU_vector::Generator(2,3)){
+		Set_xrange(1.,3.,"lin");
+		Set_CoherentRhoTerms(true);
+		Set_Integrator(integrator::dormand_prince_54);
+		for(unsigned int ix=0; ix<nx; ix++)
+			state[ix].rho[0]=SU_vector::Projector(2,0);
+	}
+	SU_vector HI(unsigned int ix, unsigned int irho, double t) const{
+		return(Get_x(ix)*splitting);
+	}
+};
+
+template<typename T>
+T read(std::ifstream& in){
+	T value;
+	in.read(reinterpret_cast<char*>(&value),sizeof(value));
+	return(value);
+}
+
+int main(){
+	const char* path="observable_recorder.test.dat";
+	const char* csv_path="observable_recorder.test.csv";
+	const unsigned int nx=3;
+	const SU_vector ops[2]={SU_vector::Projector(2,0),SU_vector::Generator(2,1)};
+	
+	//the expected samples, one row per sample
+	std::vector<std::vector<double>> expected;
+	oscillator sys(nx);
+	{
+		//a small ring, so that it fills up and the samples span several blocks
+		squids::ObservableRecorder recorder(path,csv_path,8);
+		recorder.AddObservable("P0",ops[0],0);
+		recorder.AddObservable("L1",ops[1],0);
+		auto observe=[&](const oscillator::stateView& view){
+			std::vector<double> row(1,view.Get_t());
+			for(unsigned int k=0; k<2; k++){
+				for(unsigned int ix=0; ix<nx; ix++)
+					row.push_back(view.GetExpectationValue(ops[k],0,ix));
+			}
+			expected.push_back(row);
+			recorder(view);
+		};
+		std::vector<double> times;
+		for(unsigned int i=0; i<50; i++)
+			times.push_back(0.05*i);
+		sys.Evolve(times,observe);
+		//samples can also be taken from the system itself
+		for(unsigned int i=0; i<3; i++){
+			sys.Evolve(0.1);
+			std::vector<double> row(1,sys.Get_t());
+			for(unsigned int k=0; k<2; k++){
+				for(unsigned int ix=0; ix<nx; ix++)
+					row.push_back(sys.GetExpectationValue(ops[k],0,ix));
+			}
+			expected.push_back(row);
+			recorder.Record(sys);
+		}
+		try{
+			recorder.AddObservable("late",ops[0],0);
+			std::cout << "Adding an observable after recording did not throw" << std::endl;
+		}catch(std::runtime_error&){}
+		recorder.Close();
+		if(recorder.Get_NumSamples()!=expected.size())
+			std::cout << "Recorded " << recorder.Get_NumSamples() << " samples instead of " << expected.size() << std::endl;
+	}
+	
+	std::ifstream in(path,std::ios::binary);
+	char magic[8];
+	in.read(magic,8);
+	if(std::memcmp(magic,"SQuIDSob",8)!=0 || read<uint32_t>(in)!=1 || read<uint32_t>(in)!=0x01020304)
+		std::cout << "Bad file header" << std::endl;
+	if(read<uint32_t>(in)!=nx || read<uint32_t>(in)!=2)
+		std::cout << "Wrong dimensions in file header" << std::endl;
+	const char* names[2]={"P0","L1"};
+	for(unsigned int k=0; k<2; k++){
+		std::string name(read<uint32_t>(in),' ');
+		in.read(&name[0],name.size());
+		if(name!=names[k] || read<uint32_t>(in)!=0)
+			std::cout << "Wrong observable " << name << std::endl;
+	}
+	for(unsigned int ix=0; ix<nx; ix++){
+		if(read<double>(in)!=sys.Get_x(ix))
+			std::cout << "Wrong x value in file header" << std::endl;
+	}
+	size_t sample=0, blocks=0;
+	while(true){
+		uint32_t count=read<uint32_t>(in);
+		if(!in)
+			break;
+		blocks++;
+		for(unsigned int c=0; c<1+2*nx; c++){
+			for(uint32_t i=0; i<count; i++){
+				double value=read<double>(in);
+				if(sample+i>=expected.size() || value!=expected[sample+i][c]){
+					std::cout << "Wrong value in column " << c << " of sample " << sample+i << std::endl;
+					return(0);
+				}
+			}
+		}
+		sample+=count;
+	}
+	if(sample!=expected.size() || blocks!=(expected.size()+7)/8)
+		std::cout << "Read " << sample << " samples in " << blocks << " blocks" << std::endl;
+	in.close();
+	
+	std::ifstream csv(csv_path);
+	std::string line;
+	std::getline(csv,line);
+	if(line!="t,P0_0,P0_1,P0_2,L1_0,L1_1,L1_2")
+		std::cout << "Wrong CSV header: " << line << std::endl;
+	size_t rows=0;
+	while(std::getline(csv,line)){
+		if(std::abs(std::stod(line)-expected[rows][0])>1e-14)
+			std::cout << "Wrong time in CSV row " << rows << std::endl;
+		rows++;
+	}
+	if(rows!=expected.size())
+		std::cout << "CSV has " << rows << " rows" << std::endl;
+	
+	std::remove(path);
+	std::remove(csv_path);
+}
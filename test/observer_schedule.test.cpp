@@ -0,0 +1,147 @@
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+#include <SQuIDS/SQuIDS.h>
+
+using squids::SU_vector;
+using squids::integrator;
+
+//A three level system driven at a frequency which varies with x, with some damping
+class driven_system : public squids::SQuIDS{
+	SU_vector drive, splitting, damping;
+public:
+	mutable unsigned long evaluations;
+	driven_system(unsigned int nx):
+	SQuIDS(nx,3,1,0,0.),
+	drive(SU_vector::Generator(3,1)+0.5*SU_vector::Generator(3,6)),
+	splitting(SU_vector::Generator(3,3)+0.3*SU_vector::Generator(3,8)),
+	damping(0.05*SU_vector::Generator(3,0)+0.02*SU_vector::Generator(3,8)),
+	evaluations(0){
+		Set_xrange(1.,2.,"lin");
+		Set_CoherentRhoTerms(true);
+		Set_NonCoherentRhoTerms(true);
+		for(unsigned int ix=0; ix<nx; ix++)
+			state[ix].rho[0]=SU_vector::Projector(3,0);
+	}
+	void PreDerive(double t){ evaluations++; }
+	SU_vector H0(double x, unsigned int irho) const{
+		return(x*SU_vector::Generator(3,3));
+	}
+	SU_vector HI(unsigned int ix, unsigned int irho, double t) const{
+		return(Get_x(ix)*(drive*std::cos(2*t)+splitting));
+	}
+	SU_vector GammaRho(unsigned int ix, unsigned int irho, double t) const{
+		return(damping);
+	}
+};
+
+const unsigned int nx=4;
+const SU_vector projector=SU_vector::Projector(3,1);
+
+//records the population of the second level at the first and last nodes
+struct recorder{
+	std::vector<double> times, first, last;
+	void operator()(const driven_system::stateView& view){
+		times.push_back(view.Get_t());
+		first.push_back(view.GetExpectationValue(projector,0,0));
+		last.push_back(view.GetExpectationValue(projector,0,view.Get_nx()-1));
+	}
+};
+
+//evolves a copy of the system with output at the given times, checking the
+//output against a precise reference with the given tolerance
+recorder run(integrator method, const std::vector<double>& times, bool threaded, const recorder& reference, double tolerance, const char* label){
+	driven_system sys(nx);
+	sys.Set_Integrator(method);
+	sys.Set_rel_error(1e-9);
+	sys.Set_abs_error(1e-9);
+	recorder rec;
+	sys.Evolve(times,std::ref(rec),threaded);
+	if(rec.times!=times)
+		std::cout << label << ": observer was not called at the requested times" << std::endl;
+	else{
+		double diff=0;
+		for(unsigned int i=0; i<times.size(); i++)
+			diff=std::max(diff,std::max(std::abs(rec.first[i]-reference.first[i]),std::abs(rec.last[i]-reference.last[i])));
+		if(diff>tolerance)
+			std::cout << label << ": output differs from reference by " << diff << std::endl;
+	}
+	if(std::abs(sys.Get_t()-times.back())>1e-12)
+		std::cout << label << ": evolution ended at the wrong time: " << sys.Get_t() << std::endl;
+	if(sys.Get_PersistentDriver())
+		std::cout << label << ": persistent driver setting was changed" << std::endl;
+	return(rec);
+}
+
+int main(){
+	//many output times, including the initial time and a repeated time
+	std::vector<double> times;
+	times.push_back(0);
+	for(unsigned int i=0; i<=200; i++)
+		times.push_back(0.02*i);
+	
+	recorder reference;
+	{
+		driven_system sys(nx);
+		sys.Set_rel_error(1e-13);
+		sys.Set_abs_error(1e-13);
+		for(double at : times){
+			sys.Evolve(at-sys.Get_t());
+			reference.times.push_back(sys.Get_t());
+			reference.first.push_back(sys.GetExpectationValue(projector,0,0));
+			reference.last.push_back(sys.GetExpectationValue(projector,0,nx-1));
+		}
+	}
+	
+	recorder serial=run(integrator::dormand_prince_54,times,false,reference,1e-7,"Dormand-Prince 5(4)");
+	recorder threaded=run(integrator::dormand_prince_54,times,true,reference,1e-7,"Dormand-Prince 5(4), threaded");
+	if(serial.first!=threaded.first || serial.last!=threaded.last)
+		std::cout << "Threaded observer saw different states" << std::endl;
+	//Verner's method stops at each output time rather than interpolating
+	run(integrator::verner_65,times,false,reference,1e-7,"Verner 6(5)");
+	run(integrator::gsl,times,true,reference,1e-7,"GSL");
+	
+	//a single sweep must need far fewer evaluations than stopping at each time
+	driven_system sweep(nx), stops(nx);
+	for(driven_system* sys : {&sweep,&stops}){
+		sys->Set_Integrator(integrator::dormand_prince_54);
+		sys->Set_rel_error(1e-8);
+		sys->Set_abs_error(1e-8);
+	}
+	sweep.Evolve(times,[](const driven_system::stateView&){});
+	for(double at : times)
+		stops.Evolve(at-stops.Get_t());
+	if(2*sweep.evaluations>stops.evaluations)
+		std::cout << "Sweep used " << sweep.evaluations << " evaluations, compared to "
+		<< stops.evaluations << " for separate calls" << std::endl;
+	
+	//backward evolution
+	std::vector<double> back;
+	for(unsigned int i=0; i<=10; i++)
+		back.push_back(4.-0.4*i);
+	recorder backward;
+	sweep.Evolve(back,std::ref(backward));
+	if(backward.times!=back)
+		std::cout << "Observer was not called at the requested times when evolving backward" << std::endl;
+	else if(std::abs(backward.first.front()-reference.first.back())>1e-5 || std::abs(backward.first.back()-reference.first.front())>1e-5)
+		std::cout << "Backward evolution gave wrong output" << std::endl;
+	
+	//times out of order
+	try{
+		std::vector<double> bad={1.,0.5,2.};
+		driven_system sys(nx);
+		sys.Evolve(bad,[](const driven_system::stateView&){});
+		std::cout << "Unordered output times did not throw" << std::endl;
+	}catch(std::runtime_error&){}
+	
+	//an exception in the observer thread reaches the caller
+	try{
+		driven_system sys(nx);
+		sys.Set_Integrator(integrator::tsitouras_54);
+		sys.Evolve(times,[](const driven_system::stateView& view){
+			if(view.Get_t()>1)
+				throw std::logic_error("observer failure");
+		},true);
+		std::cout << "Observer exception was not rethrown" << std::endl;
+	}catch(std::logic_error&){}
+}
@@ -0,0 +1,74 @@
+#include <cmath>
+#include <iostream>
+#include <SQuIDS/SQuIDS.h>
+
+//A system whose terms vary in cost and value from node to node
+class test_system : public squids::SQuIDS{
+public:
+	test_system(unsigned int nx):
+	SQuIDS(nx,3,2,1,0.){
+		Set_xrange(1.,10.,"log");
+		Set_CoherentRhoTerms(true);
+		Set_NonCoherentRhoTerms(true);
+		Set_GammaScalarTerms(true);
+		Set_rel_error(1e-10);
+		Set_abs_error(1e-10);
+		for(unsigned int ix=0; ix<nx; ix++){
+			for(unsigned int irho=0; irho<nrhos; irho++){
+				state[ix].rho[irho]=squids::SU_vector::Projector(nsun,irho);
+				state[ix].rho[irho]+=0.1*squids::SU_vector::Generator(nsun,1+ix%8);
+			}
+			state[ix].scalar[0]=1.+ix;
+		}
+	}
+	squids::SU_vector HI(unsigned int ix, unsigned int irho, double t) const{
+		squids::SU_vector h(nsun);
+		//make some nodes more expensive than others
+		unsigned int reps=1+3*(ix%5);
+		for(unsigned int r=0; r<reps; r++)
+			h+=squids::SU_vector::Generator(nsun,1+(ix+r)%8)*(std::cos(t*Get_x(ix))/reps);
+		return(h+irho*squids::SU_vector::Generator(nsun,3));
+	}
+	squids::SU_vector GammaRho(unsigned int ix, unsigned int irho, double t) const{
+		return(0.01*Get_x(ix)*squids::SU_vector::Projector(nsun,0));
+	}
+	double GammaScalar(unsigned int ix, unsigned int is, double t) const{
+		return(0.1/Get_x(ix));
+	}
+};
+
+int main(){
+	const unsigned int nx=57;
+	test_system serial(nx), parallel(nx);
+	parallel.Set_NumThreads(4);
+	parallel.Set_ThreadChunkSize(3);
+	if(parallel.Get_NumThreads()!=4)
+		std::cout << "Wrong number of threads: " << parallel.Get_NumThreads() << std::endl;
+	
+	serial.Evolve(2.);
+	parallel.Evolve(2.);
+	
+	//each node is computed in exactly the same way regardless of which thread
+	//handles it, so the results should be identical
+	for(unsigned int ix=0; ix<nx; ix++){
+		for(unsigned int irho=0; irho<2; irho++){
+			for(unsigned int j=0; j<9; j++){
+				double s=serial.GetExpectationValue(squids::SU_vector::Generator(3,j),irho,ix);
+				double p=parallel.GetExpectationValue(squids::SU_vector::Generator(3,j),irho,ix);
+				if(s!=p)
+					std::cout << "Mismatch at node " << ix << " rho " << irho << " component "
+					<< j << ": " << s << " != " << p << std::endl;
+			}
+		}
+	}
+	
+	//changing the affinity restarts the threads, which must remain usable
+	parallel.Set_ThreadAffinity(true);
+	parallel.Evolve(1.);
+	serial.Evolve(1.);
+	for(unsigned int ix=0; ix<nx; ix++){
+		if(serial.GetExpectationValue(squids::SU_vector::Generator(3,1),0,ix)!=
+		   parallel.GetExpectationValue(squids::SU_vector::Generator(3,1),0,ix))
+			std::cout << "Mismatch after restarting threads at node " << ix << std::endl;
+	}
+}
@@ -0,0 +1,69 @@
+#include <cmath>
+#include <iostream>
+#include <SQuIDS/SQuIDS.h>
+
+using squids::SU_vector;
+
+//A two level system driven at a frequency which varies with x
+class driven_system : public squids::SQuIDS{
+	SU_vector b1, b3;
+public:
+	mutable unsigned long evaluations;
+	driven_system(unsigned int nx):
+	SQuIDS(nx,2,1,0,0.),
+	b1(SU_vector::Generator(2,1)),
+	b3(SU_vector::Generator(2,3)),
+	evaluations(0){
+		Set_xrange(1.,2.,"lin");
+		Set_CoherentRhoTerms(true);
+		Set_rel_error(1e-9);
+		Set_abs_error(1e-9);
+		for(unsigned int ix=0; ix<nx; ix++)
+			state[ix].rho[0]=SU_vector::Projector(2,0);
+	}
+	void PreDerive(double t){ evaluations++; }
+	SU_vector HI(unsigned int ix, unsigned int irho, double t) const{
+		return(Get_x(ix)*(b1*std::cos(t)+0.5*b3));
+	}
+};
+
+int main(){
+	const unsigned int nx=8, segments=200;
+	const double duration=10.;
+	const SU_vector p0=SU_vector::Projector(2,0);
+	
+	driven_system reference(nx);
+	reference.Set_rel_error(1e-12);
+	reference.Set_abs_error(1e-12);
+	reference.Evolve(duration);
+	
+	driven_system fresh(nx), persistent(nx);
+	persistent.Set_PersistentDriver(true);
+	for(unsigned int i=0; i<segments; i++){
+		fresh.Evolve(duration/segments);
+		persistent.Evolve(duration/segments);
+	}
+	
+	if(persistent.Get_h_last()<=0)
+		std::cout << "No step size was carried over" << std::endl;
+	//starting each segment from a tiny step is much more expensive
+	if(2*persistent.evaluations>fresh.evaluations)
+		std::cout << "Persistent driver used " << persistent.evaluations
+		<< " derivative evaluations, compared to " << fresh.evaluations << std::endl;
+	if(std::abs(persistent.Get_t()-duration)>1e-12)
+		std::cout << "Evolution ended at the wrong time: " << persistent.Get_t() << std::endl;
+	for(unsigned int ix=0; ix<nx; ix++){
+		double expected=reference.GetExpectationValue(p0,0,ix);
+		double result=persistent.GetExpectationValue(p0,0,ix);
+		if(std::abs(result-expected)>1e-6)
+			std::cout << "Node " << ix << ": " << result << " != " << expected << std::endl;
+	}
+	
+	//setting the step explicitly discards the carried step
+	persistent.Set_h(1e-3);
+	if(persistent.Get_h_last()!=0)
+		std::cout << "Carried step size was not reset" << std::endl;
+	persistent.Evolve(1.);
+	if(persistent.Get_h_last()<=0)
+		std::cout << "No step size was carried over after reset" << std::endl;
+}
@@ -0,0 +1,99 @@
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <SQuIDS/SQuIDS.h>
+
+using squids::SU_vector;
+using squids::integrator;
+
+//A two level system with coherent and other terms
+class precessing : public squids::SQuIDS{
+	SU_vector B;
+public:
+	unsigned int pre_derive_calls;
+	precessing(unsigned int nx, unsigned int nthreads):
+	SQuIDS(nx,2,1,0,0.),
+	B(SU_vector::Generator(2,1)+0.5*SU_vector::Generator(2,3)),
+	pre_derive_calls(0){
+		Set_xrange(1.,10.,"lin");
+		Set_CoherentRhoTerms(true);
+		Set_OtherRhoTerms(true);
+		Set_rel_error(1e-8);
+		Set_abs_error(1e-8);
+		Set_NumThreads(nthreads);
+		for(unsigned int ix=0; ix<nx; ix++)
+			state[ix].rho[0]=SU_vector::Projector(2,0);
+	}
+	void PreDerive(double t){
+		pre_derive_calls++;
+	}
+	SU_vector HI(unsigned int ix, unsigned int irho, double t) const{
+		return((3./Get_x(ix))*B);
+	}
+	SU_vector InteractionsRho(unsigned int ix, unsigned int irho, double t) const{
+		return(-0.1*estate[ix].rho[irho]);
+	}
+};
+
+void check_empty(const char* name, const precessing::solverStats& stats){
+	if(stats.rhs_calls!=0 || stats.accepted_steps!=0 || stats.rejected_steps!=0
+	   || stats.min_step!=std::numeric_limits<double>::infinity()
+	   || stats.pre_derive_time!=0 || stats.hi_time!=0 || stats.gamma_rho_time!=0
+	   || stats.interactions_rho_time!=0 || stats.scalar_time!=0 || stats.nonlocal_time!=0)
+		std::cout << name << ": statistics are not empty" << std::endl;
+}
+
+int main(){
+	for(unsigned int nthreads : {1u,3u}){
+		precessing sys(50,nthreads);
+		check_empty("new system",sys.GetStats());
+
+		//an adaptive native integrator
+		sys.Set_Integrator(integrator::tsitouras_54);
+		sys.Evolve(5.);
+		precessing::solverStats stats=sys.GetStats();
+		if(stats.rhs_calls!=sys.pre_derive_calls)
+			std::cout << stats.rhs_calls << " derivative evaluations counted instead of " << sys.pre_derive_calls << std::endl;
+		if(stats.accepted_steps==0 || stats.rhs_calls<5*(stats.accepted_steps+stats.rejected_steps))
+			std::cout << stats.accepted_steps << " accepted and " << stats.rejected_steps
+			<< " rejected steps are inconsistent with " << stats.rhs_calls << " evaluations" << std::endl;
+		if(!(stats.min_step>0 && stats.min_step<=5./stats.accepted_steps))
+			std::cout << "Smallest step " << stats.min_step << " is inconsistent with "
+			<< stats.accepted_steps << " steps" << std::endl;
+		if(stats.timed){
+			if(!(stats.hi_time>0) || !(stats.interactions_rho_time>0) || !(stats.pre_derive_time>0))
+				std::cout << "Terms which were evaluated were not timed" << std::endl;
+			if(stats.scalar_time<0 || stats.gamma_rho_time<0 || stats.nonlocal_time!=0)
+				std::cout << "Invalid times for terms which were not used" << std::endl;
+		}else if(stats.hi_time!=0 || stats.pre_derive_time!=0)
+			std::cout << "Times recorded without timers" << std::endl;
+
+		//the statistics accumulate until they are reset
+		sys.Evolve(1.);
+		if(sys.GetStats().rhs_calls<=stats.rhs_calls)
+			std::cout << "Statistics were not accumulated" << std::endl;
+		sys.ResetStats();
+		check_empty("reset system",sys.GetStats());
+
+		//fixed steps
+		sys.Set_AdaptiveStep(false);
+		sys.Set_NumSteps(10);
+		sys.Evolve(1.);
+		stats=sys.GetStats();
+		if(stats.accepted_steps!=10 || stats.rejected_steps!=0 || std::abs(stats.min_step-0.1)>1e-15)
+			std::cout << "Fixed steps recorded as " << stats.accepted_steps << " accepted and "
+			<< stats.rejected_steps << " rejected, with smallest size " << stats.min_step << std::endl;
+
+		//a persistent GSL driver
+		sys.ResetStats();
+		sys.Set_AdaptiveStep(true);
+		sys.Set_Integrator(integrator::gsl);
+		sys.Set_GSL_step(gsl_odeiv2_step_rkf45);
+		sys.Set_PersistentDriver(true);
+		sys.Evolve(1.);
+		stats=sys.GetStats();
+		if(stats.accepted_steps==0 || !(stats.min_step>0) || stats.rhs_calls<stats.accepted_steps)
+			std::cout << "GSL steps recorded as " << stats.accepted_steps << " with smallest size "
+			<< stats.min_step << " and " << stats.rhs_calls << " evaluations" << std::endl;
+	}
+}
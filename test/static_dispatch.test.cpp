@@ -0,0 +1,134 @@
+#include <cmath>
+#include <iostream>
+#include <SQuIDS/SQuIDS.h>
+#include <SQuIDS/StaticSQuIDS.h>
+
+using squids::SU_vector;
+using squids::integrator;
+
+//The terms of a three level system with decoherence and a decaying scalar,
+//shared by the virtual and the statically dispatched versions
+struct terms{
+	SU_vector B, G;
+	terms():
+	B(SU_vector::Generator(3,1)+0.5*SU_vector::Generator(3,4)+0.2*SU_vector::Generator(3,8)),
+	G(0.05*SU_vector::Generator(3,0)+0.02*SU_vector::Generator(3,3)){}
+};
+
+template<typename State>
+void initialize(squids::SQuIDS& system, State* state, unsigned int nx){
+	system.Set_xrange(1.,10.,"log");
+	system.Set_Integrator(integrator::tsitouras_54);
+	system.Set_rel_error(1e-10);
+	system.Set_abs_error(1e-10);
+	for(unsigned int ix=0; ix<nx; ix++){
+		state[ix].rho[0]=SU_vector::Projector(3,0);
+		state[ix].rho[1]=SU_vector::Projector(3,1);
+		state[ix].scalar[0]=system.Get_x(ix);
+	}
+}
+
+class virtual_system : public squids::SQuIDS, terms{
+public:
+	virtual_system(unsigned int nx):SQuIDS(nx,3,2,1,0.){
+		Set_CoherentRhoTerms(true);
+		Set_NonCoherentRhoTerms(true);
+		Set_GammaScalarTerms(true);
+		initialize(*this,state.get(),nx);
+	}
+	SU_vector HI(unsigned int ix, unsigned int irho, double t) const{
+		return((irho ? -1. : 1.)/Get_x(ix)*B);
+	}
+	SU_vector GammaRho(unsigned int ix, unsigned int irho, double t) const{
+		return(G);
+	}
+	double GammaScalar(unsigned int ix, unsigned int is, double t) const{
+		return(0.1*Get_x(ix));
+	}
+	SU_vector InteractionsRho(unsigned int ix, unsigned int irho, double t) const{
+		return((0.01*std::sin(t))*estate[ix].rho[1-irho]);
+	}
+	const SU_vector& Rho(unsigned int ix, unsigned int irho) const{ return(state[ix].rho[irho]); }
+	double Scalar(unsigned int ix) const{ return(state[ix].scalar[0]); }
+};
+
+class static_system final
+: public squids::SQuIDS_static<static_system,squids::term_policy<true,true,false,true>>, terms{
+public:
+	static_system(unsigned int nx):SQuIDS_static(nx,3,2,1,0.){
+		initialize(*this,state.get(),nx);
+	}
+	SU_vector HI(unsigned int ix, unsigned int irho, double t) const{
+		return((irho ? -1. : 1.)/Get_x(ix)*B);
+	}
+	SU_vector GammaRho(unsigned int ix, unsigned int irho, double t) const{
+		return(G);
+	}
+	double GammaScalar(unsigned int ix, unsigned int is, double t) const{
+		return(0.1*Get_x(ix));
+	}
+	SU_vector InteractionsRho(unsigned int ix, unsigned int irho, double t) const{
+		return((0.01*std::sin(t))*estate[ix].rho[1-irho]);
+	}
+	const SU_vector& Rho(unsigned int ix, unsigned int irho) const{ return(state[ix].rho[irho]); }
+	double Scalar(unsigned int ix) const{ return(state[ix].scalar[0]); }
+};
+
+template<typename A, typename B>
+void compare(const char* name, const A& a, const B& b, unsigned int nx){
+	for(unsigned int ix=0; ix<nx; ix++){
+		for(unsigned int irho=0; irho<2; irho++){
+			for(unsigned int k=0; k<9; k++){
+				if(a.Rho(ix,irho)[k]!=b.Rho(ix,irho)[k]){
+					std::cout << name << ": mismatch at node " << ix << " rho " << irho << " component " << k
+					<< ": " << a.Rho(ix,irho)[k] << " != " << b.Rho(ix,irho)[k] << std::endl;
+					return;
+				}
+			}
+		}
+		if(a.Scalar(ix)!=b.Scalar(ix)){
+			std::cout << name << ": scalar mismatch at node " << ix << ": "
+			<< a.Scalar(ix) << " != " << b.Scalar(ix) << std::endl;
+			return;
+		}
+	}
+}
+
+int main(){
+	const unsigned int nx=40;
+	{ //the constructor enables the terms of the policy, and the statically
+		//dispatched derivative is identical to the virtual one
+		virtual_system v(nx);
+		static_system s(nx);
+		v.Evolve(3.);
+		s.Evolve(3.);
+		compare("static terms",v,s,nx);
+	}
+	{ //with a selected term disabled at run time
+		virtual_system v(nx);
+		static_system s(nx);
+		v.Set_NonCoherentRhoTerms(false);
+		s.Set_NonCoherentRhoTerms(false);
+		v.Evolve(3.);
+		s.Evolve(3.);
+		compare("disabled term",v,s,nx);
+	}
+	{ //a term outside the policy falls back to the general computation
+		virtual_system v(nx);
+		static_system s(nx);
+		v.Set_OtherRhoTerms(true);
+		s.Set_OtherRhoTerms(true);
+		v.Evolve(3.);
+		s.Evolve(3.);
+		compare("general terms",v,s,nx);
+	}
+	{ //and so do the terms which the library precomputes
+		virtual_system v(nx);
+		static_system s(nx);
+		v.Set_StaticHI(true);
+		s.Set_StaticHI(true);
+		v.Evolve(3.);
+		s.Evolve(3.);
+		compare("static HI",v,s,nx);
+	}
+}
@@ -0,0 +1,152 @@
+#include <cmath>
+#include <iostream>
+#include <SQuIDS/SQuIDS.h>
+
+using squids::SU_vector;
+using squids::integrator;
+
+//A three level system with a constant potential and constant damping, and
+//optionally a time dependent drive
+class constant_system : public squids::SQuIDS{
+	SU_vector potential, damping, drive;
+public:
+	double strength;
+	bool driven;
+	mutable unsigned long hi_calls, gamma_calls;
+	constant_system(bool static_terms):
+	SQuIDS(10,3,2,0,0.),
+	potential(SU_vector::Projector(3,0)+0.5*SU_vector::Generator(3,1)+0.2*SU_vector::Generator(3,6)),
+	damping(0.02*SU_vector::Generator(3,0)+0.01*SU_vector::Generator(3,2)),
+	drive(SU_vector::Generator(3,5)),
+	strength(1.),
+	driven(false),
+	hi_calls(0),
+	gamma_calls(0){
+		Set_xrange(1.,3.,"lin");
+		Set_CoherentRhoTerms(true);
+		Set_NonCoherentRhoTerms(true);
+		Set_Integrator(integrator::dormand_prince_54);
+		Set_rel_error(1e-10);
+		Set_abs_error(1e-10);
+		Set_StaticHI(static_terms);
+		Set_StaticGammaRho(static_terms);
+		for(unsigned int ix=0; ix<nx; ix++){
+			state[ix].rho[0]=SU_vector::Projector(3,0);
+			state[ix].rho[1]=SU_vector::Projector(3,2);
+		}
+	}
+	SU_vector HI(unsigned int ix, unsigned int irho, double t) const{
+		hi_calls++;
+		SU_vector h=(strength*Get_x(ix)*(irho==0 ? 1. : -1.))*potential;
+		if(driven)
+			h+=(0.1*std::sin(t))*drive;
+		return(h);
+	}
+	SU_vector GammaRho(unsigned int ix, unsigned int irho, double t) const{
+		gamma_calls++;
+		return((1.+irho)*damping);
+	}
+};
+
+//For SU(2) the static terms are applied as dense maps
+class two_level_system : public squids::SQuIDS{
+public:
+	mutable unsigned long calls;
+	two_level_system(bool static_terms):
+	SQuIDS(7,2,1,0,0.),
+	calls(0){
+		Set_xrange(1.,2.,"lin");
+		Set_CoherentRhoTerms(true);
+		Set_NonCoherentRhoTerms(true);
+		Set_Integrator(integrator::tsitouras_54);
+		Set_rel_error(1e-10);
+		Set_abs_error(1e-10);
+		Set_StaticHI(static_terms);
+		Set_StaticGammaRho(static_terms);
+		for(unsigned int ix=0; ix<nx; ix++)
+			state[ix].rho[0]=SU_vector::Projector(2,0);
+	}
+	SU_vector HI(unsigned int ix, unsigned int irho, double t) const{
+		calls++;
+		SU_vector h=SU_vector::Generator(2,1)+0.3*SU_vector::Generator(2,3);
+		return(Get_x(ix)*h);
+	}
+	SU_vector GammaRho(unsigned int ix, unsigned int irho, double t) const{
+		calls++;
+		return(0.05*SU_vector::Generator(2,0)+0.01*SU_vector::Generator(2,3));
+	}
+};
+
+bool compare(const constant_system& a, const constant_system& b, const char* label){
+	for(unsigned int ix=0; ix<a.Get_nx(); ix++){
+		for(unsigned int irho=0; irho<2; irho++){
+			for(unsigned int j=0; j<9; j++){
+				double va=a.GetExpectationValue(SU_vector::Generator(3,j),irho,ix);
+				double vb=b.GetExpectationValue(SU_vector::Generator(3,j),irho,ix);
+				if(std::abs(va-vb)>1e-8){
+					std::cout << label << ": mismatch at node " << ix << " rho " << irho
+					<< " component " << j << ": " << va << " != " << vb << std::endl;
+					return(false);
+				}
+			}
+		}
+	}
+	return(true);
+}
+
+int main(){
+	constant_system dynamic(false), fixed(true);
+	if(!fixed.Get_StaticHI() || !fixed.Get_StaticGammaRho() || dynamic.Get_StaticHI())
+		std::cout << "Static term settings not stored" << std::endl;
+	dynamic.Evolve(5.);
+	fixed.Evolve(5.);
+	compare(dynamic,fixed,"static terms");
+	//the terms are evaluated once for each node and density matrix
+	const unsigned long nterms=fixed.Get_nx()*2;
+	if(fixed.hi_calls!=nterms || fixed.gamma_calls!=nterms)
+		std::cout << "Static terms evaluated " << fixed.hi_calls << " and " << fixed.gamma_calls
+		<< " times instead of " << nterms << std::endl;
+
+	//the maps are kept until the option is set again
+	dynamic.strength=fixed.strength=2.;
+	fixed.Set_StaticHI(true);
+	dynamic.Evolve(2.);
+	fixed.Evolve(2.);
+	compare(dynamic,fixed,"rebuilt maps");
+	if(fixed.hi_calls!=2*nterms || fixed.gamma_calls!=2*nterms)
+		std::cout << "Static terms not reevaluated exactly once" << std::endl;
+
+	//a time dependent HI together with a static GammaRho
+	dynamic.driven=fixed.driven=true;
+	fixed.Set_StaticHI(false);
+	dynamic.Evolve(2.);
+	fixed.Evolve(2.);
+	compare(dynamic,fixed,"static GammaRho");
+	if(fixed.gamma_calls!=3*nterms)
+		std::cout << "Static GammaRho evaluated " << fixed.gamma_calls << " times instead of "
+		<< 3*nterms << std::endl;
+
+	//only the enabled terms enter the maps
+	dynamic.driven=fixed.driven=false;
+	fixed.Set_StaticHI(true);
+	dynamic.Set_NonCoherentRhoTerms(false);
+	fixed.Set_NonCoherentRhoTerms(false);
+	dynamic.Evolve(1.);
+	fixed.Evolve(1.);
+	compare(dynamic,fixed,"disabled GammaRho");
+	
+	two_level_system dynamic2(false), fixed2(true);
+	dynamic2.Evolve(5.);
+	fixed2.Evolve(5.);
+	for(unsigned int ix=0; ix<fixed2.Get_nx(); ix++){
+		for(unsigned int j=0; j<4; j++){
+			double va=dynamic2.GetExpectationValue(SU_vector::Generator(2,j),0,ix);
+			double vb=fixed2.GetExpectationValue(SU_vector::Generator(2,j),0,ix);
+			if(std::abs(va-vb)>1e-8)
+				std::cout << "SU(2) mismatch at node " << ix << " component " << j << ": "
+				<< va << " != " << vb << std::endl;
+		}
+	}
+	if(fixed2.calls!=2*fixed2.Get_nx())
+		std::cout << "SU(2) static terms evaluated " << fixed2.calls << " times" << std::endl;
+}
@@ -0,0 +1,104 @@
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+#include <SQuIDS/SQuIDS.h>
+
+using squids::SU_vector;
+using squids::integrator;
+
+//Rapid two flavor oscillations with weak damping, which does not commute
+//with the Hamiltonian
+class damped_system : public squids::SQuIDS{
+	SU_vector potential, damping;
+public:
+	mutable unsigned long evaluations;
+	damped_system():
+	SQuIDS(4,2,1,0,0.),
+	evaluations(0){
+		Set_xrange(1.,2.,"lin");
+		Set_CoherentRhoTerms(true);
+		Set_NonCoherentRhoTerms(true);
+		Set_InteractionPicture(true);
+		params.SetMixingAngle(0,1,0.3);
+		potential=SU_vector::Projector(2,0);
+		potential.RotateToB1(params);
+		damping=0.05*SU_vector::Generator(2,0)+0.03*SU_vector::Generator(2,3);
+		for(unsigned int ix=0; ix<nx; ix++)
+			state[ix].rho[0]=potential;
+	}
+	void PreDerive(double t){ evaluations++; }
+	SU_vector H0(double x, unsigned int irho) const{
+		return(x*100.*SU_vector::Projector(2,1));
+	}
+	SU_vector HI(unsigned int ix, unsigned int irho, double t) const{
+		return(20.*potential);
+	}
+	SU_vector GammaRho(unsigned int ix, unsigned int irho, double t) const{
+		return(damping);
+	}
+};
+
+double max_difference(squids::SQuIDS& a, squids::SQuIDS& b){
+	double diff=0;
+	const SU_vector p=SU_vector::Projector(2,0);
+	for(unsigned int ix=0; ix<a.Get_nx(); ix++)
+		diff=std::max(diff,std::abs(a.GetExpectationValue(p,0,ix)-b.GetExpectationValue(p,0,ix)));
+	return(diff);
+}
+
+int main(){
+	const double duration=4.;
+	damped_system reference;
+	reference.Set_Integrator(integrator::verner_65);
+	reference.Set_rel_error(1e-12);
+	reference.Set_abs_error(1e-12);
+	reference.Evolve(duration);
+	
+	damped_system unsplit;
+	unsplit.Set_Integrator(integrator::dormand_prince_54);
+	unsplit.Set_rel_error(1e-7);
+	unsplit.Set_abs_error(1e-7);
+	unsplit.Evolve(duration);
+	
+	double errors[2];
+	unsigned long evaluations=0;
+	for(unsigned int j=0; j<2; j++){
+		damped_system split;
+		split.Set_Integrator(integrator::dormand_prince_54);
+		split.Set_rel_error(1e-10);
+		split.Set_abs_error(1e-10);
+		split.Set_SplitStep(0.02/(1<<j));
+		if(split.Get_SplitStep()!=0.02/(1<<j))
+			std::cout << "Wrong split step setting" << std::endl;
+		split.Evolve(duration/2);
+		split.Evolve(duration/2);
+		if(std::abs(split.Get_t()-duration)>1e-12)
+			std::cout << "Evolution ended at the wrong time: " << split.Get_t() << std::endl;
+		errors[j]=max_difference(reference,split);
+		if(j==0)
+			evaluations=split.evaluations;
+	}
+	//splitting is second order
+	double order=std::log2(errors[0]/errors[1]);
+	if(std::abs(order-2)>0.3)
+		std::cout << "Observed order " << order << " (errors " << errors[0] << ", " << errors[1] << ")" << std::endl;
+	//with steps of 0.02 the accuracy is similar to that of the unsplit evolution
+	if(errors[0]>1e-5)
+		std::cout << "Split evolution differs from the reference by " << errors[0] << std::endl;
+	//the damping is so weak that the remaining terms need very few steps
+	if(evaluations*2>unsplit.evaluations)
+		std::cout << "Split evolution used " << evaluations << " derivative evaluations, compared to "
+		<< unsplit.evaluations << " without splitting" << std::endl;
+	
+	damped_system magnus;
+	magnus.Set_Integrator(integrator::magnus_4);
+	magnus.Set_SplitStep(0.1);
+	try{
+		magnus.Evolve(1.);
+		std::cout << "Splitting with the Magnus integrator did not fail" << std::endl;
+	}catch(std::runtime_error&){}
+	try{
+		magnus.Set_SplitStep(-1);
+		std::cout << "Setting a negative split step did not fail" << std::endl;
+	}catch(std::runtime_error&){}
+}
@@ -0,0 +1,85 @@
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+#include <SQuIDS/SQuIDS.h>
+
+using squids::SU_vector;
+using squids::integrator;
+
+//A self-interacting system in the style of the collective oscillation
+//example, whose Hamiltonian depends on the sum of the states of all nodes
+class self_interacting : public squids::SQuIDS{
+	SU_vector B;
+	std::vector<double> weights;
+public:
+	SU_vector P;
+	self_interacting(unsigned int nx, unsigned int nthreads):
+	SQuIDS(nx,2,1,0,0.),
+	B(SU_vector::Generator(2,3)),
+	weights(nx){
+		Set_xrange(-1.,1.,"lin");
+		Set_CoherentRhoTerms(true);
+		Set_Integrator(integrator::tsitouras_54);
+		Set_rel_error(1e-8);
+		Set_abs_error(1e-8);
+		Set_NumThreads(nthreads);
+		for(unsigned int ix=0; ix<nx; ix++){
+			weights[ix]=1./(1.+ix%7);
+			state[ix].rho[0]=0.5*SU_vector::Generator(2,0)+0.4*SU_vector::Generator(2,1)
+			+(0.1*std::sin(ix))*SU_vector::Generator(2,3);
+		}
+	}
+	const double* Get_weights() const{ return(weights.data()); }
+	const SU_vector& Rho(unsigned int ix) const{ return(state[ix].rho[0]); }
+	void PreDerive(double t){
+		SumRho(P,0,weights.data());
+	}
+	SU_vector HI(unsigned int ix, unsigned int irho, double t) const{
+		SU_vector h=Get_x(ix)*B;
+		h+=(5./nx)*P;
+		return(h);
+	}
+};
+
+int main(){
+	const unsigned int nx=301;
+	self_interacting serial(nx,1), threaded(nx,3);
+
+	//the sum agrees with a plain loop over the nodes
+	SU_vector total, weighted;
+	serial.SumRho(total,0);
+	serial.SumRho(weighted,0,serial.Get_weights());
+	SU_vector expected_total(2), expected_weighted(2);
+	for(unsigned int ix=0; ix<nx; ix++){
+		SU_vector rho=serial.Rho(ix);
+		expected_total+=rho;
+		expected_weighted+=serial.Get_weights()[ix]*rho;
+	}
+	for(unsigned int k=0; k<4; k++){
+		if(std::abs(total[k]-expected_total[k])>1e-12*nx)
+			std::cout << "Sum differs in component " << k << ": " << total[k] << " != " << expected_total[k] << std::endl;
+		if(std::abs(weighted[k]-expected_weighted[k])>1e-12*nx)
+			std::cout << "Weighted sum differs in component " << k << ": " << weighted[k] << " != " << expected_weighted[k] << std::endl;
+	}
+
+	//the result does not depend on the number of threads
+	SU_vector threaded_total;
+	threaded.SumRho(threaded_total,0);
+	if(!(threaded_total==total))
+		std::cout << "Sum depends on the number of threads" << std::endl;
+	serial.Evolve(2.);
+	threaded.Evolve(2.);
+	for(unsigned int ix=0; ix<nx; ix++){
+		for(unsigned int k=0; k<4; k++){
+			if(serial.Rho(ix)[k]!=threaded.Rho(ix)[k]){
+				std::cout << "Evolution depends on the number of threads at node " << ix << std::endl;
+				break;
+			}
+		}
+	}
+
+	try{
+		serial.SumRho(total,1);
+		std::cout << "Invalid rho index accepted" << std::endl;
+	}catch(std::runtime_error&){}
+}